@@ -0,0 +1,152 @@
+/**************************************************************************/
+/*  audio_sample_ring.cpp                                                 */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "audio_sample_ring.h"
+
+#ifdef GDEXTENSION
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/core/math.hpp>
+#else
+#include "core/error/error_macros.h"
+#include "core/math/math_funcs.h"
+#endif
+
+#include <cstring>
+
+// Enough to never run out of blocks before running out of samples, even with codecs that use tiny frames.
+const uint32_t AUDIO_SAMPLE_RING_BLOCK_CAPACITY = 1024;
+
+void AudioSampleRing::_discard_stale() {
+	const uint32_t current_epoch = epoch.load(std::memory_order_acquire);
+	uint32_t read = block_read.load(std::memory_order_relaxed);
+	const uint32_t write = block_write.load(std::memory_order_acquire);
+	uint64_t released_frame = read_frame.load(std::memory_order_relaxed);
+	while (read != write && blocks[read & block_mask].epoch != current_epoch) {
+		const Block &block = blocks[read & block_mask];
+		released_frame = block.start + block.frame_count;
+		read++;
+	}
+	read_frame.store(released_frame, std::memory_order_release);
+	block_read.store(read, std::memory_order_release);
+}
+
+void AudioSampleRing::init(int p_channel_count, int p_mix_rate, double p_duration_msec) {
+	ERR_FAIL_COND(p_channel_count <= 0 || p_mix_rate <= 0);
+	channel_count = p_channel_count;
+	capacity_frames = MAX((uint64_t)Math::ceil(p_mix_rate * p_duration_msec / 1000.0), (uint64_t)2);
+	// Resized from scratch so the array isn't shared with anything when we grab the write pointer.
+	samples = PackedFloat32Array();
+	samples.resize(capacity_frames * channel_count);
+	samples_write_ptr = samples.ptrw();
+	blocks.clear();
+	blocks.resize(AUDIO_SAMPLE_RING_BLOCK_CAPACITY);
+	block_mask = AUDIO_SAMPLE_RING_BLOCK_CAPACITY - 1;
+	write_frame.store(0);
+	block_write.store(0);
+	read_frame.store(0);
+	block_read.store(0);
+}
+
+int AudioSampleRing::get_channel_count() const {
+	return channel_count;
+}
+
+uint64_t AudioSampleRing::get_capacity_frames() const {
+	return capacity_frames;
+}
+
+uint64_t AudioSampleRing::get_buffered_frames() const {
+	return write_frame.load(std::memory_order_acquire) - read_frame.load(std::memory_order_acquire);
+}
+
+uint32_t AudioSampleRing::get_epoch() const {
+	return epoch.load(std::memory_order_acquire);
+}
+
+bool AudioSampleRing::push(const float *p_samples, uint32_t p_frame_count, double p_time, uint32_t p_epoch) {
+	ERR_FAIL_COND_V(p_frame_count > capacity_frames / 2, false);
+	const uint32_t block_index = block_write.load(std::memory_order_relaxed);
+	if (block_index - block_read.load(std::memory_order_acquire) >= blocks.size()) {
+		return false;
+	}
+	// Blocks never wrap around, when one doesn't fit before the end of the storage the tail is left unused.
+	uint64_t start = write_frame.load(std::memory_order_relaxed);
+	const uint64_t start_offset = start % capacity_frames;
+	if (start_offset + p_frame_count > capacity_frames) {
+		start += capacity_frames - start_offset;
+	}
+	if (start + p_frame_count - read_frame.load(std::memory_order_acquire) > capacity_frames) {
+		return false;
+	}
+	memcpy(samples_write_ptr + (start % capacity_frames) * channel_count, p_samples, p_frame_count * channel_count * sizeof(float));
+
+	Block &block = blocks[block_index & block_mask];
+	block.time = p_time;
+	block.start = start;
+	block.frame_count = p_frame_count;
+	block.epoch = p_epoch;
+	write_frame.store(start + p_frame_count, std::memory_order_release);
+	block_write.store(block_index + 1, std::memory_order_release);
+	return true;
+}
+
+bool AudioSampleRing::peek(double &r_time, uint32_t &r_frame_count, uint32_t &r_sample_offset) {
+	_discard_stale();
+	const uint32_t read = block_read.load(std::memory_order_relaxed);
+	if (read == block_write.load(std::memory_order_acquire)) {
+		return false;
+	}
+	const Block &block = blocks[read & block_mask];
+	r_time = block.time;
+	r_frame_count = block.frame_count;
+	r_sample_offset = (block.start % capacity_frames) * channel_count;
+	return true;
+}
+
+void AudioSampleRing::pop() {
+	_discard_stale();
+	const uint32_t read = block_read.load(std::memory_order_relaxed);
+	if (read == block_write.load(std::memory_order_acquire)) {
+		return;
+	}
+	const Block &block = blocks[read & block_mask];
+	read_frame.store(block.start + block.frame_count, std::memory_order_release);
+	block_read.store(read + 1, std::memory_order_release);
+}
+
+const PackedFloat32Array &AudioSampleRing::get_samples() const {
+	return samples;
+}
+
+uint32_t AudioSampleRing::flush() {
+	const uint32_t new_epoch = epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+	_discard_stale();
+	return new_epoch;
+}
@@ -0,0 +1,108 @@
+/**************************************************************************/
+/*  audio_sample_ring.h                                                   */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef AUDIO_SAMPLE_RING_H
+#define AUDIO_SAMPLE_RING_H
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/packed_float32_array.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/templates/local_vector.h"
+#include "core/variant/variant.h"
+
+#endif
+
+#include <atomic>
+#include <cstdint>
+
+// Interleaved float samples handed from the audio decode thread to the playback, preallocated for a fixed duration.
+// Samples are pushed in blocks that each carry the time of their first sample, a block is always stored contiguously
+// so the consumer can mix it straight out of the ring. Like SPSCRingBuffer, blocks are tagged with an epoch and
+// flush() drops whatever the producer pushes with an older one.
+class AudioSampleRing {
+	struct Block {
+		double time = 0.0;
+		// In frames since init(), wraps around the sample storage.
+		uint64_t start = 0;
+		uint32_t frame_count = 0;
+		uint32_t epoch = 0;
+	};
+
+	PackedFloat32Array samples;
+	// Taken once in init() while nothing else references the array, going through ptrw() afterwards
+	// would copy the whole array whenever someone else happens to hold a reference to it.
+	float *samples_write_ptr = nullptr;
+	int channel_count = 0;
+	uint64_t capacity_frames = 0;
+	LocalVector<Block> blocks;
+	uint32_t block_mask = 0;
+
+	// Producer and consumer positions live on separate cache lines to avoid false sharing.
+	alignas(64) std::atomic<uint64_t> write_frame = { 0 };
+	std::atomic<uint32_t> block_write = { 0 };
+	alignas(64) std::atomic<uint64_t> read_frame = { 0 };
+	std::atomic<uint32_t> block_read = { 0 };
+	std::atomic<uint32_t> epoch = { 0 };
+
+	void _discard_stale();
+
+public:
+	// Not thread safe, must be called before the producer and the consumer start using the ring.
+	void init(int p_channel_count, int p_mix_rate, double p_duration_msec);
+
+	int get_channel_count() const;
+	uint64_t get_capacity_frames() const;
+	// Exact from the consumer thread, an upper bound from the producer thread.
+	uint64_t get_buffered_frames() const;
+	uint32_t get_epoch() const;
+
+	// Producer side.
+
+	// Fails without copying anything when the block doesn't fit, blocks can't be larger than half the capacity.
+	bool push(const float *p_samples, uint32_t p_frame_count, double p_time, uint32_t p_epoch);
+
+	// Consumer side.
+
+	// Describes the oldest block of the current epoch, its samples start at r_sample_offset in get_samples().
+	bool peek(double &r_time, uint32_t &r_frame_count, uint32_t &r_sample_offset);
+	void pop();
+	const PackedFloat32Array &get_samples() const;
+	// Drops everything currently queued and starts a new epoch, returns the new epoch the producer should tag its blocks with.
+	uint32_t flush();
+};
+
+#endif // AUDIO_SAMPLE_RING_H
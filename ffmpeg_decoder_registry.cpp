@@ -0,0 +1,469 @@
+/**************************************************************************/
+/*  ffmpeg_decoder_registry.cpp                                           */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "ffmpeg_decoder_registry.h"
+
+#include "video_decoder.h"
+#include "yuv_cpu_converter.h"
+
+#ifdef GDEXTENSION
+#include "gdextension_build/gdex_print.h"
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+#include <godot_cpp/core/class_db.hpp>
+#else
+#include "core/config/project_settings.h"
+#include "core/io/dir_access.h"
+#include "core/io/file_access.h"
+#include "core/os/os.h"
+#endif
+
+extern "C" {
+#include "libavutil/opt.h"
+}
+
+#include <cstring>
+
+const char *DECODER_CALIBRATION_PATH = "user://ffmpeg_cache/decoder_calibration.dat";
+const int DECODER_CALIBRATION_VERSION = 1;
+const int CALIBRATION_FRAME_COUNT = 24;
+// Each decoder decodes the clip this many times, the fastest run counts.
+const int CALIBRATION_RUNS = 2;
+// Pixel counts up to which a video belongs to the SD and HD classes.
+const int64_t RESOLUTION_CLASS_SD_MAX_PIXELS = 1024 * 576;
+const int64_t RESOLUTION_CLASS_HD_MAX_PIXELS = 2048 * 1152;
+
+struct DecoderPreference {
+	AVCodecID codec_id;
+	const char *decoder_names[3];
+};
+
+// Used when neither an override nor a calibration result exists. FFmpeg's native AV1 decoder only works
+// with a hardware accelerator, libaom is far slower than dav1d.
+static const DecoderPreference DEFAULT_DECODER_PREFERENCES[] = {
+	{ AV_CODEC_ID_AV1, { "libdav1d", "libaom-av1", "av1" } },
+	{ AV_CODEC_ID_VP9, { "vp9", "libvpx-vp9", nullptr } },
+	{ AV_CODEC_ID_VP8, { "vp8", "libvpx", nullptr } },
+	{ AV_CODEC_ID_HEVC, { "hevc", nullptr, nullptr } },
+};
+
+FFmpegDecoderRegistry *FFmpegDecoderRegistry::singleton = nullptr;
+
+FFmpegDecoderRegistry *FFmpegDecoderRegistry::get_singleton() {
+	return singleton;
+}
+
+FFmpegDecoderRegistry::ResolutionClass FFmpegDecoderRegistry::get_resolution_class(int p_width, int p_height) {
+	const int64_t pixels = (int64_t)p_width * p_height;
+	if (pixels <= RESOLUTION_CLASS_SD_MAX_PIXELS) {
+		return RESOLUTION_CLASS_SD;
+	}
+	return pixels <= RESOLUTION_CLASS_HD_MAX_PIXELS ? RESOLUTION_CLASS_HD : RESOLUTION_CLASS_UHD;
+}
+
+bool FFmpegDecoderRegistry::decoder_supports_alpha(const AVCodec *p_decoder) {
+	return p_decoder != nullptr && strncmp(p_decoder->name, "libvpx", 6) == 0;
+}
+
+String FFmpegDecoderRegistry::_get_calibration_key(AVCodecID p_codec_id, ResolutionClass p_resolution_class) {
+	return vformat("%s/%d", avcodec_get_name(p_codec_id), (int)p_resolution_class);
+}
+
+void FFmpegDecoderRegistry::_load_calibration_results() {
+	calibration_results_loaded = true;
+	if (!FileAccess::file_exists(DECODER_CALIBRATION_PATH)) {
+		return;
+	}
+	Ref<FileAccess> file = FileAccess::open(DECODER_CALIBRATION_PATH, FileAccess::READ);
+	if (file.is_null()) {
+		return;
+	}
+	const Variant cached = file->get_var();
+	if (cached.get_type() != Variant::DICTIONARY) {
+		return;
+	}
+	const Dictionary cached_results = cached;
+	// Results from another FFmpeg build may name decoders that no longer exist or perform differently.
+	if ((int)cached_results.get("version", 0) != DECODER_CALIBRATION_VERSION || (int64_t)cached_results.get("avcodec_version", 0) != (int64_t)avcodec_version()) {
+		return;
+	}
+	calibration_results = cached_results.get("results", Dictionary());
+}
+
+void FFmpegDecoderRegistry::_save_calibration_results() const {
+	Dictionary cached_results;
+	cached_results["version"] = DECODER_CALIBRATION_VERSION;
+	cached_results["avcodec_version"] = (int64_t)avcodec_version();
+	cached_results["results"] = calibration_results;
+
+	const String cache_dir = String(DECODER_CALIBRATION_PATH).get_base_dir();
+	Error err = DirAccess::make_dir_recursive_absolute(cache_dir);
+	ERR_FAIL_COND_MSG(err != OK && err != ERR_ALREADY_EXISTS, vformat("Couldn't create decoder calibration cache directory '%s'.", cache_dir));
+	Ref<FileAccess> file = FileAccess::open(DECODER_CALIBRATION_PATH, FileAccess::WRITE);
+	ERR_FAIL_COND_MSG(file.is_null(), vformat("Couldn't write decoder calibration results to '%s'.", DECODER_CALIBRATION_PATH));
+	file->store_var(cached_results);
+}
+
+PackedStringArray FFmpegDecoderRegistry::_get_ranking(AVCodecID p_codec_id, ResolutionClass p_resolution_class, bool p_needs_alpha) {
+	PackedStringArray available;
+	const AVCodec *codec = nullptr;
+	void *iterator = nullptr;
+	while ((codec = av_codec_iterate(&iterator))) {
+		if (codec->id != p_codec_id || !av_codec_is_decoder(codec)) {
+			continue;
+		}
+		// Hardware-only wrappers fail to open on machines without the hardware, experimental decoders need opting in.
+		if (codec->capabilities & (AV_CODEC_CAP_HARDWARE | AV_CODEC_CAP_EXPERIMENTAL)) {
+			continue;
+		}
+		available.push_back(codec->name);
+	}
+
+	PackedStringArray preferred;
+	const String codec_name = avcodec_get_name(p_codec_id);
+	const String project_setting = "ffmpeg/decoder_ranking/" + codec_name;
+	if (ranking_overrides.has(codec_name)) {
+		preferred = ranking_overrides[codec_name];
+	} else if (ProjectSettings::get_singleton()->has_setting(project_setting)) {
+		preferred = ProjectSettings::get_singleton()->get_setting(project_setting);
+	} else {
+		if (p_needs_alpha) {
+			// Correct output beats speed, only libvpx decodes WebM alpha.
+			for (int i = 0; i < available.size(); i++) {
+				if (decoder_supports_alpha(avcodec_find_decoder_by_name(available[i].utf8().get_data()))) {
+					preferred.push_back(available[i]);
+				}
+			}
+		}
+		if (!calibration_results_loaded) {
+			_load_calibration_results();
+		}
+		const String calibration_key = _get_calibration_key(p_codec_id, p_resolution_class);
+		if (calibration_results.has(calibration_key)) {
+			preferred.push_back(calibration_results[calibration_key]);
+		}
+		for (const DecoderPreference &preference : DEFAULT_DECODER_PREFERENCES) {
+			if (preference.codec_id != p_codec_id) {
+				continue;
+			}
+			for (const char *decoder_name : preference.decoder_names) {
+				if (decoder_name != nullptr) {
+					preferred.push_back(decoder_name);
+				}
+			}
+		}
+	}
+
+	PackedStringArray ranking;
+	for (int i = 0; i < preferred.size(); i++) {
+		if (available.has(preferred[i]) && !ranking.has(preferred[i])) {
+			ranking.push_back(preferred[i]);
+		}
+	}
+	// Whatever is left keeps FFmpeg's order.
+	for (int i = 0; i < available.size(); i++) {
+		if (!ranking.has(available[i])) {
+			ranking.push_back(available[i]);
+		}
+	}
+	return ranking;
+}
+
+Vector<Ref<FFmpegCodec>> FFmpegDecoderRegistry::get_ranked_decoders(AVCodecID p_codec_id, int p_width, int p_height, bool p_needs_alpha) {
+	mutex->lock();
+	const PackedStringArray ranking = _get_ranking(p_codec_id, get_resolution_class(p_width, p_height), p_needs_alpha);
+	mutex->unlock();
+
+	Vector<Ref<FFmpegCodec>> decoders;
+	for (int i = 0; i < ranking.size(); i++) {
+		decoders.push_back(memnew(FFmpegCodec(avcodec_find_decoder_by_name(ranking[i].utf8().get_data()))));
+	}
+	return decoders;
+}
+
+const AVCodec *FFmpegDecoderRegistry::select_decoder(AVCodecID p_codec_id, int p_width, int p_height, bool p_needs_alpha) {
+	mutex->lock();
+	const PackedStringArray ranking = _get_ranking(p_codec_id, get_resolution_class(p_width, p_height), p_needs_alpha);
+	mutex->unlock();
+	return ranking.is_empty() ? nullptr : avcodec_find_decoder_by_name(ranking[0].utf8().get_data());
+}
+
+PackedStringArray FFmpegDecoderRegistry::get_decoder_names(const String &p_codec_name) const {
+	PackedStringArray names;
+	const AVCodecDescriptor *descriptor = avcodec_descriptor_get_by_name(p_codec_name.utf8().get_data());
+	ERR_FAIL_NULL_V_MSG(descriptor, names, vformat("Unknown codec '%s'.", p_codec_name));
+	const AVCodec *codec = nullptr;
+	void *iterator = nullptr;
+	while ((codec = av_codec_iterate(&iterator))) {
+		if (codec->id == descriptor->id && av_codec_is_decoder(codec)) {
+			names.push_back(codec->name);
+		}
+	}
+	return names;
+}
+
+PackedStringArray FFmpegDecoderRegistry::get_decoder_ranking(const String &p_codec_name, int p_width, int p_height) {
+	const AVCodecDescriptor *descriptor = avcodec_descriptor_get_by_name(p_codec_name.utf8().get_data());
+	ERR_FAIL_NULL_V_MSG(descriptor, PackedStringArray(), vformat("Unknown codec '%s'.", p_codec_name));
+	mutex->lock();
+	const PackedStringArray ranking = _get_ranking(descriptor->id, get_resolution_class(p_width, p_height), false);
+	mutex->unlock();
+	return ranking;
+}
+
+void FFmpegDecoderRegistry::set_decoder_ranking(const String &p_codec_name, const PackedStringArray &p_decoder_names) {
+	mutex->lock();
+	ranking_overrides.insert(p_codec_name, p_decoder_names);
+	mutex->unlock();
+}
+
+void FFmpegDecoderRegistry::clear_decoder_ranking(const String &p_codec_name) {
+	mutex->lock();
+	ranking_overrides.erase(p_codec_name);
+	mutex->unlock();
+}
+
+Error FFmpegDecoderRegistry::_encode_calibration_clip(const AVCodec *p_encoder, int p_width, int p_height, AVCodecParameters *r_params, LocalVector<AVPacket *> &r_packets) {
+	AVCodecContext *encoder_context = avcodec_alloc_context3(p_encoder);
+	ERR_FAIL_NULL_V(encoder_context, ERR_CANT_CREATE);
+	encoder_context->width = p_width;
+	encoder_context->height = p_height;
+	encoder_context->pix_fmt = AV_PIX_FMT_YUV420P;
+	encoder_context->time_base = AVRational{ 1, 30 };
+	encoder_context->framerate = AVRational{ 30, 1 };
+	encoder_context->gop_size = CALIBRATION_FRAME_COUNT / 2;
+	encoder_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	// The clip only has to decode like real content, not look good, so ask for the fastest encoding.
+	av_opt_set(encoder_context->priv_data, "preset", "ultrafast", 0);
+	av_opt_set(encoder_context->priv_data, "deadline", "realtime", 0);
+	av_opt_set_int(encoder_context->priv_data, "cpu-used", 8, 0);
+
+	int result = avcodec_open2(encoder_context, p_encoder, nullptr);
+	if (result < 0) {
+		avcodec_free_context(&encoder_context);
+		ERR_FAIL_V_MSG(ERR_CANT_OPEN, vformat("Couldn't open %s encoder for decoder calibration: %s", p_encoder->name, ffmpeg_get_error_message(result)));
+	}
+
+	AVFrame *frame = av_frame_alloc();
+	frame->width = p_width;
+	frame->height = p_height;
+	frame->format = AV_PIX_FMT_YUV420P;
+	result = av_frame_get_buffer(frame, 0);
+
+	AVPacket *packet = av_packet_alloc();
+	uint32_t noise = 0x9E3779B9;
+	for (int i = 0; i <= CALIBRATION_FRAME_COUNT && result >= 0; i++) {
+		const bool flushing = i == CALIBRATION_FRAME_COUNT;
+		if (!flushing) {
+			result = av_frame_make_writable(frame);
+			if (result < 0) {
+				break;
+			}
+			// A moving gradient with some noise, so frames neither compress to nothing nor are pure noise.
+			for (int plane = 0; plane < 3; plane++) {
+				const int plane_width = plane == 0 ? p_width : (p_width + 1) / 2;
+				const int plane_height = plane == 0 ? p_height : (p_height + 1) / 2;
+				for (int y = 0; y < plane_height; y++) {
+					uint8_t *row = frame->data[plane] + (int64_t)y * frame->linesize[plane];
+					for (int x = 0; x < plane_width; x++) {
+						noise ^= noise << 13;
+						noise ^= noise >> 17;
+						noise ^= noise << 5;
+						row[x] = (uint8_t)((plane == 0 ? x + y + i * 4 : 128 + ((x - y) >> 2)) + (noise & 7));
+					}
+				}
+			}
+			frame->pts = i;
+		}
+		result = avcodec_send_frame(encoder_context, flushing ? nullptr : frame);
+		while (result >= 0) {
+			result = avcodec_receive_packet(encoder_context, packet);
+			if (result >= 0) {
+				r_packets.push_back(av_packet_clone(packet));
+				av_packet_unref(packet);
+			}
+		}
+		if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+			result = 0;
+		}
+	}
+	av_packet_free(&packet);
+	av_frame_free(&frame);
+
+	if (result >= 0) {
+		result = avcodec_parameters_from_context(r_params, encoder_context);
+	}
+	avcodec_free_context(&encoder_context);
+	ERR_FAIL_COND_V_MSG(result < 0, FAILED, vformat("Couldn't encode decoder calibration clip with %s: %s", p_encoder->name, ffmpeg_get_error_message(result)));
+	ERR_FAIL_COND_V_MSG(r_packets.is_empty(), FAILED, vformat("%s produced no packets for the decoder calibration clip.", p_encoder->name));
+	return OK;
+}
+
+uint64_t FFmpegDecoderRegistry::_time_decode(const AVCodec *p_decoder, const AVCodecParameters *p_params, const LocalVector<AVPacket *> &p_packets) {
+	AVCodecContext *decoder_context = avcodec_alloc_context3(p_decoder);
+	if (decoder_context == nullptr) {
+		return 0;
+	}
+	avcodec_parameters_to_context(decoder_context, p_params);
+	// Same threading as playback.
+	decoder_context->thread_count = 0;
+	if (avcodec_open2(decoder_context, p_decoder, nullptr) < 0) {
+		avcodec_free_context(&decoder_context);
+		return 0;
+	}
+
+	AVFrame *frame = av_frame_alloc();
+	int decoded_frames = 0;
+	int result = 0;
+	const uint64_t start_usec = OS::get_singleton()->get_ticks_usec();
+	for (uint32_t i = 0; i <= p_packets.size() && result >= 0; i++) {
+		result = avcodec_send_packet(decoder_context, i < p_packets.size() ? p_packets[i] : nullptr);
+		while (result >= 0) {
+			result = avcodec_receive_frame(decoder_context, frame);
+			if (result >= 0) {
+				decoded_frames++;
+				av_frame_unref(frame);
+			}
+		}
+		if (result == AVERROR(EAGAIN)) {
+			result = 0;
+		}
+	}
+	const uint64_t elapsed_usec = OS::get_singleton()->get_ticks_usec() - start_usec;
+	av_frame_free(&frame);
+	avcodec_free_context(&decoder_context);
+
+	// A decoder that can't decode the whole clip is out of the running.
+	if (decoded_frames < CALIBRATION_FRAME_COUNT) {
+		return 0;
+	}
+	return MAX(elapsed_usec, (uint64_t)1);
+}
+
+String FFmpegDecoderRegistry::calibrate(const String &p_codec_name, int p_width, int p_height) {
+	ERR_FAIL_COND_V(p_width <= 0 || p_height <= 0, String());
+	const AVCodecDescriptor *descriptor = avcodec_descriptor_get_by_name(p_codec_name.utf8().get_data());
+	ERR_FAIL_NULL_V_MSG(descriptor, String(), vformat("Unknown codec '%s'.", p_codec_name));
+	const AVCodec *encoder = avcodec_find_encoder(descriptor->id);
+	ERR_FAIL_NULL_V_MSG(encoder, String(), vformat("Can't calibrate %s decoders, this FFmpeg build has no encoder to make a test clip with.", p_codec_name));
+
+	AVCodecParameters *params = avcodec_parameters_alloc();
+	LocalVector<AVPacket *> packets;
+	String fastest_decoder;
+	if (_encode_calibration_clip(encoder, p_width, p_height, params, packets) == OK) {
+		const ResolutionClass resolution_class = get_resolution_class(p_width, p_height);
+		mutex->lock();
+		const PackedStringArray candidates = _get_ranking(descriptor->id, resolution_class, false);
+		mutex->unlock();
+
+		uint64_t fastest_usec = UINT64_MAX;
+		for (int i = 0; i < candidates.size(); i++) {
+			const AVCodec *decoder = avcodec_find_decoder_by_name(candidates[i].utf8().get_data());
+			uint64_t best_run_usec = UINT64_MAX;
+			for (int run = 0; run < CALIBRATION_RUNS; run++) {
+				const uint64_t run_usec = _time_decode(decoder, params, packets);
+				if (run_usec == 0) {
+					break;
+				}
+				best_run_usec = MIN(best_run_usec, run_usec);
+			}
+			print_line(vformat("Decoder calibration: %s took %d usec for %d %dx%d frames.", candidates[i], best_run_usec == UINT64_MAX ? -1 : (int64_t)best_run_usec, CALIBRATION_FRAME_COUNT, p_width, p_height));
+			if (best_run_usec < fastest_usec) {
+				fastest_usec = best_run_usec;
+				fastest_decoder = candidates[i];
+			}
+		}
+
+		if (!fastest_decoder.is_empty()) {
+			mutex->lock();
+			calibration_results[_get_calibration_key(descriptor->id, resolution_class)] = fastest_decoder;
+			_save_calibration_results();
+			mutex->unlock();
+		}
+	}
+
+	for (AVPacket *packet : packets) {
+		av_packet_free(&packet);
+	}
+	avcodec_parameters_free(&params);
+	return fastest_decoder;
+}
+
+void FFmpegDecoderRegistry::clear_calibration() {
+	mutex->lock();
+	if (!calibration_results_loaded) {
+		_load_calibration_results();
+	}
+	calibration_results.clear();
+	_save_calibration_results();
+	mutex->unlock();
+}
+
+Array FFmpegDecoderRegistry::check_cpu_conversion(int p_width, int p_height) {
+	ERR_FAIL_COND_V(p_width <= 0 || p_height <= 0, Array());
+	YUVKernelCheck checks[YUVCPUConverter::MAX_KERNEL_CHECKS];
+	const int check_count = YUVCPUConverter::check_kernels(p_width, p_height, checks);
+
+	Array results;
+	for (int i = 0; i < check_count; i++) {
+		const YUVKernelCheck &check = checks[i];
+		print_line(vformat("CPU conversion check: %s %s-bit kernel is off by up to %.3f/255 from swscale (tolerance %.1f), %.1f MPix/s at %dx%d: %s.", check.name, check.high_bit_depth ? "10" : "8", check.max_error, YUVCPUConverter::KERNEL_CHECK_TOLERANCE, check.megapixels_per_second, p_width, p_height, check.passed ? "passed" : "FAILED"));
+		Dictionary result;
+		result["kernel"] = String(check.name);
+		result["high_bit_depth"] = check.high_bit_depth;
+		result["max_error"] = check.max_error;
+		result["tolerance"] = YUVCPUConverter::KERNEL_CHECK_TOLERANCE;
+		result["megapixels_per_second"] = check.megapixels_per_second;
+		result["passed"] = check.passed;
+		results.push_back(result);
+	}
+	return results;
+}
+
+void FFmpegDecoderRegistry::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_decoder_names", "codec_name"), &FFmpegDecoderRegistry::get_decoder_names);
+	ClassDB::bind_method(D_METHOD("get_decoder_ranking", "codec_name", "width", "height"), &FFmpegDecoderRegistry::get_decoder_ranking, DEFVAL(1920), DEFVAL(1080));
+	ClassDB::bind_method(D_METHOD("set_decoder_ranking", "codec_name", "decoder_names"), &FFmpegDecoderRegistry::set_decoder_ranking);
+	ClassDB::bind_method(D_METHOD("clear_decoder_ranking", "codec_name"), &FFmpegDecoderRegistry::clear_decoder_ranking);
+	ClassDB::bind_method(D_METHOD("calibrate", "codec_name", "width", "height"), &FFmpegDecoderRegistry::calibrate, DEFVAL(1920), DEFVAL(1080));
+	ClassDB::bind_method(D_METHOD("clear_calibration"), &FFmpegDecoderRegistry::clear_calibration);
+	ClassDB::bind_method(D_METHOD("check_cpu_conversion", "width", "height"), &FFmpegDecoderRegistry::check_cpu_conversion, DEFVAL(1920), DEFVAL(1080));
+}
+
+FFmpegDecoderRegistry::FFmpegDecoderRegistry() {
+	singleton = this;
+	mutex.instantiate();
+}
+
+FFmpegDecoderRegistry::~FFmpegDecoderRegistry() {
+	singleton = nullptr;
+}
@@ -0,0 +1,122 @@
+/**************************************************************************/
+/*  ffmpeg_decoder_registry.h                                             */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef FFMPEG_DECODER_REGISTRY_H
+#define FFMPEG_DECODER_REGISTRY_H
+
+#include "gdextension_build/sync_compat.h"
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/classes/object.hpp>
+#include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/array.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_string_array.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/object/object.h"
+#include "core/templates/hash_map.h"
+#include "core/templates/local_vector.h"
+#include "core/variant/array.h"
+#include "core/variant/dictionary.h"
+
+#endif
+
+#include "ffmpeg_codec.h"
+
+// Decides which of the decoders FFmpeg has for a codec a video gets decoded with. The ranking comes from,
+// in order: overrides set by the project, the fastest decoder found by calibration for the resolution class
+// of the video and a built-in preference list. Hardware-only decoders are left out.
+class FFmpegDecoderRegistry : public Object {
+	GDCLASS(FFmpegDecoderRegistry, Object);
+
+public:
+	enum ResolutionClass {
+		RESOLUTION_CLASS_SD,
+		RESOLUTION_CLASS_HD,
+		RESOLUTION_CLASS_UHD,
+	};
+
+private:
+	static FFmpegDecoderRegistry *singleton;
+
+	Ref<core_bind::Mutex> mutex;
+	// Decoder names in order of preference, keyed by codec name.
+	HashMap<String, PackedStringArray> ranking_overrides;
+	// Fastest decoder name keyed by "<codec name>/<resolution class>", persisted in the user cache.
+	Dictionary calibration_results;
+	bool calibration_results_loaded = false;
+
+	void _load_calibration_results();
+	void _save_calibration_results() const;
+	PackedStringArray _get_ranking(AVCodecID p_codec_id, ResolutionClass p_resolution_class, bool p_needs_alpha);
+	static String _get_calibration_key(AVCodecID p_codec_id, ResolutionClass p_resolution_class);
+	static Error _encode_calibration_clip(const AVCodec *p_encoder, int p_width, int p_height, AVCodecParameters *r_params, LocalVector<AVPacket *> &r_packets);
+	static uint64_t _time_decode(const AVCodec *p_decoder, const AVCodecParameters *p_params, const LocalVector<AVPacket *> &p_packets);
+
+protected:
+	static void _bind_methods();
+
+public:
+	static FFmpegDecoderRegistry *get_singleton();
+	static ResolutionClass get_resolution_class(int p_width, int p_height);
+	// Whether the decoder outputs the alpha channel WebM stores next to VP8 and VP9 video.
+	static bool decoder_supports_alpha(const AVCodec *p_decoder);
+
+	// Every usable decoder FFmpeg has for the codec, best first.
+	Vector<Ref<FFmpegCodec>> get_ranked_decoders(AVCodecID p_codec_id, int p_width, int p_height, bool p_needs_alpha);
+	// Best decoder for the codec, nullptr if FFmpeg has none.
+	const AVCodec *select_decoder(AVCodecID p_codec_id, int p_width, int p_height, bool p_needs_alpha);
+
+	PackedStringArray get_decoder_names(const String &p_codec_name) const;
+	PackedStringArray get_decoder_ranking(const String &p_codec_name, int p_width, int p_height);
+	void set_decoder_ranking(const String &p_codec_name, const PackedStringArray &p_decoder_names);
+	void clear_decoder_ranking(const String &p_codec_name);
+	// Encodes a short synthetic clip of the given size, times every decoder of the codec on it and remembers the
+	// fastest one for that resolution class. Blocks until done, which takes seconds for large sizes, and needs
+	// FFmpeg to have an encoder for the codec. Returns the name of the fastest decoder, empty on failure.
+	String calibrate(const String &p_codec_name, int p_width, int p_height);
+	void clear_calibration();
+	// Checks every CPU YUV to RGBA kernel this machine can run against swscale on a synthetic frame of the given
+	// size and measures its throughput. Returns one dictionary per kernel with its name, bit depth, largest error
+	// in 1/255 steps, the tolerance, megapixels per second and whether it passed.
+	Array check_cpu_conversion(int p_width, int p_height);
+
+	FFmpegDecoderRegistry();
+	~FFmpegDecoderRegistry();
+};
+
+#endif // FFMPEG_DECODER_REGISTRY_H
@@ -31,19 +31,26 @@
 #include "ffmpeg_frame.h"
 
 #ifdef GDEXTENSION
-#include <godot_cpp/variant/utility_functions.hpp>
+#include <godot_cpp/core/memory.hpp>
+#else
+#include "core/os/memory.h"
 #endif
 
-void FFmpegFrame::_bind_methods() {
-	ADD_SIGNAL(MethodInfo("return_frame", PropertyInfo(Variant::OBJECT, "frame", PROPERTY_HINT_RESOURCE_TYPE, "FFmpegFrame")));
-}
-
 AVFrame *FFmpegFrame::get_frame() const {
 	return frame;
 }
 
+void FFmpegFrame::set_return_func(ReturnFunc p_return_func, void *p_userdata) {
+	return_func = p_return_func;
+	return_userdata = p_userdata;
+}
+
 void FFmpegFrame::do_return() {
-	emit_signal("return_frame", this);
+	if (return_func == nullptr) {
+		memdelete(this);
+		return;
+	}
+	return_func(return_userdata, this);
 }
 
 FFmpegFrame::FFmpegFrame() {
@@ -31,36 +31,28 @@
 #ifndef FFMPEG_FRAME_H
 #define FFMPEG_FRAME_H
 
-#ifdef GDEXTENSION
-
-// Headers for building as GDExtension plug-in.
-#include <godot_cpp/classes/ref_counted.hpp>
-#include <godot_cpp/classes/weak_ref.hpp>
-#include <godot_cpp/godot.hpp>
-
-using namespace godot;
-
-#else
-
-#include "core/object/ref_counted.h"
-
-#endif
 extern "C" {
 #include "libavutil/frame.h"
 }
 
-class FFmpegFrame : public RefCounted {
-	GDCLASS(FFmpegFrame, RefCounted);
-
-protected:
-	static void _bind_methods();
+// Wrapper around an AVFrame meant to be recycled: instead of deleting it, whoever is done with it calls do_return()
+// which hands it back to its owner's free list through a plain function pointer.
+class FFmpegFrame {
+public:
+	typedef void (*ReturnFunc)(void *p_userdata, FFmpegFrame *p_frame);
 
 private:
 	AVFrame *frame = nullptr;
+	ReturnFunc return_func = nullptr;
+	void *return_userdata = nullptr;
 
 public:
+	// Intrusive free list link, only touched by the owner of the free list the frame is in.
+	FFmpegFrame *next_free = nullptr;
+
 	AVFrame *get_frame() const;
-	double get_time() const;
+	void set_return_func(ReturnFunc p_return_func, void *p_userdata);
+	// Hands the frame back to its owner, or deletes it if it has none. The frame must not be used afterwards.
 	void do_return();
 	FFmpegFrame();
 	~FFmpegFrame();
@@ -10,36 +10,46 @@ extern "C" {
 #ifdef ENABLE_STREAM_INFO
 #include "core/io/file_access.h"
 #include "ffmpeg_stream_info.h"
+#include "input_source.h"
 #include "video_decoder.h"
 
 int64_t FFmpegStreamInfo::_stream_seek_callback(void *p_opaque, int64_t p_offset, int p_whence) {
 	FFmpegStreamInfo *decoder = (FFmpegStreamInfo *)p_opaque;
-	switch (p_whence) {
+	InputSource *input_source = decoder->input_source;
+	switch (p_whence & ~AVSEEK_FORCE) {
 		case SEEK_CUR: {
-			decoder->current_file->seek(decoder->current_file->get_position() + p_offset);
+			input_source->seek(input_source->get_position() + p_offset);
 		} break;
 		case SEEK_SET: {
-			decoder->current_file->seek(p_offset);
+			input_source->seek(p_offset);
 		} break;
 		case SEEK_END: {
-			decoder->current_file->seek_end(p_offset);
+			input_source->seek(input_source->get_length() + p_offset);
 		} break;
 		case AVSEEK_SIZE: {
-			return decoder->current_file->get_length();
+			return input_source->get_length();
 		} break;
 		default: {
 			return -1;
 		} break;
 	}
-	return decoder->current_file->get_position();
+	return input_source->get_position();
 }
 
 int FFmpegStreamInfo::_read_packet_callback(void *p_opaque, uint8_t *p_buf, int p_buf_size) {
 	FFmpegStreamInfo *decoder = (FFmpegStreamInfo *)p_opaque;
-	uint64_t read_bytes = decoder->current_file->get_buffer(p_buf, p_buf_size);
+	int64_t read_bytes = decoder->input_source->read(p_buf, p_buf_size);
 	return read_bytes != 0 ? read_bytes : AVERROR_EOF;
 }
 
+void FFmpegStreamInfo::_close_input_source() {
+	if (input_source != nullptr) {
+		memdelete(input_source);
+		input_source = nullptr;
+	}
+	current_file.unref();
+}
+
 void FFmpegStreamInfo::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("load", "path"), &FFmpegStreamInfo::load);
 	ClassDB::bind_method(D_METHOD("get_video_stream_count"), &FFmpegStreamInfo::get_video_stream_count);
@@ -111,11 +121,19 @@ FFmpegStreamInfo::AudioCodec _ffmpeg_to_audio_codec(AVCodecID p_codec) {
 }
 
 int FFmpegStreamInfo::load(String p_path) {
-	Error err;
-	current_file = FileAccess::open(p_path, FileAccess::READ, &err);
-
-	if (err != OK) {
-		return err;
+	_close_input_source();
+	MappedInputSource *mapped_input_source = memnew(MappedInputSource);
+	if (mapped_input_source->open(p_path) == OK) {
+		input_source = mapped_input_source;
+	} else {
+		memdelete(mapped_input_source);
+		Error err;
+		current_file = FileAccess::open(p_path, FileAccess::READ, &err);
+
+		if (err != OK) {
+			return err;
+		}
+		input_source = memnew(FileInputSource(current_file));
 	}
 
 	avio_seek(io_context, 0, SEEK_SET);
@@ -137,6 +155,7 @@ int FFmpegStreamInfo::load(String p_path) {
 		av_free(io_context->buffer);
 		avio_context_free(&io_context);
 		avformat_free_context(format_context);
+		_close_input_source();
 		return FAILED;
 	}
 
@@ -147,6 +166,7 @@ int FFmpegStreamInfo::load(String p_path) {
 		av_free(io_context->buffer);
 		avio_context_free(&io_context);
 		avformat_free_context(format_context);
+		_close_input_source();
 		return FAILED;
 	}
 
@@ -167,6 +187,7 @@ int FFmpegStreamInfo::load(String p_path) {
 	av_free(io_context->buffer);
 	avio_context_free(&io_context);
 	avformat_free_context(format_context);
+	_close_input_source();
 
 	return OK;
 }
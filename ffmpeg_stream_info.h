@@ -37,6 +37,7 @@
 #include "core/object/ref_counted.h"
 
 class FileAccess;
+class InputSource;
 
 extern "C" {
 #include "libavcodec/avcodec.h"
@@ -66,6 +67,8 @@ public:
 
 private:
 	Ref<FileAccess> current_file;
+	// Memory mapped when possible, read through current_file otherwise.
+	InputSource *input_source = nullptr;
 
 	AVIOContext *io_context = nullptr;
 	AVFormatContext *format_context = nullptr;
@@ -74,6 +77,7 @@ private:
 
 	static int64_t _stream_seek_callback(void *p_opaque, int64_t p_offset, int p_whence);
 	static int _read_packet_callback(void *p_opaque, uint8_t *p_buf, int p_buf_size);
+	void _close_input_source();
 
 	struct VideoStream {
 		VideoCodec video_codec;
@@ -29,10 +29,12 @@
 /**************************************************************************/
 
 #include "ffmpeg_video_stream.h"
+#include "shared_file_cache.h"
 #include <iterator>
 
 #ifdef GDEXTENSION
 #include "gdextension_build/gdex_print.h"
+#include <godot_cpp/classes/audio_server.hpp>
 #include <godot_cpp/classes/rd_shader_file.hpp>
 #include <godot_cpp/classes/rd_shader_source.hpp>
 #include <godot_cpp/classes/rd_shader_spirv.hpp>
@@ -41,6 +43,7 @@
 #include <godot_cpp/classes/rd_uniform.hpp>
 #include <godot_cpp/classes/rendering_device.hpp>
 #include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
 typedef RenderingDevice RD;
 typedef RenderingServer RS;
 typedef RDTextureView RDTextureViewC;
@@ -81,6 +84,8 @@ RDTextureFormatC tfc_from_rdtf(Ref<RDTextureFormat> p_texture_format) {
 typedef int64_t ComputeListID;
 #define TEXTURE_FORMAT_COMPAT(tf) tfc_from_rdtf(tf);
 #else
+#include "core/object/worker_thread_pool.h"
+#include "servers/audio_server.h"
 #include "servers/rendering/rendering_device_binds.h"
 typedef RD::TextureFormat RDTextureFormatC;
 typedef RD::TextureView RDTextureViewC;
@@ -96,15 +101,40 @@ typedef RD::ComputeListID ComputeListID;
 #else
 #define FREE_RD_RID(rid) RS::get_singleton()->get_rendering_device()->free(rid);
 #endif
+
+static const uint32_t OUT_TEXTURE_USAGE_BITS = RD::TEXTURE_USAGE_SAMPLING_BIT | RD::TEXTURE_USAGE_COLOR_ATTACHMENT_BIT | RD::TEXTURE_USAGE_STORAGE_BIT | RD::TEXTURE_USAGE_CAN_COPY_TO_BIT | RD::TEXTURE_USAGE_CAN_UPDATE_BIT;
+
+static RD::DataFormat _get_output_data_format(YUVGPUConverter::OutputFormat p_output_format) {
+	switch (p_output_format) {
+		case YUVGPUConverter::OUTPUT_FORMAT_RGBA16: {
+			return RD::DATA_FORMAT_R16G16B16A16_UNORM;
+		}
+		case YUVGPUConverter::OUTPUT_FORMAT_RGB10A2: {
+			return RD::DATA_FORMAT_A2B10G10R10_UNORM_PACK32;
+		}
+		default: {
+			return RD::DATA_FORMAT_R8G8B8A8_UNORM;
+		}
+	}
+}
+
+// Image format qualifier of output_image in yuv_to_rgb.glsl.
+static const char *_get_output_format_qualifier(YUVGPUConverter::OutputFormat p_output_format) {
+	switch (p_output_format) {
+		case YUVGPUConverter::OUTPUT_FORMAT_RGBA16: {
+			return "rgba16";
+		}
+		case YUVGPUConverter::OUTPUT_FORMAT_RGB10A2: {
+			return "rgb10_a2";
+		}
+		default: {
+			return "rgba8";
+		}
+	}
+}
 void FFmpegVideoStreamPlayback::seek_into_sync() {
+	// Seeking also drops any frames still queued in the decoder.
 	decoder->seek(playback_position);
-	Vector<Ref<DecodedFrame>> decoded_frames;
-	for (Ref<DecodedFrame> df : available_frames) {
-		decoded_frames.push_back(df);
-	}
-	decoder->return_frames(decoded_frames);
-	available_frames.clear();
-	available_audio_frames.clear();
 }
 
 double FFmpegVideoStreamPlayback::get_current_frame_time() {
@@ -122,26 +152,104 @@ bool FFmpegVideoStreamPlayback::check_next_frame_valid(Ref<DecodedFrame> p_decod
 	return p_decoded_frame->get_time() <= playback_position && Math::abs(p_decoded_frame->get_time() - playback_position) < LENIENCE_BEFORE_SEEK;
 }
 
-bool FFmpegVideoStreamPlayback::check_next_audio_frame_valid(Ref<DecodedAudioFrame> p_decoded_frame) {
+bool FFmpegVideoStreamPlayback::check_next_audio_frame_valid(double p_audio_time) {
 	// in the case of looping, we may start a seek back to the beginning but still receive some lingering frames from the end of the last loop. these should be allowed to continue playing.
-	if (looping && Math::abs((p_decoded_frame->get_time() - decoder->get_duration()) - playback_position) < LENIENCE_BEFORE_SEEK)
+	if (looping && Math::abs((p_audio_time - decoder->get_duration()) - playback_position) < LENIENCE_BEFORE_SEEK)
 		return true;
 
-	return p_decoded_frame->get_time() <= playback_position && Math::abs(p_decoded_frame->get_time() - playback_position) < LENIENCE_BEFORE_SEEK;
+	return p_audio_time <= playback_position && Math::abs(p_audio_time - playback_position) < LENIENCE_BEFORE_SEEK;
+}
+
+bool FFmpegVideoStreamPlayback::check_audio_frame_stale(double p_audio_time) {
+	// Lingering frames from the end of the last loop are still going to be played.
+	if (looping && Math::abs((p_audio_time - decoder->get_duration()) - playback_position) < LENIENCE_BEFORE_SEEK) {
+		return false;
+	}
+	return p_audio_time < playback_position - LENIENCE_BEFORE_SEEK;
 }
 
+// VideoStreamPlayer asks for the channel count only once, possibly before an asynchronous load is done.
+// Asynchronously loaded videos are mixed to this many channels so the answer holds whatever the file has.
+static const int ASYNC_AUDIO_CHANNEL_COUNT = 2;
+
 const char *const upd_str = "update_internal";
 
+void FFmpegVideoStreamPlayback::_present_frame(const Ref<DecodedFrame> &p_frame) {
+	// YUV conversion
+	if (ffmpeg_get_frame_format_info(p_frame->get_format()).is_yuv) {
+		ERR_FAIL_COND(p_frame->get_yuv_plane_count() < 2);
+
+		int plane_offsets[4];
+		for (int i = 0; i < p_frame->get_yuv_plane_count(); i++) {
+			plane_offsets[i] = p_frame->get_yuv_plane_offset(i);
+		}
+		yuv_converter->set_yuv_data(p_frame->get_yuv_data(), p_frame->get_format(), plane_offsets, p_frame->get_yuv_plane_count());
+		yuv_converter->convert();
+		return;
+	}
+
+	const Ref<Image> frame_image = p_frame->get_image();
+	if (yuv_converter.is_valid()) {
+		yuv_converter->upload_rgba_image(frame_image);
+		// RGBA texture handling
+	} else if (texture.is_valid()) {
+		if (texture->get_size() != frame_image->get_size() || texture->get_format() != frame_image->get_format()) {
+			ZoneNamedN(__img_upate_slow, "Image update slow", true);
+			texture->set_image(frame_image); // should never happen, but life has many doors ed-boy...
+		} else {
+			ZoneNamedN(__img_upate_fast, "Image update fast", true);
+			texture->update(frame_image);
+		}
+	}
+}
+
+void FFmpegVideoStreamPlayback::_open_decoder() {
+	decoder->open();
+	if (decoder->get_decoder_state() == VideoDecoder::FAULTED) {
+		return;
+	}
+	// With a poster frame the decoding threads are only started once the video is played or seeked.
+	if (poster_frame_enabled) {
+		poster_frame = decoder->decode_poster_frame();
+	} else {
+		decoder->start_decoding();
+	}
+}
+
+void FFmpegVideoStreamPlayback::_ensure_decoding() {
+	if (!decoder->is_decoding_started()) {
+		decoder->start_decoding();
+	}
+}
+
+void FFmpegVideoStreamPlayback::_show_poster_frame() {
+#ifndef FFMPEG_MT_GPU_UPLOAD
+	if (poster_frame.is_valid()) {
+		_present_frame(poster_frame);
+		showing_poster_frame = true;
+	}
+#endif
+	poster_frame.unref();
+}
+
 void FFmpegVideoStreamPlayback::update_internal(double p_delta) {
 	ZoneScopedN("update_internal");
 
+	if (!load_finished) {
+		_finish_load();
+		if (!load_finished) {
+			return;
+		}
+	}
+
 	if (paused || !playing) {
 		return;
 	}
 
 	playback_position += p_delta * 1000.0f;
 
-	if (decoder->get_decoder_state() == VideoDecoder::DecoderState::END_OF_STREAM && available_frames.size() == 0) {
+	// Play, stop and seek don't wait for the demuxer thread, until it gets to the seek the end of stream state is stale.
+	if (!decoder->is_seek_pending() && decoder->get_decoder_state() == VideoDecoder::DecoderState::END_OF_STREAM && !decoder->peek_decoded_frame().is_valid()) {
 		// if at the end of the stream but our playback enters a valid time region again, a seek operation is required to get the decoder back on track.
 		if (playback_position < decoder->get_last_decoded_frame_time()) {
 			seek_into_sync();
@@ -150,7 +258,7 @@ void FFmpegVideoStreamPlayback::update_internal(double p_delta) {
 		}
 	}
 
-	Ref<DecodedFrame> peek_frame = available_frames.size() > 0 ? available_frames.front()->get() : nullptr;
+	Ref<DecodedFrame> peek_frame = decoder->peek_decoded_frame();
 	bool out_of_sync = false;
 
 	if (peek_frame.is_valid()) {
@@ -171,8 +279,8 @@ void FFmpegVideoStreamPlayback::update_internal(double p_delta) {
 
 	bool got_new_frame = false;
 
-	List<Ref<DecodedFrame>>::Element *next_frame = available_frames.front();
-	while (next_frame && (check_next_frame_valid(next_frame->get()) || just_seeked)) {
+	Ref<DecodedFrame> next_frame = decoder->peek_decoded_frame();
+	while (next_frame.is_valid() && (check_next_frame_valid(next_frame) || just_seeked)) {
 		ZoneNamedN(__frame_receive, "frame_receive", true);
 
 		just_seeked = false;
@@ -180,65 +288,34 @@ void FFmpegVideoStreamPlayback::update_internal(double p_delta) {
 		if (last_frame.is_valid()) {
 			decoder->return_frame(last_frame);
 		}
-		last_frame = next_frame->get();
+		last_frame = decoder->pop_decoded_frame();
 		last_frame_image = last_frame->get_image();
 #ifdef FFMPEG_MT_GPU_UPLOAD
 		last_frame_texture = last_frame->get_texture();
 #endif
 		got_new_frame = true;
-		next_frame = next_frame->next();
-		available_frames.pop_front();
+		next_frame = decoder->peek_decoded_frame();
 	}
 #ifndef FFMPEG_MT_GPU_UPLOAD
 	if (got_new_frame) {
-		// YUV conversion
-		if (last_frame->get_format() == FFmpegFrameFormat::YUV420P || last_frame->get_format() == FFmpegFrameFormat::YUVA420P) {
-			Ref<Image> y_plane = last_frame->get_yuv_image_plane(0);
-			Ref<Image> u_plane = last_frame->get_yuv_image_plane(1);
-			Ref<Image> v_plane = last_frame->get_yuv_image_plane(2);
-			Ref<Image> a_plane = last_frame->get_yuv_image_plane(3);
-
-			ERR_FAIL_COND(!y_plane.is_valid());
-			ERR_FAIL_COND(!u_plane.is_valid());
-			ERR_FAIL_COND(!v_plane.is_valid());
-
-			yuv_converter->set_plane_image(0, y_plane);
-			yuv_converter->set_plane_image(1, u_plane);
-			yuv_converter->set_plane_image(2, v_plane);
-			yuv_converter->set_plane_image(3, a_plane);
-			yuv_converter->convert();
-			// RGBA texture handling
-		} else if (texture.is_valid()) {
-			if (texture->get_size() != last_frame_image->get_size() || texture->get_format() != last_frame_image->get_format()) {
-				ZoneNamedN(__img_upate_slow, "Image update slow", true);
-				texture->set_image(last_frame_image); // should never happen, but life has many doors ed-boy...
-			} else {
-				ZoneNamedN(__img_upate_fast, "Image update fast", true);
-				texture->update(last_frame_image);
-			}
-		}
+		_present_frame(last_frame);
+		showing_poster_frame = false;
 	}
 #endif
 
-	if (available_frames.size() == 0) {
-		for (Ref<DecodedFrame> frame : decoder->get_decoded_frames()) {
-			available_frames.push_back(frame);
-		}
-	}
-
-	Ref<DecodedAudioFrame> peek_audio_frame;
-	if (available_audio_frames.size() > 0) {
-		peek_audio_frame = available_audio_frames.front()->get();
-	}
+	double audio_time = 0.0;
+	uint32_t audio_frame_count = 0;
+	uint32_t audio_sample_offset = 0;
+	bool has_audio_frame = decoder->peek_decoded_audio(audio_time, audio_frame_count, audio_sample_offset);
 
 	bool audio_out_of_sync = false;
 
-	if (peek_audio_frame.is_valid()) {
-		audio_out_of_sync = Math::abs(playback_position - peek_audio_frame->get_time()) > LENIENCE_BEFORE_SEEK;
+	if (has_audio_frame) {
+		audio_out_of_sync = Math::abs(playback_position - audio_time) > LENIENCE_BEFORE_SEEK;
 
 		if (looping) {
-			out_of_sync &= Math::abs(playback_position - decoder->get_duration() - peek_audio_frame->get_time()) > LENIENCE_BEFORE_SEEK &&
-					Math::abs(playback_position + decoder->get_duration() - peek_audio_frame->get_time()) > LENIENCE_BEFORE_SEEK;
+			out_of_sync &= Math::abs(playback_position - decoder->get_duration() - audio_time) > LENIENCE_BEFORE_SEEK &&
+					Math::abs(playback_position + decoder->get_duration() - audio_time) > LENIENCE_BEFORE_SEEK;
 		}
 	}
 
@@ -246,55 +323,320 @@ void FFmpegVideoStreamPlayback::update_internal(double p_delta) {
 		// TODO: seek audio stream individually if it desyncs
 	}
 
-	List<Ref<DecodedAudioFrame>>::Element *next_audio_frame = available_audio_frames.front();
-	while (next_audio_frame && check_next_audio_frame_valid(next_audio_frame->get())) {
+	// Blocks that fell too far behind never become valid again. Left in the ring they would fill it up,
+	// which blocks the audio worker and, once its packets pile up, the demuxer and the video worker too.
+	while (has_audio_frame && check_audio_frame_stale(audio_time)) {
+		decoder->pop_decoded_audio();
+		has_audio_frame = decoder->peek_decoded_audio(audio_time, audio_frame_count, audio_sample_offset);
+	}
+
+	while (has_audio_frame && check_next_audio_frame_valid(audio_time)) {
 		ZoneNamedN(__audio_mix, "Audio mix", true);
-		Ref<DecodedAudioFrame> audio_frame = next_audio_frame->get();
-		int sample_count = audio_frame->get_sample_data().size() / decoder->get_audio_channel_count();
 #ifdef GDEXTENSION
-		mix_audio(sample_count, audio_frame->get_sample_data(), 0);
+		// mix_audio writes to the array it's given, passing the decoder's ring would copy all of it.
+		const int audio_sample_count = audio_frame_count * decoder->get_audio_channel_count();
+		if (audio_mix_buffer.size() < audio_sample_count) {
+			audio_mix_buffer.resize(audio_sample_count);
+		}
+		memcpy(audio_mix_buffer.ptrw(), decoder->get_decoded_audio_samples().ptr() + audio_sample_offset, audio_sample_count * sizeof(float));
+		mix_audio(audio_frame_count, audio_mix_buffer, 0);
 #else
-		mix_callback(mix_udata, audio_frame->get_sample_data().ptr(), sample_count);
+		// Blocks are stored contiguously, so they are mixed straight out of the decoder's sample ring.
+		mix_callback(mix_udata, decoder->get_decoded_audio_samples().ptr() + audio_sample_offset, audio_frame_count);
 #endif
-		next_audio_frame = next_audio_frame->next();
-		available_audio_frames.pop_front();
-	}
-	if (available_audio_frames.size() == 0) {
-		for (Ref<DecodedAudioFrame> frame : decoder->get_decoded_audio_frames()) {
-			available_audio_frames.push_back(frame);
-		}
+		decoder->pop_decoded_audio();
+		has_audio_frame = decoder->peek_decoded_audio(audio_time, audio_frame_count, audio_sample_offset);
 	}
 
-	buffering = decoder->is_running() && available_frames.size() == 0;
+	buffering = decoder->is_running() && !decoder->peek_decoded_frame().is_valid();
 
 	if (frame_time != get_current_frame_time()) {
 		frames_processed++;
 	}
 }
 
-Error FFmpegVideoStreamPlayback::load(Ref<FileAccess> p_file_access) {
-	decoder = Ref<VideoDecoder>(memnew(VideoDecoder(p_file_access)));
+void FFmpegVideoStreamPlayback::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_load_state"), &FFmpegVideoStreamPlayback::get_load_state);
+	ClassDB::bind_method(D_METHOD("get_frame_queue_depth"), &FFmpegVideoStreamPlayback::get_frame_queue_depth);
+	ClassDB::bind_method(D_METHOD("get_frame_queue_stall_count"), &FFmpegVideoStreamPlayback::get_frame_queue_stall_count);
+	ClassDB::bind_method(D_METHOD("get_frame_count"), &FFmpegVideoStreamPlayback::get_frame_count);
+	ClassDB::bind_method(D_METHOD("seek_frame", "frame"), &FFmpegVideoStreamPlayback::seek_frame);
+	ClassDB::bind_method(D_METHOD("get_open_latency_usec"), &FFmpegVideoStreamPlayback::get_open_latency_usec);
+	ClassDB::bind_method(D_METHOD("is_decoding_started"), &FFmpegVideoStreamPlayback::is_decoding_started);
+	ClassDB::bind_method(D_METHOD("is_input_memory_mapped"), &FFmpegVideoStreamPlayback::is_input_memory_mapped);
+	ClassDB::bind_method(D_METHOD("get_input_bytes_read"), &FFmpegVideoStreamPlayback::get_input_bytes_read);
+	ClassDB::bind_method(D_METHOD("get_input_stall_count"), &FFmpegVideoStreamPlayback::get_input_stall_count);
+	ClassDB::bind_method(D_METHOD("get_input_hit_rate"), &FFmpegVideoStreamPlayback::get_input_hit_rate);
+
+	ADD_SIGNAL(MethodInfo("loaded"));
+	ADD_SIGNAL(MethodInfo("load_failed"));
+
+	BIND_ENUM_CONSTANT(LOAD_STATE_LOADING);
+	BIND_ENUM_CONSTANT(LOAD_STATE_READY);
+	BIND_ENUM_CONSTANT(LOAD_STATE_FAILED);
+}
 
-	decoder->start_decoding();
+void FFmpegVideoStreamPlayback::_set_decoder(const Ref<VideoDecoder> &p_decoder) {
+	decoder = p_decoder;
+	decoder->set_frame_queue_memory_budget(frame_queue_memory_budget);
+	decoder->set_frame_queue_target_duration(frame_queue_target_duration);
+	decoder->set_conversion_slice_count(conversion_slice_count);
+	decoder->set_keyframe_index_enabled(keyframe_index_enabled);
+	decoder->set_io_buffer_size(io_buffer_size);
+	decoder->set_read_ahead_size(read_ahead_size);
+	decoder->set_memory_map_enabled(memory_map_enabled);
+	decoder->set_audio_buffer_duration(audio_buffer_duration);
+	// Resampling while decoding spares the AudioServer from doing it again while mixing.
+	decoder->set_audio_output_mix_rate(AudioServer::get_singleton()->get_mix_rate());
+}
+
+void FFmpegVideoStreamPlayback::_setup_output() {
 	Vector2i size = decoder->get_size();
+	const FFmpegFrameFormatInfo &format_info = ffmpeg_get_frame_format_info(decoder->get_frame_format());
+	if (format_info.is_yuv) {
+		if (yuv_converter.is_null()) {
+			yuv_converter.instantiate();
+		}
+		if (format_info.bit_depth > 8) {
+			yuv_converter->set_output_format(high_bit_depth_output_format);
+		}
+		yuv_converter->set_frame_size(size);
+		yuv_texture = yuv_converter->get_output_texture();
+	} else if (yuv_converter.is_valid()) {
+		// Async loads hand out the converter's texture before the frame format is known, RGBA frames get copied into it.
+		yuv_converter->set_frame_size(size);
+	} else {
+		const Image::Format image_format = decoder->get_frame_format() == FFmpegFrameFormat::RGBAH ? Image::FORMAT_RGBAH : Image::FORMAT_RGBA8;
+#ifdef GDEXTENSION
+		Ref<Image> image = Image::create(size.x, size.y, false, image_format);
+#else
+		Ref<Image> image = Image::create_empty(size.x, size.y, false, image_format);
+#endif
+		if (texture.is_valid()) {
+			texture->set_image(image);
+		} else {
+			texture = ImageTexture::create_from_image(image);
+		}
+	}
+}
+
+Error FFmpegVideoStreamPlayback::load(Ref<FileAccess> p_file_access) {
+	_set_decoder(Ref<VideoDecoder>(memnew(VideoDecoder(p_file_access))));
+	return _load();
+}
+
+Error FFmpegVideoStreamPlayback::load_async(Ref<FileAccess> p_file_access) {
+	_set_decoder(Ref<VideoDecoder>(memnew(VideoDecoder(p_file_access))));
+	return _load_async();
+}
+
+Error FFmpegVideoStreamPlayback::load_data(const PackedByteArray &p_data, const String &p_path) {
+	_set_decoder(Ref<VideoDecoder>(memnew(VideoDecoder(p_data, p_path))));
+	return _load();
+}
+
+Error FFmpegVideoStreamPlayback::load_data_async(const PackedByteArray &p_data, const String &p_path) {
+	_set_decoder(Ref<VideoDecoder>(memnew(VideoDecoder(p_data, p_path))));
+	return _load_async();
+}
+
+Error FFmpegVideoStreamPlayback::_load() {
+	_open_decoder();
 	if (decoder->get_decoder_state() == VideoDecoder::FAULTED) {
+		load_state.store(LOAD_STATE_FAILED);
 		return FAILED;
 	}
+	_start_output();
+	load_state.store(LOAD_STATE_READY);
+	load_finished = true;
+	return OK;
+}
 
-	if (decoder->get_frame_format() == FFmpegFrameFormat::YUV420P || decoder->get_frame_format() == FFmpegFrameFormat::YUVA420P) {
+Error FFmpegVideoStreamPlayback::_load_async() {
+	load_state.store(LOAD_STATE_LOADING);
+	load_finished = false;
+	decoder->set_audio_output_channel_count(ASYNC_AUDIO_CHANNEL_COUNT);
+
+	// VideoStreamPlayer only asks for the texture once, so the one handed out now has to be the one the video ends up in.
+	if (RS::get_singleton()->get_rendering_device() != nullptr) {
 		yuv_converter.instantiate();
-		yuv_converter->set_frame_size(size);
 		yuv_texture = yuv_converter->get_output_texture();
 	} else {
 #ifdef GDEXTENSION
-		texture = ImageTexture::create_from_image(Image::create(size.x, size.y, false, Image::FORMAT_RGBA8));
+		texture = ImageTexture::create_from_image(Image::create(1, 1, false, Image::FORMAT_RGBA8));
 #else
-		texture = ImageTexture::create_from_image(Image::create_empty(size.x, size.y, false, Image::FORMAT_RGBA8));
+		texture = ImageTexture::create_from_image(Image::create_empty(1, 1, false, Image::FORMAT_RGBA8));
 #endif
 	}
+
+	load_task = WorkerThreadPool::get_singleton()->add_task(callable_mp(this, &FFmpegVideoStreamPlayback::_load_task), false, "Load FFmpeg video");
 	return OK;
 }
 
+void FFmpegVideoStreamPlayback::_load_task() {
+	_open_decoder();
+	load_state.store(decoder->get_decoder_state() == VideoDecoder::FAULTED ? LOAD_STATE_FAILED : LOAD_STATE_READY);
+	callable_mp(this, &FFmpegVideoStreamPlayback::_finish_load).call_deferred();
+}
+
+void FFmpegVideoStreamPlayback::_finish_load() {
+	const LoadState state = load_state.load();
+	if (load_finished || state == LOAD_STATE_LOADING) {
+		return;
+	}
+	load_finished = true;
+	WorkerThreadPool::get_singleton()->wait_for_task_completion(load_task);
+	load_task = -1;
+
+	if (state == LOAD_STATE_FAILED) {
+		playing = false;
+		emit_signal("load_failed");
+		return;
+	}
+
+	_start_output();
+	emit_signal("loaded");
+}
+
+void FFmpegVideoStreamPlayback::_start_output() {
+	_setup_output();
+	_show_poster_frame();
+	// Play and seek requests made while loading only updated the playback state, with a poster frame
+	// nothing has started decoding yet.
+	if (playing || seek_requested_while_loading) {
+		_ensure_decoding();
+		if (playback_position > 0.0) {
+			decoder->seek(playback_position);
+		}
+	}
+	seek_requested_while_loading = false;
+}
+
+void FFmpegVideoStreamPlayback::load_pooled(const Ref<VideoDecoder> &p_decoder) {
+	decoder = p_decoder;
+	decoder->set_frame_queue_memory_budget(frame_queue_memory_budget);
+	decoder->set_frame_queue_target_duration(frame_queue_target_duration);
+	decoder->set_conversion_slice_count(conversion_slice_count);
+	// The decoder is already running and rewound, the poster it decoded when it was first opened is shown instead.
+	if (poster_frame_enabled) {
+		poster_frame = decoder->get_poster_frame();
+	}
+	_start_output();
+	load_state.store(LOAD_STATE_READY);
+	load_finished = true;
+}
+
+void FFmpegVideoStreamPlayback::set_decoder_pool(const Ref<FFmpegDecoderPool> &p_decoder_pool, const String &p_file) {
+	decoder_pool = p_decoder_pool;
+	decoder_pool_file = p_file;
+}
+
+FFmpegVideoStreamPlayback::LoadState FFmpegVideoStreamPlayback::get_load_state() const {
+	return load_state.load();
+}
+
+void FFmpegVideoStreamPlayback::set_frame_queue_memory_budget(int64_t p_bytes) {
+	frame_queue_memory_budget = p_bytes;
+	if (decoder.is_valid()) {
+		decoder->set_frame_queue_memory_budget(p_bytes);
+	}
+}
+
+int64_t FFmpegVideoStreamPlayback::get_frame_queue_memory_budget() const {
+	return frame_queue_memory_budget;
+}
+
+void FFmpegVideoStreamPlayback::set_frame_queue_target_duration(double p_msec) {
+	frame_queue_target_duration = p_msec;
+	if (decoder.is_valid()) {
+		decoder->set_frame_queue_target_duration(p_msec);
+	}
+}
+
+double FFmpegVideoStreamPlayback::get_frame_queue_target_duration() const {
+	return frame_queue_target_duration;
+}
+
+void FFmpegVideoStreamPlayback::set_conversion_slice_count(int p_slice_count) {
+	conversion_slice_count = p_slice_count;
+	if (decoder.is_valid()) {
+		decoder->set_conversion_slice_count(p_slice_count);
+	}
+}
+
+int FFmpegVideoStreamPlayback::get_conversion_slice_count() const {
+	return conversion_slice_count;
+}
+
+void FFmpegVideoStreamPlayback::set_high_bit_depth_output_format(YUVGPUConverter::OutputFormat p_output_format) {
+	high_bit_depth_output_format = p_output_format;
+}
+
+void FFmpegVideoStreamPlayback::set_poster_frame_enabled(bool p_enabled) {
+	poster_frame_enabled = p_enabled;
+}
+
+void FFmpegVideoStreamPlayback::set_io_buffer_size(int p_bytes) {
+	io_buffer_size = p_bytes;
+}
+
+void FFmpegVideoStreamPlayback::set_read_ahead_size(int64_t p_bytes) {
+	read_ahead_size = p_bytes;
+}
+
+void FFmpegVideoStreamPlayback::set_memory_map_enabled(bool p_enabled) {
+	memory_map_enabled = p_enabled;
+}
+
+void FFmpegVideoStreamPlayback::set_audio_buffer_duration(double p_msec) {
+	audio_buffer_duration = p_msec;
+}
+
+bool FFmpegVideoStreamPlayback::is_input_memory_mapped() const {
+	return load_finished && decoder.is_valid() && decoder->is_input_memory_mapped();
+}
+
+int64_t FFmpegVideoStreamPlayback::get_input_bytes_read() const {
+	return decoder.is_valid() ? decoder->get_input_bytes_read() : 0;
+}
+
+int64_t FFmpegVideoStreamPlayback::get_input_stall_count() const {
+	return decoder.is_valid() ? decoder->get_input_stall_count() : 0;
+}
+
+double FFmpegVideoStreamPlayback::get_input_hit_rate() const {
+	return decoder.is_valid() ? decoder->get_input_hit_rate() : 0.0;
+}
+
+void FFmpegVideoStreamPlayback::set_keyframe_index_enabled(bool p_enabled) {
+	keyframe_index_enabled = p_enabled;
+}
+
+int FFmpegVideoStreamPlayback::get_frame_queue_depth() const {
+	return decoder.is_valid() ? decoder->get_frame_queue_depth() : 0;
+}
+
+int64_t FFmpegVideoStreamPlayback::get_frame_queue_stall_count() const {
+	return decoder.is_valid() ? decoder->get_frame_queue_stall_count() : 0;
+}
+
+int64_t FFmpegVideoStreamPlayback::get_frame_count() const {
+	return load_finished && decoder.is_valid() ? decoder->get_frame_count() : 0;
+}
+
+void FFmpegVideoStreamPlayback::seek_frame(int64_t p_frame) {
+	ERR_FAIL_COND_MSG(!load_finished || decoder.is_null(), "Can't seek to a frame before the video is loaded.");
+	seek_internal(decoder->get_frame_time(p_frame) / 1000.0);
+}
+
+bool FFmpegVideoStreamPlayback::is_decoding_started() const {
+	return load_finished && decoder.is_valid() && decoder->is_decoding_started();
+}
+
+int64_t FFmpegVideoStreamPlayback::get_open_latency_usec() const {
+	return load_finished && decoder.is_valid() ? decoder->get_open_latency_usec() : 0;
+}
+
 bool FFmpegVideoStreamPlayback::is_paused_internal() const {
 	return paused;
 }
@@ -308,40 +650,64 @@ void FFmpegVideoStreamPlayback::set_paused_internal(bool p_paused) {
 }
 
 void FFmpegVideoStreamPlayback::play_internal() {
+	if (!load_finished) {
+		// The decoder starts at the beginning, it just has to be loaded first.
+		playback_position = 0;
+		just_seeked = true;
+		playing = load_state.load() != LOAD_STATE_FAILED;
+		return;
+	}
 	if (decoder->get_decoder_state() == VideoDecoder::FAULTED) {
 		playing = false;
 		return;
 	}
 	clear();
+	_ensure_decoding();
 	playback_position = 0;
-	decoder->seek(0, true);
+	decoder->seek(0);
 	just_seeked = true;
 	playing = true;
 }
 
 void FFmpegVideoStreamPlayback::stop_internal() {
+	if (!load_finished) {
+		playback_position = 0.0f;
+		playing = false;
+		seek_requested_while_loading = false;
+		return;
+	}
 	if (playing) {
 		clear();
 		playback_position = 0.0f;
-		decoder->seek(playback_position, true);
+		decoder->seek(playback_position);
 		just_seeked = true;
 		texture.unref();
+		decoder->trim_frame_buffer_pool();
 	}
-	if (yuv_converter.is_valid()) {
+	// Nothing was played yet, keep showing the poster frame.
+	if (yuv_converter.is_valid() && !showing_poster_frame) {
 		yuv_converter->clear_output_texture();
 	}
 	playing = false;
 }
 
 void FFmpegVideoStreamPlayback::seek_internal(double p_time) {
+	if (!load_finished) {
+		playback_position = p_time * 1000.0f;
+		just_seeked = true;
+		seek_requested_while_loading = true;
+		return;
+	}
+	_ensure_decoding();
 	decoder->seek(p_time * 1000.0f);
 	just_seeked = true;
-	available_frames.clear();
-	available_audio_frames.clear();
 	playback_position = p_time * 1000.0f;
 }
 
 double FFmpegVideoStreamPlayback::get_length_internal() const {
+	if (!load_finished) {
+		return 0.0;
+	}
 	return decoder->get_duration() / 1000.0f;
 }
 
@@ -361,33 +727,50 @@ double FFmpegVideoStreamPlayback::get_playback_position_internal() const {
 }
 
 int FFmpegVideoStreamPlayback::get_mix_rate_internal() const {
+	// VideoStreamPlayer only asks once, possibly before an asynchronous load is done. The decoder
+	// resamples everything to this rate, so it is known from the start.
+	if (!load_finished) {
+		return AudioServer::get_singleton()->get_mix_rate();
+	}
 	return decoder->get_audio_mix_rate();
 }
 
 int FFmpegVideoStreamPlayback::get_channels_internal() const {
+	if (!load_finished) {
+		return ASYNC_AUDIO_CHANNEL_COUNT;
+	}
 	return decoder->get_audio_channel_count();
 }
 
 FFmpegVideoStreamPlayback::FFmpegVideoStreamPlayback() {
 }
 
+FFmpegVideoStreamPlayback::~FFmpegVideoStreamPlayback() {
+	if (load_task != -1) {
+		WorkerThreadPool::get_singleton()->wait_for_task_completion(load_task);
+	}
+	if (decoder_pool.is_valid() && decoder.is_valid() && load_state.load() == LOAD_STATE_READY) {
+		if (last_frame.is_valid()) {
+			decoder->return_frame(last_frame);
+			last_frame.unref();
+		}
+		decoder_pool->release(decoder, decoder_pool_file);
+	}
+}
+
 void FFmpegVideoStreamPlayback::clear() {
 	last_frame.unref();
 	last_frame_texture.unref();
-	available_frames.clear();
-	available_audio_frames.clear();
 	frames_processed = 0;
 	playing = false;
 }
 
 YUVGPUConverter::~YUVGPUConverter() {
-	for (size_t i = 0; i < std::size(yuv_planes_uniform_sets); i++) {
-		if (yuv_planes_uniform_sets[i].is_valid()) {
-			FREE_RD_RID(yuv_planes_uniform_sets[i]);
-		}
-		if (yuv_plane_textures[i].is_valid()) {
-			FREE_RD_RID(yuv_plane_textures[i]);
-		}
+	if (yuv_buffer_uniform_set.is_valid()) {
+		FREE_RD_RID(yuv_buffer_uniform_set);
+	}
+	if (yuv_buffer.is_valid()) {
+		FREE_RD_RID(yuv_buffer);
 	}
 
 	if (out_texture.is_valid() && out_texture->get_texture_rd_rid().is_valid()) {
@@ -419,19 +802,23 @@ void YUVGPUConverter::_ensure_pipeline() {
 
 	RD *rd = RS::get_singleton()->get_rendering_device();
 
+	// The output image's format qualifier has to match the texture, patch it in before compiling.
+	const String output_layout = vformat("layout(%s, set = 1", _get_output_format_qualifier(output_format));
+
 #ifdef GDEXTENSION
 
 	Ref<RDShaderSource> shader_source;
 	shader_source.instantiate();
 	// Ugly hack to skip the #[compute] in the header, because parse_versions_from_text is not available through GDNative
-	shader_source->set_stage_source(RenderingDevice::ShaderStage::SHADER_STAGE_COMPUTE, yuv_to_rgb_shader_glsl + 10);
+	String shader_code = String(yuv_to_rgb_shader_glsl + 10).replace("layout(rgba8, set = 1", output_layout);
+	shader_source->set_stage_source(RenderingDevice::ShaderStage::SHADER_STAGE_COMPUTE, shader_code);
 	Ref<RDShaderSPIRV> shader_spirv = rd->shader_compile_spirv_from_source(shader_source);
 
 #else
 
 	Ref<RDShaderFile> shader_file;
 	shader_file.instantiate();
-	Error err = shader_file->parse_versions_from_text(yuv_to_rgb_shader_glsl);
+	Error err = shader_file->parse_versions_from_text(String(yuv_to_rgb_shader_glsl).replace("layout(rgba8, set = 1", output_layout));
 	if (err != OK) {
 		print_line("Something catastrophic happened, call eirexe");
 	}
@@ -442,55 +829,25 @@ void YUVGPUConverter::_ensure_pipeline() {
 	pipeline = rd->compute_pipeline_create(shader);
 }
 
-Error YUVGPUConverter::_ensure_plane_textures() {
-	RD *rd = RS::get_singleton()->get_rendering_device();
-	for (size_t i = 0; i < std::size(yuv_plane_textures); i++) {
-		if (yuv_plane_textures[i].is_valid()) {
-			RDTextureFormatC format = TEXTURE_FORMAT_COMPAT(rd->texture_get_format(yuv_plane_textures[i]));
-
-			int desired_frame_width = i == 0 || i == 3 ? frame_size.width : Math::ceil(frame_size.width / 2.0f);
-			int desired_frame_height = i == 0 || i == 3 ? frame_size.height : Math::ceil(frame_size.height / 2.0f);
-
-			if (static_cast<int>(format.width) == desired_frame_width && static_cast<int>(format.height) == desired_frame_height) {
-				continue;
-			}
-			continue;
-		}
-
-		// Texture didn't exist or was invalid, re-create it
-
-		// free existing texture if needed
-		if (yuv_plane_textures[i].is_valid()) {
-			FREE_RD_RID(yuv_plane_textures[i]);
-		}
-
-		RDTextureFormatC new_format;
-		new_format.format = RenderingDevice::DATA_FORMAT_R8_UNORM;
-		// chroma planes are half the size of the luma plane
-		new_format.width = i == 0 || i == 3 ? frame_size.width : Math::ceil(frame_size.width / 2.0f);
-		new_format.height = i == 0 || i == 3 ? frame_size.height : Math::ceil(frame_size.height / 2.0f);
-		new_format.depth = 1;
-		new_format.array_layers = 1;
-		new_format.mipmaps = 1;
-		new_format.usage_bits = RD::TEXTURE_USAGE_SAMPLING_BIT | RD::TEXTURE_USAGE_COLOR_ATTACHMENT_BIT | RD::TEXTURE_USAGE_STORAGE_BIT | RD::TEXTURE_USAGE_CAN_UPDATE_BIT;
-
-#ifdef GDEXTENSION
-		Ref<RDTextureFormat> new_format_c = new_format.get_texture_format();
-		Ref<RDTextureViewC> texture_view;
-		texture_view.instantiate();
-#else
-		RD::TextureFormat new_format_c = new_format;
-		RDTextureViewC texture_view;
-#endif
-		yuv_plane_textures[i] = rd->texture_create(new_format_c, texture_view);
-
-		if (yuv_planes_uniform_sets[i].is_valid()) {
-			FREE_RD_RID(yuv_planes_uniform_sets[i]);
-		}
+Error YUVGPUConverter::_ensure_yuv_buffer() {
+	if (yuv_buffer.is_valid() && yuv_buffer_size == yuv_data.size()) {
+		return OK;
+	}
 
-		yuv_planes_uniform_sets[i] = _create_uniform_set(yuv_plane_textures[i], i);
+	// Buffer didn't exist or the frame size changed, re-create it
+	if (yuv_buffer_uniform_set.is_valid()) {
+		FREE_RD_RID(yuv_buffer_uniform_set);
+	}
+	if (yuv_buffer.is_valid()) {
+		FREE_RD_RID(yuv_buffer);
 	}
 
+	RD *rd = RS::get_singleton()->get_rendering_device();
+	yuv_buffer_size = yuv_data.size();
+	yuv_buffer = rd->storage_buffer_create(yuv_buffer_size);
+	ERR_FAIL_COND_V(!yuv_buffer.is_valid(), ERR_CANT_CREATE);
+	yuv_buffer_uniform_set = _create_storage_buffer_uniform_set(yuv_buffer, 0);
+
 	return OK;
 }
 
@@ -503,7 +860,7 @@ Error YUVGPUConverter::_ensure_output_texture() {
 
 	if (out_texture->get_texture_rd_rid().is_valid()) {
 		RDTextureFormatC format = TEXTURE_FORMAT_COMPAT(rd->texture_get_format(out_texture->get_texture_rd_rid()));
-		if (static_cast<int>(format.width) == frame_size.width && static_cast<int>(format.height) == frame_size.height) {
+		if (static_cast<int>(format.width) == frame_size.width && static_cast<int>(format.height) == frame_size.height && format.format == _get_output_data_format(output_format)) {
 			return OK;
 		}
 	}
@@ -513,14 +870,13 @@ Error YUVGPUConverter::_ensure_output_texture() {
 	}
 
 	RDTextureFormatC out_texture_format;
-	out_texture_format.format = RenderingDevice::DATA_FORMAT_R8G8B8A8_UNORM;
+	out_texture_format.format = _get_output_data_format(output_format);
 	out_texture_format.width = frame_size.width;
 	out_texture_format.height = frame_size.height;
 	out_texture_format.depth = 1;
 	out_texture_format.array_layers = 1;
 	out_texture_format.mipmaps = 1;
-	// RD::TEXTURE_USAGE_CAN_UPDATE_BIT not needed since we won't update it from the CPU
-	out_texture_format.usage_bits = RD::TEXTURE_USAGE_SAMPLING_BIT | RD::TEXTURE_USAGE_COLOR_ATTACHMENT_BIT | RD::TEXTURE_USAGE_STORAGE_BIT | RD::TEXTURE_USAGE_CAN_COPY_TO_BIT;
+	out_texture_format.usage_bits = OUT_TEXTURE_USAGE_BITS;
 
 #ifdef GDEXTENSION
 	Ref<RDTextureView> texture_view;
@@ -536,7 +892,7 @@ Error YUVGPUConverter::_ensure_output_texture() {
 	if (out_uniform_set.is_valid()) {
 		FREE_RD_RID(out_uniform_set);
 	}
-	out_uniform_set = _create_uniform_set(out_texture->get_texture_rd_rid(), 4);
+	out_uniform_set = _create_uniform_set(out_texture->get_texture_rd_rid(), 1);
 	return OK;
 }
 
@@ -560,30 +916,76 @@ RID YUVGPUConverter::_create_uniform_set(const RID &p_texture_rd_rid, int p_shad
 	return RS::get_singleton()->get_rendering_device()->uniform_set_create(uniforms, shader, p_shader_set);
 }
 
-void YUVGPUConverter::_upload_plane_images() {
-	for (size_t i = 0; i < std::size(yuv_plane_images); i++) {
-		ERR_CONTINUE_MSG(!yuv_plane_images[i].is_valid() && i != 3, vformat("YUV plane %d was missing, cannot upload texture data.", (int)i));
-		if (!yuv_plane_images[i].is_valid()) {
-			continue;
-		}
-		RS::get_singleton()->get_rendering_device()->texture_update(yuv_plane_textures[i], 0, yuv_plane_images[i]->get_data());
+RID YUVGPUConverter::_create_storage_buffer_uniform_set(const RID &p_buffer_rd_rid, int p_shader_set) {
+#ifdef GDEXTENSION
+	Ref<RDUniform> uniform;
+	uniform.instantiate();
+	uniform->set_binding(0);
+	uniform->set_uniform_type(RD::UNIFORM_TYPE_STORAGE_BUFFER);
+	uniform->add_id(p_buffer_rd_rid);
+	TypedArray<RDUniform> uniforms;
+	uniforms.push_back(uniform);
+#else
+	RD::Uniform uniform;
+	uniform.uniform_type = RD::UNIFORM_TYPE_STORAGE_BUFFER;
+	uniform.binding = 0;
+	uniform.append_id(p_buffer_rd_rid);
+	Vector<RD::Uniform> uniforms;
+	uniforms.push_back(uniform);
+#endif
+	return RS::get_singleton()->get_rendering_device()->uniform_set_create(uniforms, shader, p_shader_set);
+}
+
+void YUVGPUConverter::_upload_yuv_data() {
+	RD *rd = RS::get_singleton()->get_rendering_device();
+	// The whole frame goes up in a single upload.
+#ifdef GDEXTENSION
+	rd->buffer_update(yuv_buffer, 0, yuv_data.size(), yuv_data);
+#else
+	rd->buffer_update(yuv_buffer, 0, yuv_data.size(), yuv_data.ptr());
+#endif
+}
+
+void YUVGPUConverter::set_yuv_data(const PackedByteArray &p_data, FFmpegFrameFormat p_format, const int *p_plane_offsets, int p_plane_count) {
+	const FFmpegFrameFormatInfo &format_info = ffmpeg_get_frame_format_info(p_format);
+	ERR_FAIL_COND_MSG(!format_info.is_yuv, "Frame format is not a YUV format");
+	ERR_FAIL_COND_MSG(p_plane_count != format_info.plane_count, vformat("Wrong YUV plane count, expected %d got %d", format_info.plane_count, p_plane_count));
+	// Sanity checks
+	int expected_size = 0;
+	for (int i = 0; i < p_plane_count; i++) {
+		expected_size += format_info.get_plane_row_size(i, frame_size.width) * format_info.get_plane_height(i, frame_size.height);
 	}
+	ERR_FAIL_COND_MSG(p_data.size() < expected_size, vformat("YUV data too small, expected at least %d bytes got %d", expected_size, p_data.size()));
+	ERR_FAIL_COND_MSG(p_data.size() % 4 != 0, "YUV data size must be a multiple of 4");
+
+	yuv_data = p_data;
+	for (int i = 0; i < 4; i++) {
+		push_constant.plane_offsets[i] = i < p_plane_count ? p_plane_offsets[i] : 0;
+	}
+	push_constant.luma_stride = format_info.get_plane_row_size(0, frame_size.width);
+	push_constant.chroma_stride = format_info.get_plane_row_size(1, frame_size.width);
+	push_constant.chroma_shift_x = format_info.chroma_shift_x;
+	push_constant.chroma_shift_y = format_info.chroma_shift_y;
+	push_constant.interleaved_chroma = format_info.interleaved_chroma ? 1 : 0;
+	push_constant.use_alpha = format_info.has_alpha ? 1 : 0;
+	push_constant.bytes_per_sample = format_info.bytes_per_sample;
+	push_constant.sample_shift = format_info.sample_shift;
+	push_constant.bit_depth = format_info.bit_depth;
 }
 
-void YUVGPUConverter::set_plane_image(int p_plane_idx, Ref<Image> p_image) {
-	if (!p_image.is_valid()) {
-		yuv_plane_images[p_plane_idx] = p_image;
-		return;
+void YUVGPUConverter::set_output_format(OutputFormat p_output_format) {
+	ERR_FAIL_COND_MSG(pipeline.is_valid(), "The output format must be set before the first conversion.");
+	RD *rd = RS::get_singleton()->get_rendering_device();
+	ERR_FAIL_NULL(rd);
+	if (!rd->texture_is_format_supported_for_usage(_get_output_data_format(p_output_format), OUT_TEXTURE_USAGE_BITS)) {
+		WARN_PRINT(vformat("YUV output format %s is not supported as a storage image, falling back to rgba8.", _get_output_format_qualifier(p_output_format)));
+		p_output_format = OUTPUT_FORMAT_RGBA8;
 	}
-	ERR_FAIL_COND(!p_image.is_valid());
-	ERR_FAIL_INDEX((size_t)p_plane_idx, std::size(yuv_plane_images));
-	// Sanity checks
-	int desired_frame_width = p_plane_idx == 0 || p_plane_idx == 3 ? frame_size.width : Math::ceil(frame_size.width / 2.0f);
-	int desired_frame_height = p_plane_idx == 0 || p_plane_idx == 3 ? frame_size.height : Math::ceil(frame_size.height / 2.0f);
-	ERR_FAIL_COND_MSG(p_image->get_width() != desired_frame_width, vformat("Wrong YUV plane width for plane %d, expected %d got %d", p_plane_idx, desired_frame_width, p_image->get_width()));
-	ERR_FAIL_COND_MSG(p_image->get_height() != desired_frame_height, vformat("Wrong YUV plane height for plane %, expected %d got %d", p_plane_idx, desired_frame_height, p_image->get_height()));
-	ERR_FAIL_COND_MSG(p_image->get_format() != Image::FORMAT_R8, "Wrong image format, expected R8");
-	yuv_plane_images[p_plane_idx] = p_image;
+	output_format = p_output_format;
+}
+
+YUVGPUConverter::OutputFormat YUVGPUConverter::get_output_format() const {
+	return output_format;
 }
 
 Vector2i YUVGPUConverter::get_frame_size() const { return frame_size; }
@@ -593,9 +995,7 @@ void YUVGPUConverter::set_frame_size(const Vector2i &p_frame_size) {
 	ERR_FAIL_COND_MSG(p_frame_size.y == 0, "Frame size cannot be zero!");
 	frame_size = p_frame_size;
 
-	yuv_plane_images[0].unref();
-	yuv_plane_images[1].unref();
-	yuv_plane_images[2].unref();
+	yuv_data = PackedByteArray();
 }
 
 void YUVGPUConverter::convert() {
@@ -605,14 +1005,13 @@ void YUVGPUConverter::convert() {
 void YUVGPUConverter::_convert_internal() {
 	// First we must ensure everything we need exists
 	_ensure_pipeline();
-	_ensure_plane_textures();
+	ERR_FAIL_COND_MSG(yuv_data.is_empty(), "No YUV data to convert.");
+	ERR_FAIL_COND(_ensure_yuv_buffer() != OK);
 	_ensure_output_texture();
-	_upload_plane_images();
+	_upload_yuv_data();
 
 	RD *rd = RS::get_singleton()->get_rendering_device();
 
-	push_constant.use_alpha = yuv_plane_images[3].is_valid() ? 1 : 0;
-
 	PackedByteArray push_constant_data;
 	push_constant_data.resize(sizeof(push_constant));
 	memcpy(push_constant_data.ptrw(), &push_constant, push_constant_data.size());
@@ -625,18 +1024,32 @@ void YUVGPUConverter::_convert_internal() {
 #else
 	rd->compute_list_set_push_constant(compute_list, push_constant_data.ptr(), push_constant_data.size());
 #endif
-	rd->compute_list_bind_uniform_set(compute_list, yuv_planes_uniform_sets[0], 0);
-	rd->compute_list_bind_uniform_set(compute_list, yuv_planes_uniform_sets[1], 1);
-	rd->compute_list_bind_uniform_set(compute_list, yuv_planes_uniform_sets[2], 2);
-	rd->compute_list_bind_uniform_set(compute_list, yuv_planes_uniform_sets[3], 3);
-	rd->compute_list_bind_uniform_set(compute_list, out_uniform_set, 4);
+	rd->compute_list_bind_uniform_set(compute_list, yuv_buffer_uniform_set, 0);
+	rd->compute_list_bind_uniform_set(compute_list, out_uniform_set, 1);
 
 	rd->compute_list_dispatch(compute_list, Math::ceil(frame_size.x / 8.0f), Math::ceil(frame_size.y / 8.0f), 1);
 	rd->compute_list_end();
 }
 
+void YUVGPUConverter::upload_rgba_image(const Ref<Image> &p_image) {
+	ERR_FAIL_COND(p_image.is_null());
+	ERR_FAIL_COND_MSG(p_image->get_format() != Image::FORMAT_RGBA8 || output_format != OUTPUT_FORMAT_RGBA8, "Only RGBA8 images can be uploaded to the output texture.");
+	ERR_FAIL_COND_MSG(p_image->get_size() != frame_size, "Image size doesn't match the frame size.");
+	rgba_data = p_image->get_data();
+	RenderingServer::get_singleton()->call_on_render_thread(callable_mp(this, &YUVGPUConverter::_upload_rgba_internal));
+}
+
+void YUVGPUConverter::_upload_rgba_internal() {
+	ERR_FAIL_COND(_ensure_output_texture() != OK);
+	RD *rd = RS::get_singleton()->get_rendering_device();
+	rd->texture_update(out_texture->get_texture_rd_rid(), 0, rgba_data);
+}
+
 Ref<Texture2D> YUVGPUConverter::get_output_texture() const {
-	const_cast<YUVGPUConverter *>(this)->_ensure_output_texture();
+	// Before the frame size is known there is nothing to create, the texture is filled in later.
+	if (frame_size.x > 0 && frame_size.y > 0) {
+		const_cast<YUVGPUConverter *>(this)->_ensure_output_texture();
+	}
 	return out_texture;
 }
 
@@ -647,3 +1060,398 @@ void YUVGPUConverter::clear_output_texture() {
 YUVGPUConverter::YUVGPUConverter() {
 	out_texture.instantiate();
 }
+
+void FFmpegDecoderPool::_prune(uint64_t p_now_usec, Vector<Ref<VideoDecoder>> &r_removed) {
+	const uint64_t idle_timeout_usec = idle_timeout * 1000000.0;
+	for (int i = entries.size() - 1; i >= 0; i--) {
+		if (i >= max_size || p_now_usec - entries[i].release_ticks_usec > idle_timeout_usec) {
+			r_removed.push_back(entries[i].decoder);
+			entries.remove_at(i);
+		}
+	}
+}
+
+Ref<VideoDecoder> FFmpegDecoderPool::acquire(const String &p_file) {
+	Ref<VideoDecoder> decoder;
+	// Freeing a decoder joins its threads, which shouldn't happen with the lock held.
+	Vector<Ref<VideoDecoder>> removed;
+	mutex->lock();
+	if (max_size > 0) {
+		_prune(OS::get_singleton()->get_ticks_usec(), removed);
+		for (int i = 0; i < entries.size(); i++) {
+			if (entries[i].file == p_file) {
+				decoder = entries[i].decoder;
+				entries.remove_at(i);
+				break;
+			}
+		}
+		if (decoder.is_valid()) {
+			hit_count++;
+		} else {
+			miss_count++;
+		}
+	}
+	mutex->unlock();
+	return decoder;
+}
+
+void FFmpegDecoderPool::release(const Ref<VideoDecoder> &p_decoder, const String &p_file) {
+	ERR_FAIL_COND(p_decoder.is_null());
+	// Only decoders that are up and running are worth keeping around.
+	if (!p_decoder->is_decoding_started() || p_decoder->get_decoder_state() == VideoDecoder::FAULTED) {
+		return;
+	}
+	Vector<Ref<VideoDecoder>> removed;
+	mutex->lock();
+	if (max_size > 0) {
+		p_decoder->seek(0);
+		p_decoder->trim_frame_buffer_pool();
+		Entry entry;
+		entry.decoder = p_decoder;
+		entry.file = p_file;
+		entry.release_ticks_usec = OS::get_singleton()->get_ticks_usec();
+		// Most recently released first, so pruning from the back drops the oldest ones.
+		entries.insert(0, entry);
+		_prune(entry.release_ticks_usec, removed);
+	}
+	mutex->unlock();
+}
+
+void FFmpegDecoderPool::clear() {
+	Vector<Ref<VideoDecoder>> removed;
+	mutex->lock();
+	for (const Entry &entry : entries) {
+		removed.push_back(entry.decoder);
+	}
+	entries.clear();
+	mutex->unlock();
+}
+
+void FFmpegDecoderPool::_update_frame_callback() {
+	RenderingServer *rs = RenderingServer::get_singleton();
+	if (!rs) {
+		return;
+	}
+	const Callable callback = callable_mp(this, &FFmpegDecoderPool::prune);
+	const bool connected = rs->is_connected("frame_pre_draw", callback);
+	if (max_size > 0 && !connected) {
+		rs->connect("frame_pre_draw", callback);
+	} else if (max_size == 0 && connected) {
+		rs->disconnect("frame_pre_draw", callback);
+	}
+}
+
+void FFmpegDecoderPool::prune() {
+	Vector<Ref<VideoDecoder>> removed;
+	mutex->lock();
+	if (!entries.is_empty()) {
+		_prune(OS::get_singleton()->get_ticks_usec(), removed);
+	}
+	mutex->unlock();
+}
+
+void FFmpegDecoderPool::set_max_size(int p_max_size) {
+	Vector<Ref<VideoDecoder>> removed;
+	mutex->lock();
+	max_size = MAX(p_max_size, 0);
+	_prune(OS::get_singleton()->get_ticks_usec(), removed);
+	mutex->unlock();
+	_update_frame_callback();
+}
+
+int FFmpegDecoderPool::get_max_size() const {
+	return max_size;
+}
+
+void FFmpegDecoderPool::set_idle_timeout(double p_idle_timeout) {
+	mutex->lock();
+	idle_timeout = MAX(p_idle_timeout, 0.0);
+	mutex->unlock();
+}
+
+double FFmpegDecoderPool::get_idle_timeout() const {
+	return idle_timeout;
+}
+
+uint64_t FFmpegDecoderPool::get_hit_count() const {
+	return hit_count;
+}
+
+uint64_t FFmpegDecoderPool::get_miss_count() const {
+	return miss_count;
+}
+
+FFmpegDecoderPool::FFmpegDecoderPool() {
+	mutex.instantiate();
+}
+
+FFmpegDecoderPool::~FFmpegDecoderPool() {
+	max_size = 0;
+	_update_frame_callback();
+}
+
+Ref<VideoStreamPlayback> FFmpegVideoStream::instantiate_playback_internal() {
+	Ref<FFmpegVideoStreamPlayback> pb;
+	pb.instantiate();
+	pb->set_frame_queue_memory_budget(frame_queue_memory_budget);
+	pb->set_frame_queue_target_duration(frame_queue_target_duration);
+	pb->set_conversion_slice_count(conversion_slice_count);
+	pb->set_high_bit_depth_output_format(high_bit_depth_output == HIGH_BIT_DEPTH_OUTPUT_RGB10A2 ? YUVGPUConverter::OUTPUT_FORMAT_RGB10A2 : YUVGPUConverter::OUTPUT_FORMAT_RGBA16);
+	pb->set_keyframe_index_enabled(keyframe_index_enabled);
+	pb->set_poster_frame_enabled(poster_frame);
+	pb->set_io_buffer_size(io_buffer_size);
+	pb->set_read_ahead_size(read_ahead_size);
+	pb->set_memory_map_enabled(memory_map_enabled);
+	pb->set_audio_buffer_duration(audio_buffer_duration);
+	pb->set_decoder_pool(decoder_pool, get_file());
+	Ref<VideoDecoder> pooled_decoder = decoder_pool->acquire(get_file());
+	if (pooled_decoder.is_valid()) {
+		pb->load_pooled(pooled_decoder);
+		return pb;
+	}
+
+	// Data handed to set_data() has no file behind it, preloaded files are shared with every other playback of them.
+	PackedByteArray video_data = data;
+	String video_data_path;
+	if (video_data.is_empty() && preload) {
+		video_data = SharedFileCache::get_singleton()->get_file(get_file());
+		video_data_path = get_file();
+	}
+	if (!video_data.is_empty()) {
+		if ((async_load ? pb->load_data_async(video_data, video_data_path) : pb->load_data(video_data, video_data_path)) != OK) {
+			return nullptr;
+		}
+		return pb;
+	}
+
+	Ref<FileAccess> fa = FileAccess::open(get_file(), FileAccess::READ);
+	if (!fa.is_valid()) {
+		return Ref<VideoStreamPlayback>();
+	}
+	if ((async_load ? pb->load_async(fa) : pb->load(fa)) != OK) {
+		return nullptr;
+	}
+	return pb;
+}
+
+void FFmpegVideoStream::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("set_frame_queue_memory_budget", "bytes"), &FFmpegVideoStream::set_frame_queue_memory_budget);
+	ClassDB::bind_method(D_METHOD("get_frame_queue_memory_budget"), &FFmpegVideoStream::get_frame_queue_memory_budget);
+	ClassDB::bind_method(D_METHOD("set_frame_queue_target_duration", "msec"), &FFmpegVideoStream::set_frame_queue_target_duration);
+	ClassDB::bind_method(D_METHOD("get_frame_queue_target_duration"), &FFmpegVideoStream::get_frame_queue_target_duration);
+	ClassDB::bind_method(D_METHOD("set_conversion_slice_count", "slice_count"), &FFmpegVideoStream::set_conversion_slice_count);
+	ClassDB::bind_method(D_METHOD("get_conversion_slice_count"), &FFmpegVideoStream::get_conversion_slice_count);
+	ClassDB::bind_method(D_METHOD("set_high_bit_depth_output", "output"), &FFmpegVideoStream::set_high_bit_depth_output);
+	ClassDB::bind_method(D_METHOD("get_high_bit_depth_output"), &FFmpegVideoStream::get_high_bit_depth_output);
+	ClassDB::bind_method(D_METHOD("set_keyframe_index_enabled", "enabled"), &FFmpegVideoStream::set_keyframe_index_enabled);
+	ClassDB::bind_method(D_METHOD("is_keyframe_index_enabled"), &FFmpegVideoStream::is_keyframe_index_enabled);
+	ClassDB::bind_method(D_METHOD("set_async_load", "async_load"), &FFmpegVideoStream::set_async_load);
+	ClassDB::bind_method(D_METHOD("is_async_load"), &FFmpegVideoStream::is_async_load);
+	ClassDB::bind_method(D_METHOD("set_poster_frame", "poster_frame"), &FFmpegVideoStream::set_poster_frame);
+	ClassDB::bind_method(D_METHOD("is_poster_frame"), &FFmpegVideoStream::is_poster_frame);
+	ClassDB::bind_method(D_METHOD("set_io_buffer_size", "bytes"), &FFmpegVideoStream::set_io_buffer_size);
+	ClassDB::bind_method(D_METHOD("get_io_buffer_size"), &FFmpegVideoStream::get_io_buffer_size);
+	ClassDB::bind_method(D_METHOD("set_read_ahead_size", "bytes"), &FFmpegVideoStream::set_read_ahead_size);
+	ClassDB::bind_method(D_METHOD("get_read_ahead_size"), &FFmpegVideoStream::get_read_ahead_size);
+	ClassDB::bind_method(D_METHOD("set_memory_map_enabled", "enabled"), &FFmpegVideoStream::set_memory_map_enabled);
+	ClassDB::bind_method(D_METHOD("is_memory_map_enabled"), &FFmpegVideoStream::is_memory_map_enabled);
+	ClassDB::bind_method(D_METHOD("set_audio_buffer_duration", "msec"), &FFmpegVideoStream::set_audio_buffer_duration);
+	ClassDB::bind_method(D_METHOD("get_audio_buffer_duration"), &FFmpegVideoStream::get_audio_buffer_duration);
+	ClassDB::bind_method(D_METHOD("set_preload", "preload"), &FFmpegVideoStream::set_preload);
+	ClassDB::bind_method(D_METHOD("is_preload"), &FFmpegVideoStream::is_preload);
+	ClassDB::bind_method(D_METHOD("set_data", "data"), &FFmpegVideoStream::set_data);
+	ClassDB::bind_method(D_METHOD("get_data"), &FFmpegVideoStream::get_data);
+	ClassDB::bind_static_method("FFmpegVideoStream", D_METHOD("set_preload_cache_budget", "bytes"), &FFmpegVideoStream::set_preload_cache_budget);
+	ClassDB::bind_static_method("FFmpegVideoStream", D_METHOD("get_preload_cache_budget"), &FFmpegVideoStream::get_preload_cache_budget);
+	ClassDB::bind_static_method("FFmpegVideoStream", D_METHOD("get_preload_cache_size"), &FFmpegVideoStream::get_preload_cache_size);
+	ClassDB::bind_static_method("FFmpegVideoStream", D_METHOD("clear_preload_cache"), &FFmpegVideoStream::clear_preload_cache);
+	ClassDB::bind_method(D_METHOD("set_decoder_pool_size", "size"), &FFmpegVideoStream::set_decoder_pool_size);
+	ClassDB::bind_method(D_METHOD("get_decoder_pool_size"), &FFmpegVideoStream::get_decoder_pool_size);
+	ClassDB::bind_method(D_METHOD("set_decoder_pool_idle_timeout", "seconds"), &FFmpegVideoStream::set_decoder_pool_idle_timeout);
+	ClassDB::bind_method(D_METHOD("get_decoder_pool_idle_timeout"), &FFmpegVideoStream::get_decoder_pool_idle_timeout);
+	ClassDB::bind_method(D_METHOD("get_decoder_pool_hit_count"), &FFmpegVideoStream::get_decoder_pool_hit_count);
+	ClassDB::bind_method(D_METHOD("get_decoder_pool_miss_count"), &FFmpegVideoStream::get_decoder_pool_miss_count);
+	ClassDB::bind_method(D_METHOD("clear_decoder_pool"), &FFmpegVideoStream::clear_decoder_pool);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "frame_queue_memory_budget", PROPERTY_HINT_RANGE, "0,1073741824,1,suffix:B"), "set_frame_queue_memory_budget", "get_frame_queue_memory_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "frame_queue_target_duration", PROPERTY_HINT_RANGE, "0,2000,1,suffix:ms"), "set_frame_queue_target_duration", "get_frame_queue_target_duration");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "conversion_slice_count", PROPERTY_HINT_RANGE, "0,64,1"), "set_conversion_slice_count", "get_conversion_slice_count");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "high_bit_depth_output", PROPERTY_HINT_ENUM, "RGBA16,RGB10A2"), "set_high_bit_depth_output", "get_high_bit_depth_output");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "keyframe_index_enabled"), "set_keyframe_index_enabled", "is_keyframe_index_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "async_load"), "set_async_load", "is_async_load");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "poster_frame"), "set_poster_frame", "is_poster_frame");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "io_buffer_size", PROPERTY_HINT_RANGE, "4096,16777216,1,suffix:B"), "set_io_buffer_size", "get_io_buffer_size");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "read_ahead_size", PROPERTY_HINT_RANGE, "0,268435456,1,suffix:B"), "set_read_ahead_size", "get_read_ahead_size");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "memory_map_enabled"), "set_memory_map_enabled", "is_memory_map_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "audio_buffer_duration", PROPERTY_HINT_RANGE, "20,5000,1,suffix:ms"), "set_audio_buffer_duration", "get_audio_buffer_duration");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "preload"), "set_preload", "is_preload");
+	ADD_PROPERTY(PropertyInfo(Variant::PACKED_BYTE_ARRAY, "data", PROPERTY_HINT_NONE, "", PROPERTY_USAGE_NONE), "set_data", "get_data");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "decoder_pool_size", PROPERTY_HINT_RANGE, "0,16,1"), "set_decoder_pool_size", "get_decoder_pool_size");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "decoder_pool_idle_timeout", PROPERTY_HINT_RANGE, "0,600,0.1,suffix:s"), "set_decoder_pool_idle_timeout", "get_decoder_pool_idle_timeout");
+
+	BIND_ENUM_CONSTANT(HIGH_BIT_DEPTH_OUTPUT_RGBA16);
+	BIND_ENUM_CONSTANT(HIGH_BIT_DEPTH_OUTPUT_RGB10A2);
+}
+
+void FFmpegVideoStream::set_frame_queue_memory_budget(int64_t p_bytes) {
+	frame_queue_memory_budget = MAX(p_bytes, (int64_t)0);
+}
+
+int64_t FFmpegVideoStream::get_frame_queue_memory_budget() const {
+	return frame_queue_memory_budget;
+}
+
+void FFmpegVideoStream::set_frame_queue_target_duration(double p_msec) {
+	frame_queue_target_duration = MAX(p_msec, 0.0);
+}
+
+double FFmpegVideoStream::get_frame_queue_target_duration() const {
+	return frame_queue_target_duration;
+}
+
+void FFmpegVideoStream::set_conversion_slice_count(int p_slice_count) {
+	conversion_slice_count = MAX(p_slice_count, 0);
+}
+
+int FFmpegVideoStream::get_conversion_slice_count() const {
+	return conversion_slice_count;
+}
+
+void FFmpegVideoStream::set_high_bit_depth_output(HighBitDepthOutput p_output) {
+	high_bit_depth_output = p_output;
+}
+
+FFmpegVideoStream::HighBitDepthOutput FFmpegVideoStream::get_high_bit_depth_output() const {
+	return high_bit_depth_output;
+}
+
+void FFmpegVideoStream::set_keyframe_index_enabled(bool p_enabled) {
+	keyframe_index_enabled = p_enabled;
+	// Pooled decoders were opened with the old settings.
+	decoder_pool->clear();
+}
+
+bool FFmpegVideoStream::is_keyframe_index_enabled() const {
+	return keyframe_index_enabled;
+}
+
+void FFmpegVideoStream::set_async_load(bool p_async_load) {
+	async_load = p_async_load;
+}
+
+bool FFmpegVideoStream::is_async_load() const {
+	return async_load;
+}
+
+void FFmpegVideoStream::set_poster_frame(bool p_poster_frame) {
+	poster_frame = p_poster_frame;
+	// Pooled decoders only keep a poster frame if one was decoded when they were opened.
+	decoder_pool->clear();
+}
+
+bool FFmpegVideoStream::is_poster_frame() const {
+	return poster_frame;
+}
+
+void FFmpegVideoStream::set_io_buffer_size(int p_bytes) {
+	io_buffer_size = MAX(p_bytes, 4096);
+	decoder_pool->clear();
+}
+
+int FFmpegVideoStream::get_io_buffer_size() const {
+	return io_buffer_size;
+}
+
+void FFmpegVideoStream::set_read_ahead_size(int64_t p_bytes) {
+	read_ahead_size = MAX(p_bytes, (int64_t)0);
+	decoder_pool->clear();
+}
+
+int64_t FFmpegVideoStream::get_read_ahead_size() const {
+	return read_ahead_size;
+}
+
+void FFmpegVideoStream::set_memory_map_enabled(bool p_enabled) {
+	memory_map_enabled = p_enabled;
+	decoder_pool->clear();
+}
+
+bool FFmpegVideoStream::is_memory_map_enabled() const {
+	return memory_map_enabled;
+}
+
+void FFmpegVideoStream::set_audio_buffer_duration(double p_msec) {
+	audio_buffer_duration = MAX(p_msec, 20.0);
+	decoder_pool->clear();
+}
+
+double FFmpegVideoStream::get_audio_buffer_duration() const {
+	return audio_buffer_duration;
+}
+
+void FFmpegVideoStream::set_preload(bool p_preload) {
+	preload = p_preload;
+	decoder_pool->clear();
+}
+
+bool FFmpegVideoStream::is_preload() const {
+	return preload;
+}
+
+void FFmpegVideoStream::set_data(const PackedByteArray &p_data) {
+	data = p_data;
+	// Pooled decoders still read the old data.
+	decoder_pool->clear();
+}
+
+PackedByteArray FFmpegVideoStream::get_data() const {
+	return data;
+}
+
+void FFmpegVideoStream::set_preload_cache_budget(int64_t p_bytes) {
+	SharedFileCache::get_singleton()->set_budget(p_bytes);
+}
+
+int64_t FFmpegVideoStream::get_preload_cache_budget() {
+	return SharedFileCache::get_singleton()->get_budget();
+}
+
+int64_t FFmpegVideoStream::get_preload_cache_size() {
+	return SharedFileCache::get_singleton()->get_size();
+}
+
+void FFmpegVideoStream::clear_preload_cache() {
+	SharedFileCache::get_singleton()->clear();
+}
+
+void FFmpegVideoStream::set_decoder_pool_size(int p_size) {
+	decoder_pool->set_max_size(p_size);
+}
+
+int FFmpegVideoStream::get_decoder_pool_size() const {
+	return decoder_pool->get_max_size();
+}
+
+void FFmpegVideoStream::set_decoder_pool_idle_timeout(double p_seconds) {
+	decoder_pool->set_idle_timeout(p_seconds);
+}
+
+double FFmpegVideoStream::get_decoder_pool_idle_timeout() const {
+	return decoder_pool->get_idle_timeout();
+}
+
+int64_t FFmpegVideoStream::get_decoder_pool_hit_count() const {
+	return decoder_pool->get_hit_count();
+}
+
+int64_t FFmpegVideoStream::get_decoder_pool_miss_count() const {
+	return decoder_pool->get_miss_count();
+}
+
+void FFmpegVideoStream::clear_decoder_pool() {
+	decoder_pool->clear();
+}
+
+FFmpegVideoStream::FFmpegVideoStream() {
+	decoder_pool.instantiate();
+}
@@ -55,34 +55,63 @@ using namespace godot;
 #endif
 
 class YUVGPUConverter : public RefCounted {
+public:
+	enum OutputFormat {
+		OUTPUT_FORMAT_RGBA8,
+		OUTPUT_FORMAT_RGBA16,
+		OUTPUT_FORMAT_RGB10A2,
+	};
+
+private:
 	RID shader;
-	Ref<Image> yuv_plane_images[4];
-	RID yuv_plane_textures[4];
-	RID yuv_planes_uniform_sets[4];
+	// Planes of the current frame, packed into a single buffer that is uploaded as one storage buffer.
+	PackedByteArray yuv_data;
+	RID yuv_buffer;
+	int64_t yuv_buffer_size = 0;
+	RID yuv_buffer_uniform_set;
 	RID pipeline;
 	Ref<Texture2DRD> out_texture;
 	RID out_uniform_set;
 	Vector2i frame_size;
+	// RGBA frame data copied straight into the output texture.
+	PackedByteArray rgba_data;
 
 	struct PushConstant {
+		uint32_t plane_offsets[4];
+		uint32_t luma_stride;
+		uint32_t chroma_stride;
+		uint32_t chroma_shift_x;
+		uint32_t chroma_shift_y;
+		uint32_t interleaved_chroma;
 		uint32_t use_alpha;
-		uint8_t padding[11];
+		uint32_t bytes_per_sample;
+		uint32_t sample_shift;
+		uint32_t bit_depth;
+		uint32_t padding[3];
 	} push_constant;
+	OutputFormat output_format = OUTPUT_FORMAT_RGBA8;
 
 private:
 	void _ensure_pipeline();
-	Error _ensure_plane_textures();
+	Error _ensure_yuv_buffer();
 	Error _ensure_output_texture();
 	RID _create_uniform_set(const RID &p_texture_rd_rid, int p_shader_set);
-	void _upload_plane_images();
+	RID _create_storage_buffer_uniform_set(const RID &p_buffer_rd_rid, int p_shader_set);
+	void _upload_yuv_data();
 	void _clear_texture_internal();
 	void _convert_internal();
+	void _upload_rgba_internal();
 
 public:
-	void set_plane_image(int p_plane_idx, Ref<Image> p_image);
+	void set_yuv_data(const PackedByteArray &p_data, FFmpegFrameFormat p_format, const int *p_plane_offsets, int p_plane_count);
+	// Must be set before the first conversion. Falls back to RGBA8 if the format can't be used as a storage image.
+	void set_output_format(OutputFormat p_output_format);
+	OutputFormat get_output_format() const;
 	Vector2i get_frame_size() const;
 	void set_frame_size(const Vector2i &p_frame_size);
 	void convert();
+	// Copies an RGBA8 image of the frame size to the output texture, for frames that need no conversion.
+	void upload_rgba_image(const Ref<Image> &p_image);
 	Ref<Texture2D> get_output_texture() const;
 	void clear_output_texture();
 
@@ -90,18 +119,65 @@ public:
 	~YUVGPUConverter();
 };
 
+// Idle, fully opened decoders of a stream. New playbacks take one instead of opening and probing the file again,
+// playbacks give theirs back rewound to the start when they are freed.
+class FFmpegDecoderPool : public RefCounted {
+	struct Entry {
+		Ref<VideoDecoder> decoder;
+		String file;
+		uint64_t release_ticks_usec = 0;
+	};
+
+	Ref<core_bind::Mutex> mutex;
+	Vector<Entry> entries;
+	int max_size = 0;
+	double idle_timeout = 30.0;
+	std::atomic<uint64_t> hit_count = 0;
+	std::atomic<uint64_t> miss_count = 0;
+
+	// Expects the mutex to be held, the removed decoders are handed back so they can be freed after unlocking.
+	void _prune(uint64_t p_now_usec, Vector<Ref<VideoDecoder>> &r_removed);
+	// Drops timed out decoders once per frame while the pool is enabled, so they don't wait for the next acquire or release.
+	void _update_frame_callback();
+
+public:
+	// Returns a null reference on a miss or when the pool is disabled.
+	Ref<VideoDecoder> acquire(const String &p_file);
+	void release(const Ref<VideoDecoder> &p_decoder, const String &p_file);
+	void clear();
+	// Drops the decoders that have been idle for longer than the idle timeout.
+	void prune();
+	// 0 disables the pool.
+	void set_max_size(int p_max_size);
+	int get_max_size() const;
+	// In seconds, idle decoders are dropped once they have been in the pool for this long.
+	void set_idle_timeout(double p_idle_timeout);
+	double get_idle_timeout() const;
+	uint64_t get_hit_count() const;
+	uint64_t get_miss_count() const;
+
+	FFmpegDecoderPool();
+	~FFmpegDecoderPool();
+};
+
 // We have to use this function redirection system for GDExtension because the naming conventions
 // for the functions we are supposed to override are different there
 #include "gdextension_build/func_redirect.h"
 class FFmpegVideoStreamPlayback : public VideoStreamPlayback {
 	GDCLASS(FFmpegVideoStreamPlayback, VideoStreamPlayback);
 
+public:
+	enum LoadState {
+		LOAD_STATE_LOADING,
+		LOAD_STATE_READY,
+		LOAD_STATE_FAILED,
+	};
+
+private:
 	const int LENIENCE_BEFORE_SEEK = 2500;
 	double playback_position = 0.0f;
 
 	Ref<VideoDecoder> decoder;
-	List<Ref<DecodedFrame>> available_frames;
-	List<Ref<DecodedAudioFrame>> available_audio_frames;
 	Ref<DecodedFrame> last_frame;
 #ifndef FFMPEG_MT_GPU_UPLOAD
 	Ref<ImageTexture> last_frame_texture;
@@ -115,13 +191,56 @@ class FFmpegVideoStreamPlayback : public VideoStreamPlayback {
 	void seek_into_sync();
 	double get_current_frame_time();
 	bool check_next_frame_valid(Ref<DecodedFrame> p_decoded_frame);
-	bool check_next_audio_frame_valid(Ref<DecodedAudioFrame> p_decoded_frame);
+	bool check_next_audio_frame_valid(double p_audio_time);
+	bool check_audio_frame_stale(double p_audio_time);
 	bool paused = false;
 	bool playing = false;
 	bool just_seeked = false;
+	int64_t frame_queue_memory_budget = 64 * 1024 * 1024;
+	double frame_queue_target_duration = 100.0;
+	int conversion_slice_count = 0;
+	bool keyframe_index_enabled = true;
+	bool poster_frame_enabled = false;
+	int io_buffer_size = 64 * 1024;
+	int64_t read_ahead_size = 8 * 1024 * 1024;
+	bool memory_map_enabled = true;
+	double audio_buffer_duration = 500.0;
+	// Decoded while loading, shown as soon as the output is set up.
+	Ref<DecodedFrame> poster_frame;
+	// The output still shows the poster frame, stopping keeps it.
+	bool showing_poster_frame = false;
+#ifdef GDEXTENSION
+	PackedFloat32Array audio_mix_buffer;
+#endif
+	YUVGPUConverter::OutputFormat high_bit_depth_output_format = YUVGPUConverter::OUTPUT_FORMAT_RGBA16;
 
 	Ref<YUVGPUConverter> yuv_converter;
 
+	// The decoder is given back to the pool when the playback is freed.
+	Ref<FFmpegDecoderPool> decoder_pool;
+	String decoder_pool_file;
+
+	// Written by the load task, everything else about loading is only touched by the main thread.
+	std::atomic<LoadState> load_state{ LOAD_STATE_LOADING };
+	bool load_finished = false;
+	int64_t load_task = -1;
+	// seek() was called while loading, the decoding has to be started once the load finishes.
+	bool seek_requested_while_loading = false;
+
+	void _set_decoder(const Ref<VideoDecoder> &p_decoder);
+	Error _load();
+	Error _load_async();
+	void _open_decoder();
+	void _ensure_decoding();
+	void _setup_output();
+	// Common to every load path once the decoder is open: sets up the output, shows the poster frame
+	// and starts decoding if the video was played or seeked while it was loading.
+	void _start_output();
+	void _present_frame(const Ref<DecodedFrame> &p_frame);
+	void _show_poster_frame();
+	void _load_task();
+	void _finish_load();
+
 private:
 	bool is_paused_internal() const;
 	void update_internal(double p_delta);
@@ -138,10 +257,50 @@ private:
 
 protected:
 	void clear();
-	static void _bind_methods(){}; // Required by GDExtension, do not remove
+	static void _bind_methods();
 
 public:
 	Error load(Ref<FileAccess> p_file_access);
+	// Opens the file on the WorkerThreadPool. Until the load finishes the playback reports LOAD_STATE_LOADING,
+	// hands out a placeholder texture that the video is drawn to later and has no length yet. Its audio is always mixed to stereo,
+	// as the channel count has to be reported before the file is opened.
+	Error load_async(Ref<FileAccess> p_file_access);
+	// Plays a video that is already in memory, the data is shared rather than copied. p_path may be empty,
+	// it's only used to look up the video's caches.
+	Error load_data(const PackedByteArray &p_data, const String &p_path);
+	Error load_data_async(const PackedByteArray &p_data, const String &p_path);
+	// Takes over an already running decoder from the pool, the load finishes immediately.
+	void load_pooled(const Ref<VideoDecoder> &p_decoder);
+	LoadState get_load_state() const;
+	void set_decoder_pool(const Ref<FFmpegDecoderPool> &p_decoder_pool, const String &p_file);
+
+	void set_frame_queue_memory_budget(int64_t p_bytes);
+	int64_t get_frame_queue_memory_budget() const;
+	void set_frame_queue_target_duration(double p_msec);
+	double get_frame_queue_target_duration() const;
+	void set_conversion_slice_count(int p_slice_count);
+	int get_conversion_slice_count() const;
+	void set_high_bit_depth_output_format(YUVGPUConverter::OutputFormat p_output_format);
+	void set_keyframe_index_enabled(bool p_enabled);
+	// Must be set before loading. The first frame or the cover art is shown right after the load,
+	// without starting the decoding threads until the video is played or seeked.
+	void set_poster_frame_enabled(bool p_enabled);
+	// Must be set before loading.
+	void set_io_buffer_size(int p_bytes);
+	void set_read_ahead_size(int64_t p_bytes);
+	void set_memory_map_enabled(bool p_enabled);
+	void set_audio_buffer_duration(double p_msec);
+	bool is_input_memory_mapped() const;
+	int64_t get_input_bytes_read() const;
+	int64_t get_input_stall_count() const;
+	double get_input_hit_rate() const;
+	int get_frame_queue_depth() const;
+	int64_t get_frame_queue_stall_count() const;
+	int64_t get_frame_count() const;
+	void seek_frame(int64_t p_frame);
+	int64_t get_open_latency_usec() const;
+	// False while a poster frame is shown and the video hasn't been played or seeked yet.
+	bool is_decoding_started() const;
 
 	STREAM_FUNC_REDIRECT_0_CONST(bool, is_paused);
 	STREAM_FUNC_REDIRECT_1(void, update, double, p_delta);
@@ -156,28 +315,86 @@ public:
 	STREAM_FUNC_REDIRECT_0_CONST(int, get_mix_rate);
 	STREAM_FUNC_REDIRECT_0_CONST(int, get_channels);
 	FFmpegVideoStreamPlayback();
+	~FFmpegVideoStreamPlayback();
 };
 
 class FFmpegVideoStream : public VideoStream {
 	GDCLASS(FFmpegVideoStream, VideoStream);
 
+public:
+	// Texture format 10 and 12-bit video is converted to on the GPU.
+	enum HighBitDepthOutput {
+		HIGH_BIT_DEPTH_OUTPUT_RGBA16,
+		HIGH_BIT_DEPTH_OUTPUT_RGB10A2,
+	};
+
+private:
+	int64_t frame_queue_memory_budget = 64 * 1024 * 1024;
+	double frame_queue_target_duration = 100.0;
+	int conversion_slice_count = 0;
+	HighBitDepthOutput high_bit_depth_output = HIGH_BIT_DEPTH_OUTPUT_RGBA16;
+	bool keyframe_index_enabled = true;
+	bool async_load = false;
+	bool poster_frame = false;
+	int io_buffer_size = 64 * 1024;
+	int64_t read_ahead_size = 8 * 1024 * 1024;
+	bool memory_map_enabled = true;
+	double audio_buffer_duration = 500.0;
+	bool preload = false;
+	PackedByteArray data;
+	Ref<FFmpegDecoderPool> decoder_pool;
+
 protected:
-	static void _bind_methods(){}; // Required by GDExtension, do not remove
-	Ref<VideoStreamPlayback> instantiate_playback_internal() {
-		Ref<FileAccess> fa = FileAccess::open(get_file(), FileAccess::READ);
-		if (!fa.is_valid()) {
-			return Ref<VideoStreamPlayback>();
-		}
-		Ref<FFmpegVideoStreamPlayback> pb;
-		pb.instantiate();
-		if (pb->load(fa) != OK) {
-			return nullptr;
-		}
-		return pb;
-	}
+	static void _bind_methods();
+	Ref<VideoStreamPlayback> instantiate_playback_internal();
 
 public:
+	void set_frame_queue_memory_budget(int64_t p_bytes);
+	int64_t get_frame_queue_memory_budget() const;
+	void set_frame_queue_target_duration(double p_msec);
+	double get_frame_queue_target_duration() const;
+	void set_conversion_slice_count(int p_slice_count);
+	int get_conversion_slice_count() const;
+	void set_high_bit_depth_output(HighBitDepthOutput p_output);
+	HighBitDepthOutput get_high_bit_depth_output() const;
+	void set_keyframe_index_enabled(bool p_enabled);
+	bool is_keyframe_index_enabled() const;
+	void set_async_load(bool p_async_load);
+	bool is_async_load() const;
+	void set_poster_frame(bool p_poster_frame);
+	bool is_poster_frame() const;
+	void set_io_buffer_size(int p_bytes);
+	int get_io_buffer_size() const;
+	void set_read_ahead_size(int64_t p_bytes);
+	int64_t get_read_ahead_size() const;
+	void set_memory_map_enabled(bool p_enabled);
+	bool is_memory_map_enabled() const;
+	void set_audio_buffer_duration(double p_msec);
+	double get_audio_buffer_duration() const;
+	// Reads the whole file into memory once and shares it between every playback, through a cache shared by all streams.
+	void set_preload(bool p_preload);
+	bool is_preload() const;
+	// Plays this data instead of the file, for videos generated or downloaded at runtime.
+	void set_data(const PackedByteArray &p_data);
+	PackedByteArray get_data() const;
+	static void set_preload_cache_budget(int64_t p_bytes);
+	static int64_t get_preload_cache_budget();
+	static int64_t get_preload_cache_size();
+	static void clear_preload_cache();
+	void set_decoder_pool_size(int p_size);
+	int get_decoder_pool_size() const;
+	void set_decoder_pool_idle_timeout(double p_seconds);
+	double get_decoder_pool_idle_timeout() const;
+	int64_t get_decoder_pool_hit_count() const;
+	int64_t get_decoder_pool_miss_count() const;
+	void clear_decoder_pool();
+
+	FFmpegVideoStream();
+
 	STREAM_FUNC_REDIRECT_0(Ref<VideoStreamPlayback>, instantiate_playback);
 };
 
+VARIANT_ENUM_CAST(FFmpegVideoStreamPlayback::LoadState);
+VARIANT_ENUM_CAST(FFmpegVideoStream::HighBitDepthOutput);
+
 #endif // FFMPEG_VIDEO_STREAM_H
@@ -0,0 +1,99 @@
+/**************************************************************************/
+/*  frame_buffer_pool.cpp                                                 */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "frame_buffer_pool.h"
+
+PackedByteArray FrameBufferPool::acquire(int64_t p_size) {
+	PackedByteArray buffer;
+	mutex->lock();
+	LocalVector<PackedByteArray> *sized_buffers = buffers.getptr(p_size);
+	if (sized_buffers != nullptr && sized_buffers->size() > 0) {
+		buffer = (*sized_buffers)[sized_buffers->size() - 1];
+		sized_buffers->remove_at(sized_buffers->size() - 1);
+		pooled_bytes -= p_size;
+	}
+	mutex->unlock();
+
+	if (buffer.is_empty()) {
+		buffer.resize(p_size);
+	}
+	return buffer;
+}
+
+void FrameBufferPool::release(const PackedByteArray &p_buffer) {
+	const int64_t size = p_buffer.size();
+	if (size == 0) {
+		return;
+	}
+	mutex->lock();
+	if (pooled_bytes + size <= high_water_mark) {
+		if (!buffers.has(size)) {
+			buffers.insert(size, LocalVector<PackedByteArray>());
+		}
+		buffers[size].push_back(p_buffer);
+		pooled_bytes += size;
+	}
+	mutex->unlock();
+}
+
+void FrameBufferPool::trim() {
+	mutex->lock();
+	buffers.clear();
+	pooled_bytes = 0;
+	mutex->unlock();
+}
+
+void FrameBufferPool::set_high_water_mark(int64_t p_bytes) {
+	mutex->lock();
+	high_water_mark = p_bytes;
+	if (pooled_bytes > high_water_mark) {
+		buffers.clear();
+		pooled_bytes = 0;
+	}
+	mutex->unlock();
+}
+
+int64_t FrameBufferPool::get_high_water_mark() const {
+	mutex->lock();
+	const int64_t bytes = high_water_mark;
+	mutex->unlock();
+	return bytes;
+}
+
+int64_t FrameBufferPool::get_pooled_bytes() const {
+	mutex->lock();
+	const int64_t bytes = pooled_bytes;
+	mutex->unlock();
+	return bytes;
+}
+
+FrameBufferPool::FrameBufferPool() {
+	mutex.instantiate();
+}
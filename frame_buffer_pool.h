@@ -0,0 +1,76 @@
+/**************************************************************************/
+/*  frame_buffer_pool.h                                                   */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef FRAME_BUFFER_POOL_H
+#define FRAME_BUFFER_POOL_H
+
+#include "gdextension_build/sync_compat.h"
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/templates/hash_map.h"
+#include "core/templates/local_vector.h"
+#include "core/variant/variant.h"
+
+#endif
+
+// Thread safe pool of PackedByteArrays keyed by their size, used to recycle frame data once the consumer returns a frame.
+// Released buffers may still be shared with an Image the consumer holds on to, in that case writing to them
+// triggers a copy on write so recycling is always safe, it only pays off once every other reference is gone.
+class FrameBufferPool {
+	Ref<core_bind::Mutex> mutex;
+	HashMap<int64_t, LocalVector<PackedByteArray>> buffers;
+	int64_t pooled_bytes = 0;
+	int64_t high_water_mark = 0;
+
+public:
+	// Returns a buffer of exactly p_size bytes, its contents are undefined.
+	PackedByteArray acquire(int64_t p_size);
+	// Keeps the buffer around for reuse unless that would grow the pool past the high-water mark.
+	void release(const PackedByteArray &p_buffer);
+	// Drops every pooled buffer.
+	void trim();
+	void set_high_water_mark(int64_t p_bytes);
+	int64_t get_high_water_mark() const;
+	int64_t get_pooled_bytes() const;
+
+	FrameBufferPool();
+};
+
+#endif // FRAME_BUFFER_POOL_H
@@ -32,8 +32,6 @@
 
 #ifdef GDEXTENSION
 
-#include <godot_cpp/classes/os.hpp>
-
 void CommandQueueMT::lock() {
 	mutex->lock();
 }
@@ -42,11 +40,6 @@ void CommandQueueMT::unlock() {
 	mutex->unlock();
 }
 
-void CommandQueueMT::wait_for_flush() {
-	// wait one millisecond for a flush to happen
-	OS::get_singleton()->delay_usec(1000);
-}
-
 CommandQueueMT::SyncSemaphore *CommandQueueMT::_alloc_sync_sem() {
 	int idx = -1;
 
@@ -59,21 +52,37 @@ CommandQueueMT::SyncSemaphore *CommandQueueMT::_alloc_sync_sem() {
 				break;
 			}
 		}
-		unlock();
 
-		if (idx == -1) {
-			wait_for_flush();
-		} else {
+		if (idx != -1) {
+			unlock();
 			break;
 		}
+
+		// All sync semaphores are taken, block until one of them is released instead of polling.
+		sync_sem_waiters++;
+		unlock();
+		sync_sem_released->wait();
+		lock();
+		sync_sem_waiters--;
+		unlock();
 	}
 
 	return &sync_sems[idx];
 }
 
+void CommandQueueMT::_free_sync_sem(SyncSemaphore *p_sync_sem) {
+	lock();
+	p_sync_sem->in_use = false;
+	if (sync_sem_waiters > 0) {
+		sync_sem_released->post();
+	}
+	unlock();
+}
+
 CommandQueueMT::CommandQueueMT() {
 	sync.instantiate();
 	mutex.instantiate();
+	sync_sem_released.instantiate();
 }
 
 CommandQueueMT::~CommandQueueMT() {
@@ -280,7 +280,7 @@ using namespace godot;
 		if (sync.is_valid())                                                                   \
 			sync->post();                                                                      \
 		ss->sem->wait();                                                                       \
-		ss->in_use = false;                                                                    \
+		_free_sync_sem(ss);                                                                    \
 	}
 
 #define CMD_SYNC_TYPE(N) CommandSync##N<T, M COMMA(N) COMMA_SEP_LIST(TYPE_ARG, N)>
@@ -298,7 +298,7 @@ using namespace godot;
 		if (sync.is_valid())                                                          \
 			sync->post();                                                             \
 		ss->sem->wait();                                                              \
-		ss->in_use = false;                                                           \
+		_free_sync_sem(ss);                                                           \
 	}
 
 #define MAX_CMD_PARAMS 15
@@ -348,6 +348,9 @@ class CommandQueueMT {
 	SyncSemaphore sync_sems[SYNC_SEMAPHORES];
 	Ref<core_bind::Mutex> mutex;
 	Ref<core_bind::Semaphore> sync;
+	// Posted when a sync semaphore is released while someone is waiting for one.
+	Ref<core_bind::Semaphore> sync_sem_released;
+	int sync_sem_waiters = 0;
 
 	template <class T>
 	T *allocate() {
@@ -391,8 +394,8 @@ class CommandQueueMT {
 
 	void lock();
 	void unlock();
-	void wait_for_flush();
 	SyncSemaphore *_alloc_sync_sem();
+	void _free_sync_sem(SyncSemaphore *p_sync_sem);
 
 public:
 	/* NORMAL PUSH COMMANDS */
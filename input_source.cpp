@@ -0,0 +1,278 @@
+/**************************************************************************/
+/*  input_source.cpp                                                      */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "input_source.h"
+
+#include <cstring>
+
+int64_t FileInputSource::read(uint8_t *r_buffer, int64_t p_size) {
+	const int64_t read_size = file->get_buffer(r_buffer, p_size);
+	bytes_read += read_size;
+	return read_size;
+}
+
+void FileInputSource::seek(int64_t p_position) {
+	file->seek(p_position);
+}
+
+int64_t FileInputSource::get_position() const {
+	return file->get_position();
+}
+
+int64_t FileInputSource::get_length() const {
+	return file->get_length();
+}
+
+String FileInputSource::get_path() const {
+	return file->get_path();
+}
+
+FileInputSource::FileInputSource(const Ref<FileAccess> &p_file) {
+	file = p_file;
+}
+
+void ReadAheadInputSource::_read_ahead_thread_func(void *p_userdata) {
+	((ReadAheadInputSource *)p_userdata)->_read_ahead();
+}
+
+void ReadAheadInputSource::_read_ahead() {
+	const int64_t ahead_limit = capacity - keep_behind;
+	mutex->lock();
+	while (!aborted) {
+		if (end_reached || window_end - position >= ahead_limit) {
+			read_ahead_waiting = true;
+			mutex->unlock();
+			space_available->wait();
+			mutex->lock();
+			continue;
+		}
+
+		const int64_t read_offset = window_end;
+		const int64_t ring_offset = read_offset % capacity;
+		const int64_t chunk_size = MIN(MIN(READ_CHUNK_SIZE, ahead_limit - (window_end - position)), capacity - ring_offset);
+		// The chunk overwrites the oldest data in the ring, it has to leave the window before the lock is released.
+		window_start = MAX(window_start, read_offset + chunk_size - capacity);
+		const uint32_t generation = window_generation;
+		mutex->unlock();
+
+		if ((int64_t)file->get_position() != read_offset) {
+			file->seek(read_offset);
+		}
+		const int64_t read_size = file->get_buffer(buffer.ptr() + ring_offset, chunk_size);
+
+		mutex->lock();
+		if (generation != window_generation) {
+			// The reader seeked out of the window while we were busy, this data is of no use anymore.
+			continue;
+		}
+		window_end += read_size;
+		end_reached = read_size == 0 || window_end >= length;
+		if (reader_waiting) {
+			reader_waiting = false;
+			data_available->post();
+		}
+	}
+	mutex->unlock();
+}
+
+void ReadAheadInputSource::_wake_read_ahead() {
+	if (read_ahead_waiting) {
+		read_ahead_waiting = false;
+		space_available->post();
+	}
+}
+
+int64_t ReadAheadInputSource::read(uint8_t *r_buffer, int64_t p_size) {
+	mutex->lock();
+	if (position >= window_end && !end_reached) {
+		stall_count++;
+		while (!aborted && !end_reached && position >= window_end) {
+			reader_waiting = true;
+			mutex->unlock();
+			data_available->wait();
+			mutex->lock();
+		}
+	} else {
+		hit_count++;
+	}
+
+	const int64_t read_size = MIN(p_size, window_end - position);
+	if (read_size <= 0) {
+		mutex->unlock();
+		return 0;
+	}
+	int64_t copied = 0;
+	while (copied < read_size) {
+		const int64_t ring_offset = (position + copied) % capacity;
+		const int64_t copy_size = MIN(read_size - copied, capacity - ring_offset);
+		memcpy(r_buffer + copied, buffer.ptr() + ring_offset, copy_size);
+		copied += copy_size;
+	}
+	position += read_size;
+	bytes_read += read_size;
+	_wake_read_ahead();
+	mutex->unlock();
+	return read_size;
+}
+
+void ReadAheadInputSource::seek(int64_t p_position) {
+	mutex->lock();
+	p_position = MAX(p_position, (int64_t)0);
+	if (p_position >= window_start && p_position <= window_end) {
+		position = p_position;
+	} else {
+		window_generation++;
+		window_start = p_position;
+		window_end = p_position;
+		position = p_position;
+		end_reached = p_position >= length;
+	}
+	_wake_read_ahead();
+	mutex->unlock();
+}
+
+int64_t ReadAheadInputSource::get_position() const {
+	mutex->lock();
+	const int64_t current_position = position;
+	mutex->unlock();
+	return current_position;
+}
+
+int64_t ReadAheadInputSource::get_length() const {
+	return length;
+}
+
+String ReadAheadInputSource::get_path() const {
+	return path;
+}
+
+ReadAheadInputSource::ReadAheadInputSource(const Ref<FileAccess> &p_file, int64_t p_read_ahead_size) {
+	mutex.instantiate();
+	data_available.instantiate();
+	space_available.instantiate();
+	file = p_file;
+	path = file->get_path();
+	length = file->get_length();
+	// No point in a window larger than the file.
+	capacity = MAX(MIN(p_read_ahead_size, length + 1), (int64_t)1);
+	keep_behind = capacity / 8;
+	buffer.resize(capacity);
+	file->seek(0);
+	end_reached = length == 0;
+	read_ahead_thread = memnew(std::thread(_read_ahead_thread_func, this));
+}
+
+ReadAheadInputSource::~ReadAheadInputSource() {
+	mutex->lock();
+	aborted = true;
+	mutex->unlock();
+	data_available->post();
+	space_available->post();
+	read_ahead_thread->join();
+	memdelete(read_ahead_thread);
+}
+
+Error MappedInputSource::open(const String &p_path) {
+	const Error err = mapped_file.map(p_path);
+	if (err != OK) {
+		return err;
+	}
+	path = p_path;
+	position = 0;
+	mapped_file.advise(0, mapped_file.get_size(), MappedFile::ADVICE_SEQUENTIAL);
+	return OK;
+}
+
+int64_t MappedInputSource::read(uint8_t *r_buffer, int64_t p_size) {
+	const int64_t read_position = position.load();
+	const int64_t read_size = CLAMP(mapped_file.get_size() - read_position, (int64_t)0, p_size);
+	if (read_size == 0) {
+		return 0;
+	}
+	memcpy(r_buffer, mapped_file.get_data() + read_position, read_size);
+	position = read_position + read_size;
+	bytes_read += read_size;
+	hit_count++;
+	return read_size;
+}
+
+void MappedInputSource::seek(int64_t p_position) {
+	p_position = MAX(p_position, (int64_t)0);
+	if (p_position != position.load()) {
+		mapped_file.advise(p_position, SEEK_PREFETCH_SIZE, MappedFile::ADVICE_WILLNEED);
+	}
+	position = p_position;
+}
+
+int64_t MappedInputSource::get_position() const {
+	return position.load();
+}
+
+int64_t MappedInputSource::get_length() const {
+	return mapped_file.get_size();
+}
+
+String MappedInputSource::get_path() const {
+	return path;
+}
+
+int64_t MemoryInputSource::read(uint8_t *r_buffer, int64_t p_size) {
+	const int64_t read_position = position.load();
+	const int64_t read_size = CLAMP(data.size() - read_position, (int64_t)0, p_size);
+	if (read_size == 0) {
+		return 0;
+	}
+	memcpy(r_buffer, data.ptr() + read_position, read_size);
+	position = read_position + read_size;
+	bytes_read += read_size;
+	hit_count++;
+	return read_size;
+}
+
+void MemoryInputSource::seek(int64_t p_position) {
+	position = MAX(p_position, (int64_t)0);
+}
+
+int64_t MemoryInputSource::get_position() const {
+	return position.load();
+}
+
+int64_t MemoryInputSource::get_length() const {
+	return data.size();
+}
+
+String MemoryInputSource::get_path() const {
+	return path;
+}
+
+MemoryInputSource::MemoryInputSource(const PackedByteArray &p_data, const String &p_path) {
+	data = p_data;
+	path = p_path;
+}
@@ -0,0 +1,183 @@
+/**************************************************************************/
+/*  input_source.h                                                        */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef INPUT_SOURCE_H
+#define INPUT_SOURCE_H
+
+#include "gdextension_build/sync_compat.h"
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/io/file_access.h"
+#include "core/templates/local_vector.h"
+
+#endif
+
+#include "mapped_file.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Byte stream the demuxer reads the video from, see VideoDecoder's AVIO callbacks.
+// Only ever used by one thread at a time, the statistics can be read from anywhere.
+class InputSource {
+protected:
+	std::atomic<int64_t> bytes_read = { 0 };
+	// Reads that had to wait for the data to be fetched.
+	std::atomic<int64_t> stall_count = { 0 };
+	// Reads served from data that was already buffered.
+	std::atomic<int64_t> hit_count = { 0 };
+
+public:
+	// Returns the number of bytes read, 0 at the end of the input.
+	virtual int64_t read(uint8_t *r_buffer, int64_t p_size) = 0;
+	virtual void seek(int64_t p_position) = 0;
+	virtual int64_t get_position() const = 0;
+	virtual int64_t get_length() const = 0;
+	// Empty if the input doesn't come from a file.
+	virtual String get_path() const = 0;
+
+	int64_t get_bytes_read() const { return bytes_read.load(); }
+	int64_t get_stall_count() const { return stall_count.load(); }
+	int64_t get_hit_count() const { return hit_count.load(); }
+
+	virtual ~InputSource() {}
+};
+
+// Reads straight from the FileAccess on the demuxer thread.
+class FileInputSource : public InputSource {
+	Ref<FileAccess> file;
+
+public:
+	virtual int64_t read(uint8_t *r_buffer, int64_t p_size) override;
+	virtual void seek(int64_t p_position) override;
+	virtual int64_t get_position() const override;
+	virtual int64_t get_length() const override;
+	virtual String get_path() const override;
+
+	FileInputSource(const Ref<FileAccess> &p_file);
+};
+
+// Keeps a window of the file ahead of the read position filled from a background thread, so the demuxer
+// doesn't wait on the disk or cross into FileAccess for every read. Seeks that land inside the window
+// just move the read position, only seeks outside of it make the thread start over at the new position.
+class ReadAheadInputSource : public InputSource {
+	static const int64_t READ_CHUNK_SIZE = 256 * 1024;
+
+	// Only touched by the read ahead thread once constructed.
+	Ref<FileAccess> file;
+	String path;
+	int64_t length = 0;
+
+	// Ring buffer holding the file range [window_start, window_end), offset p lives at p % capacity.
+	LocalVector<uint8_t> buffer;
+	int64_t capacity = 0;
+	// Already read data kept behind the read position, demuxers like to seek back a little.
+	int64_t keep_behind = 0;
+
+	Ref<core_bind::Mutex> mutex;
+	// Only posted while the reader waits for the window to grow.
+	Ref<core_bind::Semaphore> data_available;
+	bool reader_waiting = false;
+	// Only posted while the read ahead thread waits for the reader to move on or seek.
+	Ref<core_bind::Semaphore> space_available;
+	bool read_ahead_waiting = false;
+	int64_t window_start = 0;
+	int64_t window_end = 0;
+	int64_t position = 0;
+	// Bumped whenever the window is moved, the thread drops whatever it read for an older one.
+	uint32_t window_generation = 0;
+	bool end_reached = false;
+	bool aborted = false;
+	std::thread *read_ahead_thread = nullptr;
+
+	static void _read_ahead_thread_func(void *p_userdata);
+	void _read_ahead();
+	// Expects the mutex to be held.
+	void _wake_read_ahead();
+
+public:
+	virtual int64_t read(uint8_t *r_buffer, int64_t p_size) override;
+	virtual void seek(int64_t p_position) override;
+	virtual int64_t get_position() const override;
+	virtual int64_t get_length() const override;
+	virtual String get_path() const override;
+
+	ReadAheadInputSource(const Ref<FileAccess> &p_file, int64_t p_read_ahead_size);
+	~ReadAheadInputSource();
+};
+
+// Serves reads straight out of a memory mapping of the file, the kernel takes care of reading ahead.
+// Only works for plain files on disk, see MappedFile::map().
+class MappedInputSource : public InputSource {
+	// Pages past a seek target that are requested right away.
+	static const int64_t SEEK_PREFETCH_SIZE = 2 * 1024 * 1024;
+
+	MappedFile mapped_file;
+	String path;
+	std::atomic<int64_t> position = { 0 };
+
+public:
+	Error open(const String &p_path);
+
+	virtual int64_t read(uint8_t *r_buffer, int64_t p_size) override;
+	virtual void seek(int64_t p_position) override;
+	virtual int64_t get_position() const override;
+	virtual int64_t get_length() const override;
+	virtual String get_path() const override;
+};
+
+// Reads from a buffer already in memory, such as a preloaded file or data handed to FFmpegVideoStream.set_data().
+// The buffer is shared, not copied.
+class MemoryInputSource : public InputSource {
+	PackedByteArray data;
+	String path;
+	std::atomic<int64_t> position = { 0 };
+
+public:
+	virtual int64_t read(uint8_t *r_buffer, int64_t p_size) override;
+	virtual void seek(int64_t p_position) override;
+	virtual int64_t get_position() const override;
+	virtual int64_t get_length() const override;
+	virtual String get_path() const override;
+
+	MemoryInputSource(const PackedByteArray &p_data, const String &p_path);
+};
+
+#endif // INPUT_SOURCE_H
@@ -0,0 +1,299 @@
+/**************************************************************************/
+/*  keyframe_index.cpp                                                    */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "keyframe_index.h"
+
+#include "video_decoder.h"
+
+#ifdef GDEXTENSION
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/os.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#else
+#include "core/io/dir_access.h"
+#include "core/io/file_access.h"
+#include "core/os/os.h"
+#endif
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavformat/avio.h"
+}
+
+#include <algorithm>
+
+const uint32_t KEYFRAME_INDEX_MAGIC = 0x5849464B; // "KFIX"
+const uint32_t KEYFRAME_INDEX_VERSION = 1;
+const char *KEYFRAME_INDEX_CACHE_DIR = "user://ffmpeg_cache/keyframes";
+// Larger than the decoder's since the scan reads the file front to back.
+const int KEYFRAME_INDEX_IO_BUFFER_SIZE = 64 * 1024;
+
+Ref<core_bind::Mutex> KeyframeIndex::building_mutex;
+HashSet<String> KeyframeIndex::building_paths;
+
+int KeyframeIndex::_read_packet_callback(void *p_opaque, uint8_t *p_buf, int p_buf_size) {
+	FileAccess *file = (FileAccess *)p_opaque;
+	uint64_t read_bytes = file->get_buffer(p_buf, p_buf_size);
+	return read_bytes != 0 ? read_bytes : AVERROR_EOF;
+}
+
+int64_t KeyframeIndex::_stream_seek_callback(void *p_opaque, int64_t p_offset, int p_whence) {
+	FileAccess *file = (FileAccess *)p_opaque;
+	switch (p_whence) {
+		case SEEK_CUR: {
+			file->seek(file->get_position() + p_offset);
+		} break;
+		case SEEK_SET: {
+			file->seek(p_offset);
+		} break;
+		case SEEK_END: {
+			file->seek_end(p_offset);
+		} break;
+		case AVSEEK_SIZE: {
+			return file->get_length();
+		} break;
+		default: {
+			return -1;
+		} break;
+	}
+	return file->get_position();
+}
+
+String KeyframeIndex::get_cache_path(const String &p_source_path) {
+	return String(KEYFRAME_INDEX_CACHE_DIR).path_join(p_source_path.md5_text() + ".kfi");
+}
+
+void KeyframeIndex::initialize() {
+	building_mutex.instantiate();
+}
+
+void KeyframeIndex::finalize() {
+	building_paths.clear();
+	building_mutex.unref();
+}
+
+bool KeyframeIndex::begin_build(const String &p_source_path) {
+	building_mutex->lock();
+	const bool claimed = !building_paths.has(p_source_path);
+	if (claimed) {
+		building_paths.insert(p_source_path);
+	}
+	building_mutex->unlock();
+	return claimed;
+}
+
+void KeyframeIndex::end_build(const String &p_source_path) {
+	building_mutex->lock();
+	building_paths.erase(p_source_path);
+	building_mutex->unlock();
+}
+
+bool KeyframeIndex::is_building(const String &p_source_path) {
+	building_mutex->lock();
+	const bool building = building_paths.has(p_source_path);
+	building_mutex->unlock();
+	return building;
+}
+
+Error KeyframeIndex::load(const String &p_cache_path, const String &p_source_path, int p_stream_index, AVRational p_time_base) {
+	if (!FileAccess::file_exists(p_cache_path)) {
+		return ERR_FILE_NOT_FOUND;
+	}
+	Ref<FileAccess> source = FileAccess::open(p_source_path, FileAccess::READ);
+	if (source.is_null()) {
+		return ERR_FILE_CANT_OPEN;
+	}
+	const int64_t expected_size = source->get_length();
+	const uint64_t expected_modified_time = FileAccess::get_modified_time(p_source_path);
+	source.unref();
+
+	Error err = mapped_file.open(p_cache_path);
+	if (err != OK) {
+		return err;
+	}
+
+	const Header *header = (const Header *)mapped_file.get_data();
+	const bool valid = mapped_file.get_size() >= (int64_t)sizeof(Header) &&
+			header->magic == KEYFRAME_INDEX_MAGIC &&
+			header->version == KEYFRAME_INDEX_VERSION &&
+			header->source_size == expected_size &&
+			header->source_modified_time == expected_modified_time &&
+			header->stream_index == p_stream_index &&
+			header->time_base_num == p_time_base.num &&
+			header->time_base_den == p_time_base.den &&
+			header->entry_count >= 0 &&
+			mapped_file.get_size() == (int64_t)(sizeof(Header) + header->entry_count * sizeof(Entry));
+	if (!valid) {
+		// Stale or truncated, it gets rebuilt and overwritten.
+		mapped_file.close();
+		return ERR_FILE_CORRUPT;
+	}
+
+	built_entries.clear();
+	entries = (const Entry *)(mapped_file.get_data() + sizeof(Header));
+	entry_count = header->entry_count;
+	frame_count = header->frame_count;
+	source_size = header->source_size;
+	source_modified_time = header->source_modified_time;
+	stream_index = header->stream_index;
+	time_base = p_time_base;
+	return OK;
+}
+
+Error KeyframeIndex::build(const String &p_source_path, int p_stream_index, const SafeFlag &p_abort) {
+	Ref<FileAccess> file = FileAccess::open(p_source_path, FileAccess::READ);
+	ERR_FAIL_COND_V_MSG(file.is_null(), ERR_FILE_CANT_OPEN, vformat("Couldn't open '%s' to index its keyframes.", p_source_path));
+
+	unsigned char *context_buffer = (unsigned char *)av_malloc(KEYFRAME_INDEX_IO_BUFFER_SIZE);
+	AVIOContext *io_context = avio_alloc_context(context_buffer, KEYFRAME_INDEX_IO_BUFFER_SIZE, 0, file.ptr(), &KeyframeIndex::_read_packet_callback, nullptr, &KeyframeIndex::_stream_seek_callback);
+	AVFormatContext *format_context = avformat_alloc_context();
+	format_context->pb = io_context;
+	// Same flags as the decoder so the timestamps we see match the ones it gets.
+	format_context->flags |= AVFMT_FLAG_GENPTS;
+
+	LocalVector<int64_t> frame_pts;
+	LocalVector<Entry> keyframes;
+	int64_t packet_count = 0;
+
+	int result = avformat_open_input(&format_context, "dummy", nullptr, nullptr);
+	if (result >= 0) {
+		result = avformat_find_stream_info(format_context, nullptr);
+	}
+	if (result >= 0 && (p_stream_index < 0 || p_stream_index >= (int)format_context->nb_streams)) {
+		result = AVERROR_STREAM_NOT_FOUND;
+	}
+	if (result >= 0) {
+		// Let the demuxer skip whatever isn't the indexed stream.
+		for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+			if ((int)i != p_stream_index) {
+				format_context->streams[i]->discard = AVDISCARD_ALL;
+			}
+		}
+		time_base = format_context->streams[p_stream_index]->time_base;
+
+		AVPacket *packet = av_packet_alloc();
+		while (!p_abort.is_set() && (result = av_read_frame(format_context, packet)) >= 0) {
+			if (packet->stream_index == p_stream_index) {
+				packet_count++;
+				const int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+				if (pts != AV_NOPTS_VALUE) {
+					frame_pts.push_back(pts);
+					if (packet->flags & AV_PKT_FLAG_KEY) {
+						keyframes.push_back({ pts, packet->pos, 0 });
+					}
+				}
+			}
+			av_packet_unref(packet);
+		}
+		av_packet_free(&packet);
+		if (result == AVERROR_EOF) {
+			result = 0;
+		}
+	}
+
+	// On failure avformat_open_input has already freed the context and cleared the pointer.
+	avformat_close_input(&format_context);
+	av_free(io_context->buffer);
+	avio_context_free(&io_context);
+
+	if (p_abort.is_set()) {
+		return ERR_SKIP;
+	}
+	ERR_FAIL_COND_V_MSG(result < 0, FAILED, vformat("Error indexing keyframes of '%s': %s", p_source_path, ffmpeg_get_error_message(result)));
+
+	// Packets come in decode order, frame numbers are in presentation order.
+	frame_pts.sort();
+	keyframes.sort();
+	for (Entry &keyframe : keyframes) {
+		keyframe.frame_number = std::lower_bound(frame_pts.ptr(), frame_pts.ptr() + frame_pts.size(), keyframe.pts) - frame_pts.ptr();
+	}
+
+	mapped_file.close();
+	built_entries = keyframes;
+	entries = built_entries.ptr();
+	entry_count = built_entries.size();
+	frame_count = packet_count;
+	source_size = file->get_length();
+	source_modified_time = FileAccess::get_modified_time(p_source_path);
+	stream_index = p_stream_index;
+	return OK;
+}
+
+Error KeyframeIndex::save(const String &p_cache_path) const {
+	ERR_FAIL_COND_V(stream_index < 0, ERR_UNCONFIGURED);
+
+	Error err = DirAccess::make_dir_recursive_absolute(p_cache_path.get_base_dir());
+	ERR_FAIL_COND_V_MSG(err != OK && err != ERR_ALREADY_EXISTS, err, vformat("Couldn't create keyframe index cache directory '%s'.", p_cache_path.get_base_dir()));
+
+	// Written next to the final path and renamed once complete, so a half written sidecar is never mapped.
+	// The process id keeps other instances of the game indexing the same file from writing to the same temporary file.
+	const String temp_path = vformat("%s.%d.tmp", p_cache_path, OS::get_singleton()->get_process_id());
+	Ref<FileAccess> file = FileAccess::open(temp_path, FileAccess::WRITE);
+	ERR_FAIL_COND_V_MSG(file.is_null(), ERR_FILE_CANT_WRITE, vformat("Couldn't write keyframe index '%s'.", temp_path));
+
+	Header header = {};
+	header.magic = KEYFRAME_INDEX_MAGIC;
+	header.version = KEYFRAME_INDEX_VERSION;
+	header.source_size = source_size;
+	header.source_modified_time = source_modified_time;
+	header.stream_index = stream_index;
+	header.time_base_num = time_base.num;
+	header.time_base_den = time_base.den;
+	header.entry_count = entry_count;
+	header.frame_count = frame_count;
+	file->store_buffer((const uint8_t *)&header, sizeof(Header));
+	if (entry_count > 0) {
+		file->store_buffer((const uint8_t *)entries, entry_count * sizeof(Entry));
+	}
+	err = file->get_error();
+	file.unref();
+	if (err != OK) {
+		DirAccess::remove_absolute(temp_path);
+		return err;
+	}
+	return DirAccess::rename_absolute(temp_path, p_cache_path);
+}
+
+const KeyframeIndex::Entry *KeyframeIndex::find_keyframe(int64_t p_pts) const {
+	const Entry *end = entries + entry_count;
+	const Entry *after = std::upper_bound(entries, end, p_pts, [](int64_t p_value, const Entry &p_entry) {
+		return p_value < p_entry.pts;
+	});
+	return after == entries ? nullptr : after - 1;
+}
+
+const KeyframeIndex::Entry *KeyframeIndex::find_keyframe_for_frame(int64_t p_frame_number) const {
+	const Entry *end = entries + entry_count;
+	const Entry *after = std::upper_bound(entries, end, p_frame_number, [](int64_t p_value, const Entry &p_entry) {
+		return p_value < p_entry.frame_number;
+	});
+	return after == entries ? nullptr : after - 1;
+}
@@ -0,0 +1,139 @@
+/**************************************************************************/
+/*  keyframe_index.h                                                      */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef KEYFRAME_INDEX_H
+#define KEYFRAME_INDEX_H
+
+#include "gdextension_build/sync_compat.h"
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/templates/hash_set.hpp>
+#include <godot_cpp/templates/local_vector.hpp>
+#include <godot_cpp/templates/safe_refcount.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/templates/hash_set.h"
+#include "core/templates/local_vector.h"
+#include "core/templates/safe_refcount.h"
+#include "core/variant/variant.h"
+
+#endif
+
+#include "mapped_file.h"
+
+extern "C" {
+#include "libavutil/rational.h"
+}
+
+
+// Table of the keyframes of a video stream, built by scanning every packet of the file once and then
+// persisted as a sidecar file in the user cache so later opens only have to map it.
+class KeyframeIndex {
+public:
+	struct Entry {
+		// In the stream's time base.
+		int64_t pts;
+		// Byte position of the keyframe's packet, -1 when the demuxer doesn't know it.
+		int64_t pos;
+		// Number of frames presented before this one.
+		int64_t frame_number;
+
+		bool operator<(const Entry &p_other) const { return pts < p_other.pts; }
+	};
+
+private:
+	// On disk layout of the sidecar, followed by entry_count Entries in native byte order.
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		int64_t source_size;
+		uint64_t source_modified_time;
+		int32_t stream_index;
+		int32_t time_base_num;
+		int32_t time_base_den;
+		uint32_t reserved;
+		int64_t entry_count;
+		int64_t frame_count;
+	};
+
+	// Entries point either into mapped_file or into built_entries.
+	MappedFile mapped_file;
+	LocalVector<Entry> built_entries;
+	const Entry *entries = nullptr;
+	int64_t entry_count = 0;
+	int64_t frame_count = 0;
+	int64_t source_size = 0;
+	uint64_t source_modified_time = 0;
+	int stream_index = -1;
+	AVRational time_base = { 0, 1 };
+
+	// Sources being indexed right now, so that players opening the same file don't each scan it.
+	// Created by initialize(), engine classes can't be instantiated during static initialization.
+	static Ref<core_bind::Mutex> building_mutex;
+	static HashSet<String> building_paths;
+
+	static int _read_packet_callback(void *p_opaque, uint8_t *p_buf, int p_buf_size);
+	static int64_t _stream_seek_callback(void *p_opaque, int64_t p_offset, int p_whence);
+
+public:
+	// Called when the module is registered and unregistered.
+	static void initialize();
+	static void finalize();
+
+	static String get_cache_path(const String &p_source_path);
+	// Claims the build of a source's index, fails if it is already being built. Every successful claim must be ended.
+	static bool begin_build(const String &p_source_path);
+	static void end_build(const String &p_source_path);
+	static bool is_building(const String &p_source_path);
+
+	// Maps a sidecar, fails if it is missing or was built from a different version of the source file.
+	Error load(const String &p_cache_path, const String &p_source_path, int p_stream_index, AVRational p_time_base);
+	// Scans the whole source file, p_abort is polled between packets.
+	Error build(const String &p_source_path, int p_stream_index, const SafeFlag &p_abort);
+	Error save(const String &p_cache_path) const;
+
+	// Last keyframe at or before p_pts, nullptr if there is none.
+	const Entry *find_keyframe(int64_t p_pts) const;
+	// Last keyframe at or before the given frame, nullptr if there is none.
+	const Entry *find_keyframe_for_frame(int64_t p_frame_number) const;
+
+	int64_t get_entry_count() const { return entry_count; }
+	const Entry *get_entries() const { return entries; }
+	int64_t get_frame_count() const { return frame_count; }
+	AVRational get_time_base() const { return time_base; }
+};
+
+#endif // KEYFRAME_INDEX_H
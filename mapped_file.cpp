@@ -0,0 +1,202 @@
+/**************************************************************************/
+/*  mapped_file.cpp                                                       */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "mapped_file.h"
+
+#ifdef GDEXTENSION
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+#else
+#include "core/config/project_settings.h"
+#include "core/io/file_access.h"
+#include "core/io/file_access_pack.h"
+#endif
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define MAPPED_FILE_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::_map(const String &p_absolute_path) {
+#if defined(_WIN32)
+	HANDLE file = CreateFileW((LPCWSTR)p_absolute_path.utf16().get_data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+	data = (const uint8_t *)view;
+	size = file_size.QuadPart;
+	return true;
+#elif defined(MAPPED_FILE_POSIX)
+	const int fd = ::open(p_absolute_path.utf8().get_data(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void *view = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file.
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+	data = (const uint8_t *)view;
+	size = file_stat.st_size;
+	return true;
+#else
+	return false;
+#endif
+}
+
+Error MappedFile::map(const String &p_path) {
+	close();
+
+	// Paths that don't globalize point inside a PCK, which may also be compressed or encrypted.
+	const String absolute_path = ProjectSettings::get_singleton()->globalize_path(p_path);
+	if (!absolute_path.is_absolute_path() || absolute_path.begins_with("res://") || absolute_path.begins_with("user://")) {
+		return ERR_UNAVAILABLE;
+	}
+	// A file in a loaded pack takes precedence over the one on disk at the same path, only map what FileAccess would read.
+#ifdef GDEXTENSION
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::READ);
+	if (file.is_null() || file->get_path_absolute().simplify_path() != absolute_path.simplify_path()) {
+		return ERR_UNAVAILABLE;
+	}
+	file.unref();
+#else
+	PackedData *packed_data = PackedData::get_singleton();
+	if (packed_data && !packed_data->is_disabled() && packed_data->has_path(p_path)) {
+		return ERR_UNAVAILABLE;
+	}
+#endif
+	if (!_map(absolute_path)) {
+		return ERR_UNAVAILABLE;
+	}
+	mapped = true;
+	return OK;
+}
+
+Error MappedFile::open(const String &p_path) {
+	if (map(p_path) == OK) {
+		return OK;
+	}
+
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::READ);
+	if (file.is_null()) {
+		return ERR_FILE_CANT_OPEN;
+	}
+	const int64_t length = file->get_length();
+	if (length == 0) {
+		return ERR_FILE_EOF;
+	}
+	read_data.resize(length);
+	if ((int64_t)file->get_buffer(read_data.ptrw(), length) != length) {
+		read_data = PackedByteArray();
+		return ERR_FILE_CANT_READ;
+	}
+	data = read_data.ptr();
+	size = length;
+	return OK;
+}
+
+void MappedFile::advise(int64_t p_offset, int64_t p_size, Advice p_advice) const {
+	// Only POSIX has per-range hints for mappings, Windows' prefetcher picks up sequential reads on its own.
+#if defined(MAPPED_FILE_POSIX)
+	if (!mapped || p_offset < 0 || p_offset >= size) {
+		return;
+	}
+	// madvise wants a page aligned address.
+	const int64_t page_size = sysconf(_SC_PAGESIZE);
+	const int64_t start = p_offset - p_offset % page_size;
+	const int64_t end = MIN(p_offset + p_size, size);
+	int advice = MADV_NORMAL;
+	switch (p_advice) {
+		case ADVICE_NORMAL: {
+			advice = MADV_NORMAL;
+		} break;
+		case ADVICE_SEQUENTIAL: {
+			advice = MADV_SEQUENTIAL;
+		} break;
+		case ADVICE_WILLNEED: {
+			advice = MADV_WILLNEED;
+		} break;
+	}
+	madvise((void *)(data + start), end - start, advice);
+#endif
+}
+
+void MappedFile::close() {
+	if (mapped) {
+#if defined(_WIN32)
+		UnmapViewOfFile(data);
+		CloseHandle((HANDLE)mapping_handle);
+		CloseHandle((HANDLE)file_handle);
+		mapping_handle = nullptr;
+		file_handle = nullptr;
+#elif defined(MAPPED_FILE_POSIX)
+		munmap((void *)data, size);
+#endif
+	}
+	read_data = PackedByteArray();
+	data = nullptr;
+	size = 0;
+	mapped = false;
+}
@@ -0,0 +1,93 @@
+/**************************************************************************/
+/*  mapped_file.h                                                         */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/error/error_list.h"
+#include "core/variant/variant.h"
+
+#endif
+
+#include <cstdint>
+
+// Read only view of a whole file. The file is memory mapped where the platform allows it, files that can't
+// be mapped (such as the ones inside a PCK) are read into memory instead.
+class MappedFile {
+public:
+	enum Advice {
+		ADVICE_NORMAL,
+		ADVICE_SEQUENTIAL,
+		ADVICE_WILLNEED,
+	};
+
+private:
+	const uint8_t *data = nullptr;
+	int64_t size = 0;
+	bool mapped = false;
+#ifdef _WIN32
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+#endif
+	PackedByteArray read_data;
+
+	bool _map(const String &p_absolute_path);
+
+public:
+	// Accepts any path FileAccess does.
+	Error open(const String &p_path);
+	// Like open(), but fails with ERR_UNAVAILABLE instead of reading files that can't be mapped into memory.
+	Error map(const String &p_path);
+	void close();
+	// Hints the kernel about how the range is going to be accessed, does nothing if the file isn't mapped.
+	void advise(int64_t p_offset, int64_t p_size, Advice p_advice) const;
+
+	bool is_open() const { return data != nullptr; }
+	bool is_mapped() const { return mapped; }
+	const uint8_t *get_data() const { return data; }
+	int64_t get_size() const { return size; }
+
+	MappedFile() {}
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile() { close(); }
+};
+
+#endif // MAPPED_FILE_H
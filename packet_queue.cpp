@@ -0,0 +1,170 @@
+/**************************************************************************/
+/*  packet_queue.cpp                                                      */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "packet_queue.h"
+
+void PacketQueue::_clear() {
+	for (Entry &entry : entries) {
+		if (entry.packet != nullptr) {
+			av_packet_free(&entry.packet);
+		}
+	}
+	entries.clear();
+	packet_count = 0;
+	size_bytes = 0;
+	duration = 0;
+}
+
+void PacketQueue::_push_entry(const Entry &p_entry) {
+	entries.push_back(p_entry);
+	entry_available->post();
+}
+
+void PacketQueue::set_time_base(AVRational p_time_base) {
+	mutex->lock();
+	time_base = p_time_base;
+	mutex->unlock();
+}
+
+void PacketQueue::put(AVPacket *p_packet) {
+	AVPacket *packet = av_packet_alloc();
+	av_packet_move_ref(packet, p_packet);
+
+	mutex->lock();
+	if (aborted) {
+		mutex->unlock();
+		av_packet_free(&packet);
+		return;
+	}
+	Entry entry;
+	entry.packet = packet;
+	entry.serial = serial;
+	packet_count++;
+	size_bytes += packet->size;
+	duration += packet->duration;
+	_push_entry(entry);
+	mutex->unlock();
+}
+
+void PacketQueue::flush(uint32_t p_serial, double p_skip_output_until_time) {
+	mutex->lock();
+	_clear();
+	serial = p_serial;
+	Entry entry;
+	entry.type = FLUSH;
+	entry.serial = serial;
+	entry.skip_output_until_time = p_skip_output_until_time;
+	_push_entry(entry);
+	mutex->unlock();
+}
+
+uint32_t PacketQueue::put_drain() {
+	mutex->lock();
+	Entry entry;
+	entry.type = DRAIN;
+	entry.serial = serial;
+	entry.drain_id = ++last_drain_id;
+	_push_entry(entry);
+	mutex->unlock();
+	return entry.drain_id;
+}
+
+bool PacketQueue::is_drained(uint32_t p_drain_id) {
+	mutex->lock();
+	const bool drained = completed_drain_id == p_drain_id;
+	mutex->unlock();
+	return drained;
+}
+
+bool PacketQueue::has_enough_packets(int p_min_packets, double p_min_duration) {
+	mutex->lock();
+	// Packets without a duration can't tell us how much time we have buffered, go by the packet count alone.
+	const bool enough = aborted || (packet_count > p_min_packets && (duration == 0 || duration * av_q2d(time_base) * 1000.0 > p_min_duration));
+	mutex->unlock();
+	return enough;
+}
+
+int64_t PacketQueue::get_size_bytes() {
+	mutex->lock();
+	const int64_t bytes = size_bytes;
+	mutex->unlock();
+	return bytes;
+}
+
+uint32_t PacketQueue::get_serial() {
+	mutex->lock();
+	const uint32_t current_serial = serial;
+	mutex->unlock();
+	return current_serial;
+}
+
+void PacketQueue::abort() {
+	mutex->lock();
+	aborted = true;
+	mutex->unlock();
+	entry_available->post();
+}
+
+bool PacketQueue::get(Entry &r_entry) {
+	mutex->lock();
+	while (!aborted && entries.is_empty()) {
+		mutex->unlock();
+		entry_available->wait();
+		mutex->lock();
+	}
+	if (aborted) {
+		mutex->unlock();
+		return false;
+	}
+	r_entry = entries.front()->get();
+	entries.pop_front();
+	if (r_entry.packet != nullptr) {
+		packet_count--;
+		size_bytes -= r_entry.packet->size;
+		duration -= r_entry.packet->duration;
+	}
+	mutex->unlock();
+	return true;
+}
+
+void PacketQueue::mark_drained(uint32_t p_drain_id) {
+	mutex->lock();
+	completed_drain_id = p_drain_id;
+	mutex->unlock();
+}
+
+PacketQueue::PacketQueue() {
+	mutex.instantiate();
+	entry_available.instantiate();
+}
+
+PacketQueue::~PacketQueue() {
+	_clear();
+}
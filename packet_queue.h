@@ -0,0 +1,123 @@
+/**************************************************************************/
+/*  packet_queue.h                                                        */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef PACKET_QUEUE_H
+#define PACKET_QUEUE_H
+
+#include "gdextension_build/sync_compat.h"
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/templates/list.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/templates/list.h"
+
+#endif
+
+extern "C" {
+#include "libavcodec/packet.h"
+#include "libavutil/rational.h"
+}
+
+#include <cstdint>
+
+// Thread safe queue of demuxed packets for a single stream, fed by the demuxer thread and drained by that stream's decode worker.
+// Every entry carries the serial it was queued with, flush() starts a new serial so the worker knows it has to reset its codec.
+class PacketQueue {
+public:
+	enum EntryType {
+		PACKET,
+		// Everything before this entry was discarded by a seek, the worker must flush its codec.
+		FLUSH,
+		// End of the stream, the worker must drain its codec.
+		DRAIN,
+	};
+
+	struct Entry {
+		EntryType type = PACKET;
+		AVPacket *packet = nullptr;
+		uint32_t serial = 0;
+		// FLUSH: output before this time (in msec) must be skipped. DRAIN: id to pass back to mark_drained().
+		double skip_output_until_time = -1.0;
+		uint32_t drain_id = 0;
+	};
+
+private:
+	Ref<core_bind::Mutex> mutex;
+	// Posted for every entry pushed and on abort, the worker may wake up to an entry a flush already discarded.
+	Ref<core_bind::Semaphore> entry_available;
+	List<Entry> entries;
+	AVRational time_base = { 1, 1000 };
+	int packet_count = 0;
+	int64_t size_bytes = 0;
+	int64_t duration = 0;
+	uint32_t serial = 0;
+	uint32_t last_drain_id = 0;
+	uint32_t completed_drain_id = 0;
+	bool aborted = false;
+
+	void _clear();
+	void _push_entry(const Entry &p_entry);
+
+public:
+	void set_time_base(AVRational p_time_base);
+
+	// Demuxer side.
+
+	// Takes ownership of the packet's data, p_packet is left blank.
+	void put(AVPacket *p_packet);
+	// Discards all queued packets and starts a new serial.
+	void flush(uint32_t p_serial, double p_skip_output_until_time);
+	// Queues a drain request and returns its id, see is_drained().
+	uint32_t put_drain();
+	bool is_drained(uint32_t p_drain_id);
+	// Whether the queue holds more than p_min_packets packets covering at least p_min_duration msec.
+	bool has_enough_packets(int p_min_packets, double p_min_duration);
+	int64_t get_size_bytes();
+	uint32_t get_serial();
+	void abort();
+
+	// Worker side.
+
+	// Blocks until an entry is available, returns false once the queue is aborted.
+	// The caller owns the returned packet and must free it with av_packet_free().
+	bool get(Entry &r_entry);
+	void mark_drained(uint32_t p_drain_id);
+
+	PacketQueue();
+	~PacketQueue();
+};
+
+#endif // PACKET_QUEUE_H
@@ -0,0 +1,251 @@
+/**************************************************************************/
+/*  probe_cache.cpp                                                       */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "probe_cache.h"
+
+#ifdef GDEXTENSION
+#include <godot_cpp/classes/dir_access.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/array.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/vector2i.hpp>
+#else
+#include "core/io/dir_access.h"
+#include "core/io/file_access.h"
+#endif
+
+#include <cstring>
+
+const int PROBE_CACHE_VERSION = 1;
+const char *PROBE_CACHE_DIR = "user://ffmpeg_cache/probe";
+
+static Vector2i _rational_to_vector(AVRational p_rational) {
+	return Vector2i(p_rational.num, p_rational.den);
+}
+
+static AVRational _vector_to_rational(const Vector2i &p_vector) {
+	return AVRational{ p_vector.x, p_vector.y };
+}
+
+static Dictionary _stream_to_dictionary(const AVStream *p_stream) {
+	const AVCodecParameters *par = p_stream->codecpar;
+	Dictionary stream;
+	stream["time_base"] = _rational_to_vector(p_stream->time_base);
+	stream["start_time"] = p_stream->start_time;
+	stream["duration"] = p_stream->duration;
+	stream["nb_frames"] = p_stream->nb_frames;
+	stream["avg_frame_rate"] = _rational_to_vector(p_stream->avg_frame_rate);
+	stream["r_frame_rate"] = _rational_to_vector(p_stream->r_frame_rate);
+
+	stream["codec_type"] = par->codec_type;
+	stream["codec_id"] = par->codec_id;
+	stream["codec_tag"] = par->codec_tag;
+	PackedByteArray extradata;
+	if (par->extradata_size > 0) {
+		extradata.resize(par->extradata_size);
+		memcpy(extradata.ptrw(), par->extradata, par->extradata_size);
+	}
+	stream["extradata"] = extradata;
+	stream["format"] = par->format;
+	stream["bit_rate"] = par->bit_rate;
+	stream["bits_per_coded_sample"] = par->bits_per_coded_sample;
+	stream["bits_per_raw_sample"] = par->bits_per_raw_sample;
+	stream["profile"] = par->profile;
+	stream["level"] = par->level;
+	stream["width"] = par->width;
+	stream["height"] = par->height;
+	stream["sample_aspect_ratio"] = _rational_to_vector(par->sample_aspect_ratio);
+	stream["field_order"] = par->field_order;
+	stream["color_range"] = par->color_range;
+	stream["color_primaries"] = par->color_primaries;
+	stream["color_trc"] = par->color_trc;
+	stream["color_space"] = par->color_space;
+	stream["chroma_location"] = par->chroma_location;
+	stream["video_delay"] = par->video_delay;
+	stream["channel_order"] = par->ch_layout.order;
+	stream["channel_count"] = par->ch_layout.nb_channels;
+	stream["channel_mask"] = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? (int64_t)par->ch_layout.u.mask : 0;
+	stream["sample_rate"] = par->sample_rate;
+	stream["block_align"] = par->block_align;
+	stream["frame_size"] = par->frame_size;
+	stream["initial_padding"] = par->initial_padding;
+	stream["trailing_padding"] = par->trailing_padding;
+	stream["seek_preroll"] = par->seek_preroll;
+	return stream;
+}
+
+static void _apply_stream_dictionary(const Dictionary &p_stream, AVStream *r_stream) {
+	AVCodecParameters *par = r_stream->codecpar;
+	r_stream->start_time = p_stream["start_time"];
+	r_stream->duration = p_stream["duration"];
+	r_stream->nb_frames = p_stream["nb_frames"];
+	r_stream->avg_frame_rate = _vector_to_rational(p_stream["avg_frame_rate"]);
+	r_stream->r_frame_rate = _vector_to_rational(p_stream["r_frame_rate"]);
+
+	par->codec_tag = (uint32_t)(int64_t)p_stream["codec_tag"];
+	const PackedByteArray extradata = p_stream["extradata"];
+	if (extradata.size() > 0) {
+		av_freep(&par->extradata);
+		par->extradata = (uint8_t *)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+		memcpy(par->extradata, extradata.ptr(), extradata.size());
+		par->extradata_size = extradata.size();
+	}
+	par->format = p_stream["format"];
+	par->bit_rate = p_stream["bit_rate"];
+	par->bits_per_coded_sample = p_stream["bits_per_coded_sample"];
+	par->bits_per_raw_sample = p_stream["bits_per_raw_sample"];
+	par->profile = p_stream["profile"];
+	par->level = p_stream["level"];
+	par->width = p_stream["width"];
+	par->height = p_stream["height"];
+	par->sample_aspect_ratio = _vector_to_rational(p_stream["sample_aspect_ratio"]);
+	par->field_order = (AVFieldOrder)(int)p_stream["field_order"];
+	par->color_range = (AVColorRange)(int)p_stream["color_range"];
+	par->color_primaries = (AVColorPrimaries)(int)p_stream["color_primaries"];
+	par->color_trc = (AVColorTransferCharacteristic)(int)p_stream["color_trc"];
+	par->color_space = (AVColorSpace)(int)p_stream["color_space"];
+	par->chroma_location = (AVChromaLocation)(int)p_stream["chroma_location"];
+	par->video_delay = p_stream["video_delay"];
+	const int channel_count = p_stream["channel_count"];
+	if (channel_count > 0) {
+		av_channel_layout_uninit(&par->ch_layout);
+		if ((int)p_stream["channel_order"] != AV_CHANNEL_ORDER_NATIVE || av_channel_layout_from_mask(&par->ch_layout, (uint64_t)(int64_t)p_stream["channel_mask"]) < 0) {
+			av_channel_layout_default(&par->ch_layout, channel_count);
+		}
+	}
+	par->sample_rate = p_stream["sample_rate"];
+	par->block_align = p_stream["block_align"];
+	par->frame_size = p_stream["frame_size"];
+	par->initial_padding = p_stream["initial_padding"];
+	par->trailing_padding = p_stream["trailing_padding"];
+	par->seek_preroll = p_stream["seek_preroll"];
+}
+
+String ProbeCache::get_cache_path(const String &p_source_path) {
+	return String(PROBE_CACHE_DIR).path_join(p_source_path.md5_text() + ".probe");
+}
+
+Error ProbeCache::load(const String &p_source_path, int64_t p_source_size) {
+	entry.clear();
+	const String cache_path = get_cache_path(p_source_path);
+	if (!FileAccess::file_exists(cache_path)) {
+		return ERR_FILE_NOT_FOUND;
+	}
+	Ref<FileAccess> file = FileAccess::open(cache_path, FileAccess::READ);
+	if (file.is_null()) {
+		return ERR_FILE_CANT_OPEN;
+	}
+	const Variant cached = file->get_var();
+	if (cached.get_type() != Variant::DICTIONARY) {
+		return ERR_FILE_CORRUPT;
+	}
+	const Dictionary cached_entry = cached;
+	const bool valid = (int)cached_entry.get("version", 0) == PROBE_CACHE_VERSION &&
+			(String)cached_entry.get("source_path", String()) == p_source_path &&
+			(int64_t)cached_entry.get("source_size", -1) == p_source_size &&
+			(int64_t)cached_entry.get("source_modified_time", -1) == (int64_t)FileAccess::get_modified_time(p_source_path);
+	if (!valid) {
+		return ERR_FILE_CORRUPT;
+	}
+	entry = cached_entry;
+	return get_input_format() != nullptr ? OK : ERR_FILE_UNRECOGNIZED;
+}
+
+const AVInputFormat *ProbeCache::get_input_format() const {
+	if (!entry.has("format_name")) {
+		return nullptr;
+	}
+	return av_find_input_format(String(entry["format_name"]).utf8().get_data());
+}
+
+bool ProbeCache::apply(AVFormatContext *p_format_context) const {
+	ERR_FAIL_COND_V(entry.is_empty(), false);
+	const Array streams = entry["streams"];
+	if ((int)p_format_context->nb_streams != streams.size() || strcmp(p_format_context->iformat->name, String(entry["format_name"]).utf8().get_data()) != 0) {
+		return false;
+	}
+	// Validate everything first so a mismatch leaves the context as the demuxer set it up.
+	for (unsigned int i = 0; i < p_format_context->nb_streams; i++) {
+		const AVStream *stream = p_format_context->streams[i];
+		const Dictionary cached_stream = streams[i];
+		if ((int)cached_stream["codec_type"] != stream->codecpar->codec_type ||
+				(int)cached_stream["codec_id"] != stream->codecpar->codec_id ||
+				(Vector2i)cached_stream["time_base"] != _rational_to_vector(stream->time_base)) {
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < p_format_context->nb_streams; i++) {
+		_apply_stream_dictionary(streams[i], p_format_context->streams[i]);
+	}
+	p_format_context->start_time = entry["start_time"];
+	p_format_context->duration = entry["duration"];
+	p_format_context->bit_rate = entry["bit_rate"];
+	return true;
+}
+
+Error ProbeCache::save(const String &p_source_path, int64_t p_source_size, const AVFormatContext *p_format_context) {
+	// Streams of these formats only show up while packets are read, there's no header to validate an entry against.
+	if (p_format_context->ctx_flags & AVFMTCTX_NOHEADER) {
+		return ERR_UNAVAILABLE;
+	}
+
+	Dictionary cached_entry;
+	cached_entry["version"] = PROBE_CACHE_VERSION;
+	cached_entry["source_path"] = p_source_path;
+	cached_entry["source_size"] = p_source_size;
+	cached_entry["source_modified_time"] = (int64_t)FileAccess::get_modified_time(p_source_path);
+	cached_entry["format_name"] = String(p_format_context->iformat->name);
+	cached_entry["start_time"] = p_format_context->start_time;
+	cached_entry["duration"] = p_format_context->duration;
+	cached_entry["bit_rate"] = p_format_context->bit_rate;
+	Array streams;
+	for (unsigned int i = 0; i < p_format_context->nb_streams; i++) {
+		streams.push_back(_stream_to_dictionary(p_format_context->streams[i]));
+	}
+	cached_entry["streams"] = streams;
+
+	const String cache_path = get_cache_path(p_source_path);
+	Error err = DirAccess::make_dir_recursive_absolute(cache_path.get_base_dir());
+	ERR_FAIL_COND_V_MSG(err != OK && err != ERR_ALREADY_EXISTS, err, vformat("Couldn't create probe cache directory '%s'.", cache_path.get_base_dir()));
+
+	// Written next to the final path and renamed once complete, so a half written entry is never read.
+	const String temp_path = cache_path + ".tmp";
+	Ref<FileAccess> file = FileAccess::open(temp_path, FileAccess::WRITE);
+	ERR_FAIL_COND_V_MSG(file.is_null(), ERR_FILE_CANT_WRITE, vformat("Couldn't write probe cache entry '%s'.", temp_path));
+	file->store_var(cached_entry);
+	err = file->get_error();
+	file.unref();
+	if (err != OK) {
+		DirAccess::remove_absolute(temp_path);
+		return err;
+	}
+	return DirAccess::rename_absolute(temp_path, cache_path);
+}
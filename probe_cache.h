@@ -0,0 +1,71 @@
+/**************************************************************************/
+/*  probe_cache.h                                                         */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/variant/dictionary.h"
+
+#endif
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+// Persistent cache of what avformat_find_stream_info found out about a file, keyed by its path and
+// validated against its size and modification time. A hit lets the file be opened without probing it.
+class ProbeCache {
+	Dictionary entry;
+
+public:
+	static String get_cache_path(const String &p_source_path);
+
+	// Reads the entry of the source file, fails if there is none or if it is stale.
+	Error load(const String &p_source_path, int64_t p_source_size);
+	// Demuxer the entry was made with, open the file with it to skip format probing.
+	const AVInputFormat *get_input_format() const;
+	// Rebuilds the stream parameters of a context opened with get_input_format(), returns false
+	// without touching anything if its streams don't match the entry, the caller then has to probe the file.
+	bool apply(AVFormatContext *p_format_context) const;
+
+	static Error save(const String &p_source_path, int64_t p_source_size, const AVFormatContext *p_format_context);
+};
+
+#endif // PROBE_CACHE_H
@@ -32,16 +32,23 @@
 
 #ifdef GDEXTENSION
 #include "gdextension_build/gdex_print.h"
+#include <godot_cpp/classes/engine.hpp>
 #include <godot_cpp/classes/resource_loader.hpp>
 #else
+#include "core/config/engine.h"
 #include "core/string/print_string.h"
 #include "ffmpeg_stream_info.h"
 #endif
 
+#include "ffmpeg_decoder_registry.h"
 #include "ffmpeg_video_stream.h"
+#include "keyframe_index.h"
+#include "shared_file_cache.h"
 #include "video_stream_ffmpeg_loader.h"
 
 Ref<VideoStreamFFMpegLoader> ffmpeg_loader;
+FFmpegDecoderRegistry *decoder_registry = nullptr;
+SharedFileCache *shared_file_cache = nullptr;
 
 static void print_codecs() {
 	const AVCodecDescriptor *desc = NULL;
@@ -83,7 +90,15 @@ void initialize_ffmpeg_module(ModuleInitializationLevel p_level) {
 	GDREGISTER_ABSTRACT_CLASS(FFmpegVideoStreamPlayback);
 	GDREGISTER_ABSTRACT_CLASS(VideoStreamFFMpegLoader);
 	GDREGISTER_CLASS(FFmpegVideoStream);
-	GDREGISTER_INTERNAL_CLASS(FFmpegFrame);
+	GDREGISTER_ABSTRACT_CLASS(FFmpegDecoderRegistry);
+	decoder_registry = memnew(FFmpegDecoderRegistry);
+#ifdef GDEXTENSION
+	Engine::get_singleton()->register_singleton("FFmpegDecoderRegistry", decoder_registry);
+#else
+	Engine::get_singleton()->add_singleton(Engine::Singleton("FFmpegDecoderRegistry", decoder_registry));
+#endif
+	shared_file_cache = memnew(SharedFileCache);
+	KeyframeIndex::initialize();
 	ffmpeg_loader.instantiate();
 #ifdef GDEXTENSION
 	ResourceLoader::get_singleton()->add_resource_format_loader(ffmpeg_loader);
@@ -102,6 +117,16 @@ void uninitialize_ffmpeg_module(ModuleInitializationLevel p_level) {
 	ResourceLoader::remove_resource_format_loader(ffmpeg_loader);
 #endif
 	ffmpeg_loader.unref();
+#ifdef GDEXTENSION
+	Engine::get_singleton()->unregister_singleton("FFmpegDecoderRegistry");
+#else
+	Engine::get_singleton()->remove_singleton("FFmpegDecoderRegistry");
+#endif
+	memdelete(decoder_registry);
+	decoder_registry = nullptr;
+	memdelete(shared_file_cache);
+	shared_file_cache = nullptr;
+	KeyframeIndex::finalize();
 }
 
 #ifdef GDEXTENSION
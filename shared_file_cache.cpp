@@ -0,0 +1,134 @@
+/**************************************************************************/
+/*  shared_file_cache.cpp                                                 */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "shared_file_cache.h"
+
+#ifdef GDEXTENSION
+#include <godot_cpp/classes/file_access.hpp>
+#else
+#include "core/io/file_access.h"
+#endif
+
+SharedFileCache *SharedFileCache::singleton = nullptr;
+
+void SharedFileCache::_evict(const String &p_keep_path) {
+	while (total_size > budget) {
+		String oldest_path;
+		uint64_t oldest_use = UINT64_MAX;
+		for (const KeyValue<String, Entry> &E : entries) {
+			if (E.value.last_used < oldest_use && E.key != p_keep_path) {
+				oldest_use = E.value.last_used;
+				oldest_path = E.key;
+			}
+		}
+		if (oldest_use == UINT64_MAX) {
+			// A single file larger than the budget is still kept while it's the most recent one.
+			break;
+		}
+		total_size -= entries[oldest_path].data.size();
+		entries.erase(oldest_path);
+	}
+}
+
+PackedByteArray SharedFileCache::get_file(const String &p_path) {
+	const uint64_t modified_time = FileAccess::get_modified_time(p_path);
+	mutex->lock();
+	Entry *cached_entry = entries.getptr(p_path);
+	if (cached_entry != nullptr && cached_entry->modified_time == modified_time) {
+		cached_entry->last_used = ++use_counter;
+		const PackedByteArray cached_data = cached_entry->data;
+		mutex->unlock();
+		return cached_data;
+	}
+	mutex->unlock();
+
+	// Read without holding the lock, at worst two playbacks load the same file at once.
+	Ref<FileAccess> file = FileAccess::open(p_path, FileAccess::READ);
+	if (file.is_null()) {
+		return PackedByteArray();
+	}
+	PackedByteArray data;
+	data.resize(file->get_length());
+	if ((int64_t)file->get_buffer(data.ptrw(), data.size()) != data.size()) {
+		return PackedByteArray();
+	}
+
+	mutex->lock();
+	Entry *entry = entries.getptr(p_path);
+	if (entry != nullptr) {
+		total_size -= entry->data.size();
+	} else {
+		entry = &entries[p_path];
+	}
+	entry->data = data;
+	entry->modified_time = modified_time;
+	entry->last_used = ++use_counter;
+	total_size += data.size();
+	_evict(p_path);
+	mutex->unlock();
+	return data;
+}
+
+void SharedFileCache::clear() {
+	mutex->lock();
+	entries.clear();
+	total_size = 0;
+	mutex->unlock();
+}
+
+void SharedFileCache::set_budget(int64_t p_bytes) {
+	mutex->lock();
+	budget = MAX(p_bytes, (int64_t)0);
+	_evict(String());
+	mutex->unlock();
+}
+
+int64_t SharedFileCache::get_budget() const {
+	mutex->lock();
+	const int64_t current_budget = budget;
+	mutex->unlock();
+	return current_budget;
+}
+
+int64_t SharedFileCache::get_size() const {
+	mutex->lock();
+	const int64_t size = total_size;
+	mutex->unlock();
+	return size;
+}
+
+SharedFileCache::SharedFileCache() {
+	mutex.instantiate();
+	singleton = this;
+}
+
+SharedFileCache::~SharedFileCache() {
+	singleton = nullptr;
+}
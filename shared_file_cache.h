@@ -0,0 +1,88 @@
+/**************************************************************************/
+/*  shared_file_cache.h                                                   */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef SHARED_FILE_CACHE_H
+#define SHARED_FILE_CACHE_H
+
+#include "gdextension_build/sync_compat.h"
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/templates/hash_map.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/string.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/templates/hash_map.h"
+#include "core/variant/variant.h"
+
+#endif
+
+#include <cstdint>
+
+// Video files preloaded into memory, shared by every playback that reads them. Once the cache holds more than
+// its budget the least recently used files are dropped, playbacks still reading a dropped file keep its buffer alive.
+class SharedFileCache {
+	static SharedFileCache *singleton;
+
+	struct Entry {
+		PackedByteArray data;
+		uint64_t modified_time = 0;
+		uint64_t last_used = 0;
+	};
+
+	Ref<core_bind::Mutex> mutex;
+	HashMap<String, Entry> entries;
+	int64_t budget = 64 * 1024 * 1024;
+	int64_t total_size = 0;
+	uint64_t use_counter = 0;
+
+	// Expects the mutex to be held.
+	void _evict(const String &p_keep_path);
+
+public:
+	static SharedFileCache *get_singleton() { return singleton; }
+
+	// Returns the whole file, reading it only if it isn't cached or changed on disk. Empty if it can't be read.
+	PackedByteArray get_file(const String &p_path);
+	void clear();
+	void set_budget(int64_t p_bytes);
+	int64_t get_budget() const;
+	int64_t get_size() const;
+
+	SharedFileCache();
+	~SharedFileCache();
+};
+
+#endif // SHARED_FILE_CACHE_H
@@ -0,0 +1,157 @@
+/**************************************************************************/
+/*  spsc_ring_buffer.h                                                    */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef SPSC_RING_BUFFER_H
+#define SPSC_RING_BUFFER_H
+
+#ifdef GDEXTENSION
+
+// Headers for building as GDExtension plug-in.
+#include <godot_cpp/templates/local_vector.hpp>
+
+using namespace godot;
+
+#else
+
+#include "core/templates/local_vector.h"
+
+#endif
+
+#include <atomic>
+#include <cstdint>
+
+// Fixed capacity ring buffer for handing items from exactly one producer thread to exactly one consumer thread.
+// push() and pop() are wait-free and never allocate once the buffer has been initialized.
+// Every item is tagged with an epoch, flush() bumps the ring's epoch so anything the producer pushes with
+// an older epoch gets silently dropped on the consumer side, this lets seeks discard in-flight items without locking.
+template <class T>
+class SPSCRingBuffer {
+	struct Slot {
+		T value;
+		uint32_t epoch = 0;
+	};
+
+	LocalVector<Slot> slots;
+	uint32_t mask = 0;
+
+	// Producer and consumer positions live on separate cache lines to avoid false sharing.
+	alignas(64) std::atomic<uint32_t> write_pos = { 0 };
+	alignas(64) std::atomic<uint32_t> read_pos = { 0 };
+	std::atomic<uint32_t> epoch = { 0 };
+
+	void _discard_stale() {
+		const uint32_t current_epoch = epoch.load(std::memory_order_acquire);
+		uint32_t read = read_pos.load(std::memory_order_relaxed);
+		const uint32_t write = write_pos.load(std::memory_order_acquire);
+		while (read != write && slots[read & mask].epoch != current_epoch) {
+			slots[read & mask].value = T();
+			read++;
+		}
+		read_pos.store(read, std::memory_order_release);
+	}
+
+public:
+	// Not thread safe, must be called before the producer and the consumer start using the buffer.
+	void init(uint32_t p_capacity) {
+		uint32_t capacity = 1;
+		while (capacity < p_capacity) {
+			capacity <<= 1;
+		}
+		slots.clear();
+		slots.resize(capacity);
+		mask = capacity - 1;
+		write_pos.store(0);
+		read_pos.store(0);
+	}
+
+	uint32_t get_capacity() const {
+		return slots.size();
+	}
+
+	// Exact from the consumer thread, an upper bound from the producer thread.
+	uint32_t size() const {
+		return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire);
+	}
+
+	uint32_t get_epoch() const {
+		return epoch.load(std::memory_order_acquire);
+	}
+
+	// Producer side.
+
+	bool is_full() const {
+		return write_pos.load(std::memory_order_relaxed) - read_pos.load(std::memory_order_acquire) >= slots.size();
+	}
+
+	bool push(const T &p_value, uint32_t p_epoch) {
+		const uint32_t write = write_pos.load(std::memory_order_relaxed);
+		if (write - read_pos.load(std::memory_order_acquire) >= slots.size()) {
+			return false;
+		}
+		Slot &slot = slots[write & mask];
+		slot.value = p_value;
+		slot.epoch = p_epoch;
+		write_pos.store(write + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side.
+
+	// Returns a pointer to the oldest item of the current epoch, valid until the next pop() or flush().
+	T *peek() {
+		_discard_stale();
+		const uint32_t read = read_pos.load(std::memory_order_relaxed);
+		if (read == write_pos.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		return &slots[read & mask].value;
+	}
+
+	bool pop(T &r_value) {
+		if (peek() == nullptr) {
+			return false;
+		}
+		const uint32_t read = read_pos.load(std::memory_order_relaxed);
+		Slot &slot = slots[read & mask];
+		r_value = slot.value;
+		slot.value = T();
+		read_pos.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Drops everything currently queued and starts a new epoch, returns the new epoch the producer should tag its items with.
+	uint32_t flush() {
+		const uint32_t new_epoch = epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+		_discard_stale();
+		return new_epoch;
+	}
+};
+
+#endif // SPSC_RING_BUFFER_H
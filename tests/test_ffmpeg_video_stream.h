@@ -0,0 +1,112 @@
+/**************************************************************************/
+/*  test_ffmpeg_video_stream.h                                            */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef TEST_FFMPEG_VIDEO_STREAM_H
+#define TEST_FFMPEG_VIDEO_STREAM_H
+
+#include "../ffmpeg_video_stream.h"
+
+#include "core/os/os.h"
+
+#include "tests/test_macros.h"
+
+namespace TestFFmpegVideoStream {
+
+// 64x64 VP8, ten frames at 10 FPS, no audio.
+static String get_test_video_path() {
+	return String::utf8(__FILE__).get_base_dir().path_join("data/poster_async.webm");
+}
+
+static Ref<FFmpegVideoStreamPlayback> instantiate_async_poster_playback() {
+	Ref<FFmpegVideoStream> stream;
+	stream.instantiate();
+	stream->set_file(get_test_video_path());
+	stream->set_async_load(true);
+	stream->set_poster_frame(true);
+	return stream->instantiate_playback();
+}
+
+static void wait_for_load(const Ref<FFmpegVideoStreamPlayback> &p_playback) {
+	const uint64_t timeout_usec = OS::get_singleton()->get_ticks_usec() + 5000000;
+	while (p_playback->get_load_state() == FFmpegVideoStreamPlayback::LOAD_STATE_LOADING && OS::get_singleton()->get_ticks_usec() < timeout_usec) {
+		OS::get_singleton()->delay_usec(1000);
+	}
+	REQUIRE(p_playback->get_load_state() == FFmpegVideoStreamPlayback::LOAD_STATE_READY);
+	// The load is finished on the main thread by the next update.
+	p_playback->update(0.0);
+}
+
+TEST_CASE("[SceneTree][Audio][FFmpegVideoStream] Asynchronous load with a poster frame") {
+	SUBCASE("Decoding is held back until the video is played") {
+		Ref<FFmpegVideoStreamPlayback> playback = instantiate_async_poster_playback();
+		REQUIRE(playback.is_valid());
+		wait_for_load(playback);
+		CHECK_FALSE(playback->is_decoding_started());
+
+		playback->play();
+		CHECK(playback->is_decoding_started());
+		CHECK(playback->is_playing());
+	}
+
+	SUBCASE("Playing before the load finishes starts decoding once loaded") {
+		Ref<FFmpegVideoStreamPlayback> playback = instantiate_async_poster_playback();
+		REQUIRE(playback.is_valid());
+		playback->play();
+		CHECK(playback->is_playing());
+
+		wait_for_load(playback);
+		CHECK(playback->is_decoding_started());
+		CHECK(playback->is_playing());
+	}
+
+	SUBCASE("Seeking to the start before the load finishes starts decoding once loaded") {
+		Ref<FFmpegVideoStreamPlayback> playback = instantiate_async_poster_playback();
+		REQUIRE(playback.is_valid());
+		playback->seek(0.0);
+
+		wait_for_load(playback);
+		CHECK(playback->is_decoding_started());
+	}
+
+	SUBCASE("Stopping before the load finishes keeps showing the poster frame") {
+		Ref<FFmpegVideoStreamPlayback> playback = instantiate_async_poster_playback();
+		REQUIRE(playback.is_valid());
+		playback->seek(0.5);
+		playback->stop();
+
+		wait_for_load(playback);
+		CHECK_FALSE(playback->is_decoding_started());
+		CHECK_FALSE(playback->is_playing());
+	}
+}
+
+} // namespace TestFFmpegVideoStream
+
+#endif // TEST_FFMPEG_VIDEO_STREAM_H
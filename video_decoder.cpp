@@ -29,25 +29,76 @@
 /**************************************************************************/
 
 #include "video_decoder.h"
+#include "ffmpeg_decoder_registry.h"
 #include "ffmpeg_frame.h"
+#include "probe_cache.h"
 
 #include "libavcodec/codec.h"
 #include "libavcodec/codec_id.h"
 #include "tracy_import.h"
 #include <cstdio>
+#include <cstring>
 #include <iterator>
 
 #ifdef GDEXTENSION
 #include "gdextension_build/gdex_print.h"
 #include <godot_cpp/classes/rendering_server.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#else
+#include "core/object/worker_thread_pool.h"
 #endif
 
 extern "C" {
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
 }
 
-const int MAX_PENDING_FRAMES = 3;
+const int MIN_FRAME_QUEUE_DEPTH = 2;
+// Hard capacities of the rings, the adaptive frame queue depth never grows past DECODED_FRAMES_CAPACITY.
+const int DECODED_FRAMES_CAPACITY = 64;
+const double DEFAULT_AUDIO_BUFFER_DURATION = 500.0;
+const int64_t DEFAULT_FRAME_QUEUE_MEMORY_BUDGET = 64 * 1024 * 1024;
+const double DEFAULT_FRAME_QUEUE_TARGET_DURATION = 100.0;
+// After this long without stalls the queue gives back one frame worth of memory.
+const uint64_t FRAME_QUEUE_SHRINK_INTERVAL_USEC = 10000000;
+const uint64_t MEMORY_PRESSURE_CHECK_INTERVAL_USEC = 1000000;
+const int64_t LOW_MEMORY_THRESHOLD = 256 * 1024 * 1024;
+// swscale only takes its SIMD paths when the destination stride is a multiple of this.
+const int SWS_STRIDE_ALIGNMENT = 16;
+// With automatic slicing, RGBA conversion gets one slice per this many pixels.
+const int CONVERSION_PIXELS_PER_SLICE = 1024 * 1024;
+// Used to open files the probe cache knows about, 32 bytes is the least FFmpeg accepts.
+const int64_t PROBE_CACHE_HIT_PROBESIZE = 32;
+// FFmpeg's default, restored when a probe cache entry turns out to be stale.
+const int64_t PROBE_DEFAULT_PROBESIZE = 5000000;
+const int DEFAULT_IO_BUFFER_SIZE = 64 * 1024;
+const int64_t DEFAULT_READ_AHEAD_SIZE = 8 * 1024 * 1024;
+// The demuxer stops reading once the packet queues hold this much data in total, or once every queue
+// holds more than PACKET_QUEUE_MIN_PACKETS packets covering at least PACKET_QUEUE_MIN_DURATION msec.
+const int64_t PACKET_QUEUE_MAX_BYTES = 15 * 1024 * 1024;
+const int PACKET_QUEUE_MIN_PACKETS = 25;
+const double PACKET_QUEUE_MIN_DURATION = 1000.0;
+
+static const FFmpegFrameFormatInfo FRAME_FORMAT_INFOS[FFmpegFrameFormat::FRAME_FORMAT_MAX] = {
+	// pixel_format, is_yuv, plane_count, chroma_shift_x, chroma_shift_y, interleaved_chroma, has_alpha, bit_depth, bytes_per_sample, sample_shift
+	{ AV_PIX_FMT_RGBA, false, 1, 0, 0, false, true, 8, 4, 0 }, // RGBA8
+	{ AV_PIX_FMT_YUV420P, true, 3, 1, 1, false, false, 8, 1, 0 }, // YUV420P
+	{ AV_PIX_FMT_YUVA420P, true, 4, 1, 1, false, true, 8, 1, 0 }, // YUVA420P
+	{ AV_PIX_FMT_NV12, true, 2, 1, 1, true, false, 8, 1, 0 }, // NV12
+	{ AV_PIX_FMT_YUV422P, true, 3, 1, 0, false, false, 8, 1, 0 }, // YUV422P
+	{ AV_PIX_FMT_YUV444P, true, 3, 0, 0, false, false, 8, 1, 0 }, // YUV444P
+	{ AV_PIX_FMT_YUV420P10LE, true, 3, 1, 1, false, false, 10, 2, 0 }, // YUV420P10
+	{ AV_PIX_FMT_YUV420P12LE, true, 3, 1, 1, false, false, 12, 2, 0 }, // YUV420P12
+	{ AV_PIX_FMT_P010LE, true, 2, 1, 1, true, false, 10, 2, 6 }, // P010
+	// Only used for sizing, there is no half float format swscale can output.
+	{ AV_PIX_FMT_RGBA64LE, false, 1, 0, 0, false, true, 16, 8, 0 }, // RGBAH
+};
+
+const FFmpegFrameFormatInfo &ffmpeg_get_frame_format_info(FFmpegFrameFormat p_format) {
+	return FRAME_FORMAT_INFOS[CLAMP((int)p_format, 0, (int)FFmpegFrameFormat::FRAME_FORMAT_MAX - 1)];
+}
 
 bool is_hardware_pixel_format(AVPixelFormat p_fmt) {
 	switch (p_fmt) {
@@ -75,96 +126,105 @@ bool is_hardware_pixel_format(AVPixelFormat p_fmt) {
 
 int VideoDecoder::_read_packet_callback(void *p_opaque, uint8_t *p_buf, int p_buf_size) {
 	VideoDecoder *decoder = (VideoDecoder *)p_opaque;
-	uint64_t read_bytes = decoder->video_file->get_buffer(p_buf, p_buf_size);
+	int64_t read_bytes = decoder->input_source->read(p_buf, p_buf_size);
 	return read_bytes != 0 ? read_bytes : AVERROR_EOF;
 }
 
 int64_t VideoDecoder::_stream_seek_callback(void *p_opaque, int64_t p_offset, int p_whence) {
 	VideoDecoder *decoder = (VideoDecoder *)p_opaque;
-	switch (p_whence) {
+	InputSource *input_source = decoder->input_source;
+	// AVSEEK_FORCE only asks us to seek even if it's expensive, which makes no difference here.
+	switch (p_whence & ~AVSEEK_FORCE) {
 		case SEEK_CUR: {
-			decoder->video_file->seek(decoder->video_file->get_position() + p_offset);
+			input_source->seek(input_source->get_position() + p_offset);
 		} break;
 		case SEEK_SET: {
-			decoder->video_file->seek(p_offset);
+			input_source->seek(p_offset);
 		} break;
 		case SEEK_END: {
-			decoder->video_file->seek_end(p_offset);
+			input_source->seek(input_source->get_length() + p_offset);
 		} break;
 		case AVSEEK_SIZE: {
-			return decoder->video_file->get_length();
+			return input_source->get_length();
 		} break;
 		default: {
 			return -1;
 		} break;
 	}
-	return decoder->video_file->get_position();
+	return input_source->get_position();
 }
 
 void VideoDecoder::prepare_decoding() {
 	avio_seek(io_context, 0, SEEK_SET);
+	if (input_source == nullptr && !source_data.is_empty()) {
+		input_source = memnew(MemoryInputSource(source_data, source_data_path));
+	}
+	if (input_source == nullptr && memory_map_enabled && video_file.is_valid() && !video_file->get_path().is_empty()) {
+		MappedInputSource *mapped_input_source = memnew(MappedInputSource);
+		if (mapped_input_source->open(video_file->get_path()) == OK) {
+			input_source = mapped_input_source;
+			input_memory_mapped = true;
+		} else {
+			// Not a plain file on disk, such as a compressed or encrypted file inside a PCK.
+			memdelete(mapped_input_source);
+		}
+	}
+	if (input_source == nullptr) {
+		ERR_FAIL_COND_MSG(video_file.is_null(), "There is no video file or data to decode.");
+		if (read_ahead_size > 0) {
+			input_source = memnew(ReadAheadInputSource(video_file, read_ahead_size));
+		} else {
+			input_source = memnew(FileInputSource(video_file));
+		}
+	}
 	if (!io_context) {
-		const int context_buffer_size = 4096;
-		unsigned char *context_buffer = (unsigned char *)av_malloc(context_buffer_size);
-		io_context = avio_alloc_context(context_buffer, context_buffer_size, 0, this, &VideoDecoder::_read_packet_callback, nullptr, &VideoDecoder::_stream_seek_callback);
+		unsigned char *context_buffer = (unsigned char *)av_malloc(io_buffer_size);
+		io_context = avio_alloc_context(context_buffer, io_buffer_size, 0, this, &VideoDecoder::_read_packet_callback, nullptr, &VideoDecoder::_stream_seek_callback);
 	}
 
 	format_context = avformat_alloc_context();
 	format_context->pb = io_context;
 	format_context->flags |= AVFMT_FLAG_GENPTS;
-	format_context->video_codec = forced_video_codec;
 
-	int open_input_res = avformat_open_input(&format_context, "dummy", nullptr, nullptr);
+	const String source_path = input_source->get_path();
+	ProbeCache probe_cache;
+	const bool probe_cache_hit = !source_path.is_empty() && probe_cache.load(source_path, input_source->get_length()) == OK;
+	if (probe_cache_hit) {
+		// The demuxer is known and the streams come from the cache, only the header has to be read.
+		format_context->probesize = PROBE_CACHE_HIT_PROBESIZE;
+	}
+
+	int open_input_res = avformat_open_input(&format_context, "dummy", probe_cache_hit ? probe_cache.get_input_format() : nullptr, nullptr);
 	input_opened = open_input_res >= 0;
 	ERR_FAIL_COND_MSG(!input_opened, vformat("Error opening file or stream: %s", ffmpeg_get_error_message(open_input_res)));
 
-	AVCodec *codec = nullptr;
-
-	int find_stream_info_result = avformat_find_stream_info(format_context, nullptr);
-	ERR_FAIL_COND_MSG(find_stream_info_result < 0, vformat("Error finding stream info: %s", ffmpeg_get_error_message(find_stream_info_result)));
-
-	int stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, (const AVCodec **)&codec, 0);
-
-	// The stream was found but FFmpeg has no decoder for its codec.
-	// Re-probe ignoring decoder availability so we can name the codec and try a fallback.
-	if (stream_index == AVERROR_DECODER_NOT_FOUND && format_context->video_codec == nullptr) {
-		int raw_stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
-		if (raw_stream_index >= 0) {
-			const AVCodecID unsupported_id = format_context->streams[raw_stream_index]->codecpar->codec_id;
-			String fallback_name = _codec_id_to_preferred_decoder_name(unsupported_id);
-			if (!fallback_name.is_empty()) {
-				forced_video_codec = avcodec_find_decoder_by_name(fallback_name.utf8().get_data());
-				if (forced_video_codec != nullptr) {
-					print_line(vformat("No default decoder for '%s', retrying with '%s'.",
-							avcodec_get_name(unsupported_id), fallback_name));
-					avformat_close_input(&format_context);
-					prepare_decoding();
-					return;
-				}
-			}
-			ERR_FAIL_MSG(vformat("No decoder found for '%s': codec not supported by this FFmpeg build.",
-					avcodec_get_name(unsupported_id)));
+	if (!probe_cache_hit || !probe_cache.apply(format_context)) {
+		if (probe_cache_hit) {
+			print_line(vformat("Probe cache entry of '%s' doesn't match the file, probing it.", source_path));
+			format_context->probesize = PROBE_DEFAULT_PROBESIZE;
+		}
+		int find_stream_info_result = avformat_find_stream_info(format_context, nullptr);
+		ERR_FAIL_COND_MSG(find_stream_info_result < 0, vformat("Error finding stream info: %s", ffmpeg_get_error_message(find_stream_info_result)));
+		if (!source_path.is_empty()) {
+			ProbeCache::save(source_path, input_source->get_length(), format_context);
 		}
 	}
 
+	int stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
 	ERR_FAIL_COND_MSG(stream_index < 0, vformat("Couldn't find video stream: %s", ffmpeg_get_error_message(stream_index)));
 
-	{
-		if (format_context->video_codec == nullptr) {
-			const AVCodecID codec_id = format_context->streams[stream_index]->codecpar->codec_id;
-			String preferred_decoder_name = _codec_id_to_preferred_decoder_name(codec_id);
-			if (!preferred_decoder_name.is_empty()) {
-				forced_video_codec = avcodec_find_decoder_by_name(preferred_decoder_name.utf8().get_data());
-				if (forced_video_codec != nullptr) {
-					avformat_close_input(&format_context);
-					prepare_decoding();
-					return;
-				}
-			}
-		}
+	video_stream = format_context->streams[stream_index];
+
+	// The decoder only matters to the codec context, the file is probed with FFmpeg's default one.
+	const AVCodecParameters *video_params = video_stream->codecpar;
+	const AVDictionaryEntry *alpha_mode = av_dict_get(video_stream->metadata, "alpha_mode", nullptr, 0);
+	video_has_alpha = alpha_mode != nullptr && strcmp(alpha_mode->value, "1") == 0;
+	forced_video_codec = FFmpegDecoderRegistry::get_singleton()->select_decoder(video_params->codec_id, video_params->width, video_params->height, video_has_alpha);
+	if (forced_video_codec == nullptr) {
+		video_stream = nullptr;
+		ERR_FAIL_MSG(vformat("No decoder found for '%s': codec not supported by this FFmpeg build.", avcodec_get_name(video_params->codec_id)));
 	}
 
-	video_stream = format_context->streams[stream_index];
 	video_time_base_in_seconds = video_stream->time_base.num / (double)video_stream->time_base.den;
 	if (video_stream->duration > 0) {
 		duration = video_stream->duration * video_time_base_in_seconds * 1000.0;
@@ -172,6 +232,11 @@ void VideoDecoder::prepare_decoding() {
 		duration = format_context->duration / (double)AV_TIME_BASE * 1000.0;
 	}
 
+	AVRational frame_rate = av_guess_frame_rate(format_context, video_stream, nullptr);
+	if (frame_rate.num > 0 && frame_rate.den > 0) {
+		frame_duration = 1000.0 * frame_rate.den / frame_rate.num;
+	}
+
 	int audio_stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
 	if (audio_stream_index >= 0) {
 		audio_stream = format_context->streams[audio_stream_index];
@@ -185,13 +250,25 @@ Error VideoDecoder::recreate_codec_context() {
 	}
 
 	AVCodecParameters codec_params = *video_stream->codecpar;
+	int decoded_format = codec_params.format;
+	// The file was probed with FFmpeg's default decoder, which ignores the alpha WebM carries next to the video.
+	// libvpx picks it up and outputs it as a fourth plane.
+	if (video_has_alpha && decoded_format == AV_PIX_FMT_YUV420P && FFmpegDecoderRegistry::decoder_supports_alpha(forced_video_codec)) {
+		decoded_format = AV_PIX_FMT_YUVA420P;
+	}
 	// YUV conversion needs rendering device
 	bool has_rendering_device = RenderingServer::get_singleton()->get_rendering_device() != nullptr;
-	bool is_yuv_pixel_fmt = codec_params.format == AVPixelFormat::AV_PIX_FMT_YUV420P || codec_params.format == AVPixelFormat::AV_PIX_FMT_YUVA420P;
-	if (is_yuv_pixel_fmt && has_rendering_device) {
-		frame_format = codec_params.format == AVPixelFormat::AV_PIX_FMT_YUV420P ? FFmpegFrameFormat::YUV420P : FFmpegFrameFormat::YUVA420P;
-	} else {
-		frame_format = FFmpegFrameFormat::RGBA8;
+	frame_format = FFmpegFrameFormat::RGBA8;
+	for (int i = 0; i < FFmpegFrameFormat::FRAME_FORMAT_MAX && has_rendering_device; i++) {
+		const FFmpegFrameFormatInfo &format_info = ffmpeg_get_frame_format_info((FFmpegFrameFormat)i);
+		if (format_info.is_yuv && format_info.pixel_format == decoded_format) {
+			frame_format = (FFmpegFrameFormat)i;
+			break;
+		}
+	}
+	if (!has_rendering_device && YUVCPUConverter::is_supported_high_bit_depth_format(decoded_format)) {
+		// Keep the extra precision instead of squashing it down to 8 bits.
+		frame_format = FFmpegFrameFormat::RGBAH;
 	}
 
 	const AVCodec *decoder = forced_video_codec;
@@ -211,6 +288,10 @@ Error VideoDecoder::recreate_codec_context() {
 	ERR_FAIL_COND_V_MSG(param_copy_result < 0, FAILED, vformat("Couldn't copy codec parameters from %s: %s", decoder->name, ffmpeg_get_error_message(param_copy_result)));
 
 	video_codec_context->thread_count = 0;
+	if (frame_format == FFmpegFrameFormat::RGBA8 && (decoder->capabilities & AV_CODEC_CAP_DR1)) {
+		video_codec_context->opaque = this;
+		video_codec_context->get_buffer2 = _get_video_buffer;
+	}
 
 	int open_codec_result = avcodec_open2(video_codec_context, decoder, nullptr);
 	ERR_FAIL_COND_V_MSG(open_codec_result < 0, FAILED, vformat("Error trying to open %s codec: %s", decoder->name, ffmpeg_get_error_message(open_codec_result)));
@@ -219,6 +300,9 @@ Error VideoDecoder::recreate_codec_context() {
 
 	ERR_FAIL_COND_V_MSG(video_codec_context == nullptr, ERR_CANT_CREATE, vformat("Error creating video codec context: Exhausted all available decoders for codec %s", avcodec_get_name(codec_params.codec_id)));
 
+	_update_frame_queue_limits(Vector2i(video_codec_context->width, video_codec_context->height));
+	frame_queue_depth.store(frame_queue_base_depth.load());
+
 	if (!audio_stream) {
 		return OK;
 	}
@@ -237,117 +321,376 @@ Error VideoDecoder::recreate_codec_context() {
 		ERR_FAIL_COND_V_MSG(param_copy_result < 0, FAILED, vformat("Couldn't copy codec parameters from %s: %s", codec->name, ffmpeg_get_error_message(param_copy_result)));
 		int open_codec_result = avcodec_open2(audio_codec_context, codec, nullptr);
 		ERR_FAIL_COND_V_MSG(open_codec_result < 0, ERR_CANT_OPEN, vformat("Error trying to open %s codec: %s", codec->name, ffmpeg_get_error_message(open_codec_result)));
+		// Decoded audio is converted to one fixed layout and rate, even if the source changes them mid-stream.
+		int output_channel_count = audio_output_channel_count > 0 ? audio_output_channel_count : audio_codec_context->ch_layout.nb_channels;
+		if (output_channel_count > 2 && output_channel_count != 4 && output_channel_count != 6 && output_channel_count != 8) {
+			// Godot can only mix 1, 2, 4, 6 and 8 channels.
+			output_channel_count = 2;
+		}
+		av_channel_layout_uninit(&audio_output_ch_layout);
+		av_channel_layout_default(&audio_output_ch_layout, output_channel_count);
+		audio_output_sample_rate = audio_output_mix_rate > 0 ? audio_output_mix_rate : audio_codec_context->sample_rate;
+		decoded_audio.init(audio_output_ch_layout.nb_channels, audio_output_sample_rate, audio_buffer_duration);
 		has_audio = true;
 	}
 	return OK;
 }
 
-void VideoDecoder::_seek_command(double p_target_timestamp) {
-	avcodec_flush_buffers(video_codec_context);
-	av_seek_frame(format_context, video_stream->index, (long)(p_target_timestamp / video_time_base_in_seconds / 1000.0), AVSEEK_FLAG_BACKWARD);
+bool VideoDecoder::_is_valid_state_transition(DecoderState p_from, DecoderState p_to) {
+	if (p_from == p_to) {
+		return true;
+	}
+	switch (p_from) {
+		case READY:
+		case RUNNING: {
+			return true;
+		}
+		case END_OF_STREAM: {
+			// END_OF_STREAM can only be left through a seek, which puts us back into READY.
+			return p_to != RUNNING;
+		}
+		case FAULTED:
+		case STOPPED: {
+			// Terminal states.
+			return false;
+		}
+	}
+	return false;
+}
+
+bool VideoDecoder::_set_decoder_state(DecoderState p_state) {
+	DecoderState current_state = decoder_state.load();
+	do {
+		if (!_is_valid_state_transition(current_state, p_state)) {
+			return false;
+		}
+	} while (!decoder_state.compare_exchange_weak(current_state, p_state));
+	return true;
+}
+
+void VideoDecoder::_update_frame_queue_limits(const Vector2i &p_frame_size) {
+	frame_queue_limits_dirty.clear();
+	if (frame_queue_frame_size != p_frame_size) {
+		// Buffers for the old resolution will never be asked for again.
+		frame_buffer_pool.trim();
+	}
+	frame_buffer_pool.set_high_water_mark(frame_queue_memory_budget.load());
+	frame_queue_frame_size = p_frame_size;
+	frame_queue_frame_size_bytes = MAX(av_image_get_buffer_size(ffmpeg_get_frame_format_info(frame_format).pixel_format, p_frame_size.x, p_frame_size.y, 1), 1);
+
+	const int max_depth = CLAMP(frame_queue_memory_budget.load() / frame_queue_frame_size_bytes, (int64_t)MIN_FRAME_QUEUE_DEPTH, (int64_t)DECODED_FRAMES_CAPACITY);
+	const int base_depth = CLAMP((int)Math::ceil(frame_queue_target_duration.load() / frame_duration), MIN_FRAME_QUEUE_DEPTH, max_depth);
+	frame_queue_max_depth.store(max_depth);
+	frame_queue_base_depth.store(base_depth);
+	// Keep whatever depth previous stalls taught us as long as it still fits in the budget.
+	frame_queue_depth.store(CLAMP(frame_queue_depth.load(), base_depth, max_depth));
+}
+
+void VideoDecoder::_check_memory_pressure() {
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+	if (now - last_memory_pressure_check_usec < MEMORY_PRESSURE_CHECK_INTERVAL_USEC) {
+		return;
+	}
+	last_memory_pressure_check_usec = now;
+
+	Dictionary memory_info = OS::get_singleton()->get_memory_info();
+	const int64_t available_memory = memory_info.get("available", -1);
+	if (available_memory < 0 || available_memory > LOW_MEMORY_THRESHOLD) {
+		return;
+	}
+
+	const int depth = frame_queue_depth.load();
+	const int new_depth = MAX(depth / 2, MIN_FRAME_QUEUE_DEPTH);
+	if (new_depth != depth) {
+		frame_queue_depth.store(new_depth);
+		print_line(vformat("Low on memory, shrinking video frame queue from %d to %d frames.", depth, new_depth));
+	}
+}
+
+void VideoDecoder::_on_frame_queue_starved() {
+	// Only count each underrun once, and ignore the wait for the first frames after a seek.
+	if (frame_queue_starved || frames_popped_since_seek == 0) {
+		return;
+	}
+	const DecoderState state = decoder_state.load();
+	if (state != DecoderState::READY && state != DecoderState::RUNNING) {
+		return;
+	}
+	frame_queue_starved = true;
+	frame_queue_stall_count.fetch_add(1);
+	last_frame_queue_adjustment_usec = OS::get_singleton()->get_ticks_usec();
+
+	const int depth = frame_queue_depth.load();
+	if (depth < frame_queue_max_depth.load()) {
+		frame_queue_depth.store(depth + 1);
+		video_output_wakeup->post();
+	}
+}
+
+void VideoDecoder::_on_frame_popped() {
+	frame_queue_starved = false;
+	frames_popped_since_seek++;
+
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+	if (now - last_frame_queue_adjustment_usec < FRAME_QUEUE_SHRINK_INTERVAL_USEC) {
+		return;
+	}
+	last_frame_queue_adjustment_usec = now;
+	const int depth = frame_queue_depth.load();
+	if (depth > frame_queue_base_depth.load()) {
+		frame_queue_depth.store(depth - 1);
+	}
+}
+
+void VideoDecoder::_start_keyframe_index() {
+	keyframe_index_source_path = input_source->get_path();
+	if (!keyframe_index_enabled || keyframe_index_source_path.is_empty()) {
+		return;
+	}
+	KeyframeIndex *index = memnew(KeyframeIndex);
+	if (index->load(KeyframeIndex::get_cache_path(keyframe_index_source_path), keyframe_index_source_path, video_stream->index, video_stream->time_base) == OK) {
+		keyframe_index.store(index);
+		return;
+	}
+	memdelete(index);
+	if (!KeyframeIndex::begin_build(keyframe_index_source_path)) {
+		// Someone else is scanning the file already, we pick up their sidecar once it's written.
+		keyframe_index_pending.store(true);
+		return;
+	}
+	keyframe_index_thread = memnew(std::thread(_keyframe_index_thread_func, this));
+}
+
+const KeyframeIndex *VideoDecoder::_get_keyframe_index() const {
+	KeyframeIndex *index = keyframe_index.load();
+	if (index != nullptr || !keyframe_index_pending.load() || KeyframeIndex::is_building(keyframe_index_source_path)) {
+		return index;
+	}
+	// The other build is over, whether it succeeded or not there is no point in trying again.
+	if (!keyframe_index_pending.exchange(false)) {
+		return keyframe_index.load();
+	}
+	index = memnew(KeyframeIndex);
+	if (index->load(KeyframeIndex::get_cache_path(keyframe_index_source_path), keyframe_index_source_path, video_stream->index, video_stream->time_base) != OK) {
+		memdelete(index);
+		return nullptr;
+	}
+	keyframe_index.store(index);
+	return index;
+}
+
+void VideoDecoder::_keyframe_index_thread_func(void *userdata) {
+	VideoDecoder *decoder = (VideoDecoder *)userdata;
+	KeyframeIndex *index = memnew(KeyframeIndex);
+	if (index->build(decoder->keyframe_index_source_path, decoder->video_stream->index, decoder->keyframe_index_abort) != OK) {
+		memdelete(index);
+		KeyframeIndex::end_build(decoder->keyframe_index_source_path);
+		return;
+	}
+	index->save(KeyframeIndex::get_cache_path(decoder->keyframe_index_source_path));
+	decoder->keyframe_index.store(index);
+	KeyframeIndex::end_build(decoder->keyframe_index_source_path);
+}
+
+bool VideoDecoder::_seek_to_keyframe(int64_t p_target_pts) {
+	const KeyframeIndex *index = _get_keyframe_index();
+	if (index == nullptr) {
+		return false;
+	}
+	const KeyframeIndex::Entry *keyframe = index->find_keyframe(p_target_pts);
+	if (keyframe == nullptr) {
+		return false;
+	}
+	// Byte seeking lands right on the keyframe's packet without the demuxer having to search for it, but only
+	// containers whose packets carry their own timestamps pick up correctly from an arbitrary byte position.
+	const int format_flags = format_context->iformat->flags;
+	if (keyframe->pos >= 0 && (format_flags & AVFMT_TS_DISCONT) && !(format_flags & AVFMT_NO_BYTE_SEEK)) {
+		if (av_seek_frame(format_context, video_stream->index, keyframe->pos, AVSEEK_FLAG_BYTE) >= 0) {
+			return true;
+		}
+	}
+	// Seeking to the keyframe's exact timestamp still spares the demuxer from guessing.
+	return av_seek_frame(format_context, video_stream->index, keyframe->pts, AVSEEK_FLAG_BACKWARD) >= 0;
+}
+
+void VideoDecoder::_seek_command(double p_target_timestamp, uint32_t p_video_epoch, uint32_t p_audio_epoch, bool p_notify) {
+	const int64_t start_time = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+	if (!_seek_to_keyframe(start_time + (int64_t)(p_target_timestamp / video_time_base_in_seconds / 1000.0))) {
+		av_seek_frame(format_context, video_stream->index, (long)(p_target_timestamp / video_time_base_in_seconds / 1000.0), AVSEEK_FLAG_BACKWARD);
+	}
 	// No need to seek the audio stream separately since it is seeked automatically with the video stream
-	// due to being in the same file
+	// due to being in the same file.
+	// The workers flush their codecs once they reach the flush entry, everything queued before it is dropped.
+	video_packets.flush(p_video_epoch, p_target_timestamp);
 	if (has_audio) {
-		avcodec_flush_buffers(audio_codec_context);
+		audio_packets.flush(p_audio_epoch, p_target_timestamp);
+	}
+	demux_eof = false;
+	_set_decoder_state(DecoderState::READY);
+	completed_seek_epoch.store(p_video_epoch);
+	if (p_notify) {
+		seek_done->post();
 	}
-	skip_output_until_time = p_target_timestamp;
-	decoder_state = DecoderState::READY;
-	skip_current_outputs.clear();
 }
 
-void VideoDecoder::_thread_func(void *userdata) {
+void VideoDecoder::_demux_thread_func(void *userdata) {
 	VideoDecoder *decoder = (VideoDecoder *)userdata;
 	AVPacket *packet = av_packet_alloc();
-	AVFrame *receive_frame = av_frame_alloc();
 
-#ifdef GDEXTENSION
-	String video_decoding_str = vformat("Video decoding %d", OS::get_singleton()->get_thread_caller_id());
-#else
-	String video_decoding_str = vformat("Video decoding %d", Thread::get_caller_id());
-#endif
-	CharString str = video_decoding_str.utf8();
 	while (!decoder->thread_abort.is_set()) {
-		switch (decoder->decoder_state) {
+		switch (decoder->decoder_state.load()) {
 			case READY:
 			case RUNNING: {
-				decoder->decoded_frames_mutex->lock();
-				bool needs_frame = decoder->decoded_frames.size() < MAX_PENDING_FRAMES;
-				decoder->decoded_frames_mutex->unlock();
-				if (needs_frame) {
-					FrameMarkStart(video_decoding);
-					decoder->_decode_next_frame(packet, receive_frame);
-					FrameMarkEnd(video_decoding);
+				if (decoder->demux_eof) {
+					// Everything has been demuxed, the stream only ends once the workers have output their last frames.
+					if (decoder->_are_packet_queues_drained()) {
+						decoder->_set_decoder_state(DecoderState::END_OF_STREAM);
+					} else {
+						decoder->demux_wakeup->wait();
+					}
+				} else if (decoder->_has_enough_packets()) {
+					decoder->_set_decoder_state(DecoderState::READY);
+					// Sleep until a worker takes a packet, a command is pushed or we are told to abort.
+					decoder->demux_wakeup->wait();
 				} else {
-					decoder->decoder_state = DecoderState::READY;
-					OS::get_singleton()->delay_usec(1000);
+					decoder->_demux_next_packet(packet);
 				}
 			} break;
 			case END_OF_STREAM: {
 				// While at the end of the stream, avoid attempting to read further as this comes with a non-negligible overhead.
-				// A Seek() operation will trigger a state change, allowing decoding to potentially start again.
-				OS::get_singleton()->delay_usec(50000);
+				// A seek command will wake us up and trigger a state change, allowing decoding to potentially start again.
+				decoder->demux_wakeup->wait();
 			} break;
 			default: {
 				ERR_PRINT("Invalid decoder state");
+				decoder->demux_wakeup->wait();
 			} break;
 		}
 		decoder->decoder_commands.flush_if_pending();
 	}
 
 	av_packet_free(&packet);
-	av_frame_free(&receive_frame);
 
-	if (decoder->decoder_state != DecoderState::FAULTED) {
-		decoder->decoder_state = DecoderState::STOPPED;
-	}
+	decoder->_set_decoder_state(DecoderState::STOPPED);
 }
 
-void VideoDecoder::_decode_next_frame(AVPacket *p_packet, AVFrame *p_receive_frame) {
-	ZoneScopedN("Video decoder decode next frame");
-	int read_frame_result = 0;
-
-	if (p_packet->buf == nullptr) {
-		read_frame_result = av_read_frame(format_context, p_packet);
-	}
-
-	if (read_frame_result >= 0) {
-		decoder_state = DecoderState::RUNNING;
-
-		bool unref_packet = true;
+void VideoDecoder::_video_decode_thread_func(void *userdata) {
+	VideoDecoder *decoder = (VideoDecoder *)userdata;
+	decoder->_run_decode_worker(decoder->video_packets, decoder->video_codec_context);
+}
 
-		if ((video_stream && p_packet->stream_index == video_stream->index) || (audio_stream && p_packet->stream_index == audio_stream->index)) {
-			AVCodecContext *codec_ctx = video_codec_context;
-			if (has_audio && p_packet->stream_index == audio_stream->index) {
-				codec_ctx = audio_codec_context;
-			}
-			int send_packet_result = _send_packet(codec_ctx, p_receive_frame, p_packet);
+void VideoDecoder::_audio_decode_thread_func(void *userdata) {
+	VideoDecoder *decoder = (VideoDecoder *)userdata;
+	decoder->_run_decode_worker(decoder->audio_packets, decoder->audio_codec_context);
+}
 
-			if (send_packet_result == -EAGAIN) {
-				unref_packet = false;
-			}
-		}
+void VideoDecoder::_demux_next_packet(AVPacket *p_packet) {
+	ZoneScopedN("Video decoder demux next packet");
+	int read_frame_result = av_read_frame(format_context, p_packet);
 
-		if (unref_packet) {
-			av_packet_unref(p_packet);
+	if (read_frame_result >= 0) {
+		_set_decoder_state(DecoderState::RUNNING);
+		if (p_packet->stream_index == video_stream->index) {
+			video_packets.put(p_packet);
+		} else if (has_audio && p_packet->stream_index == audio_stream->index) {
+			audio_packets.put(p_packet);
 		}
+		av_packet_unref(p_packet);
 	} else if (read_frame_result == AVERROR_EOF) {
-		_send_packet(video_codec_context, p_receive_frame, nullptr);
+		video_drain_id = video_packets.put_drain();
 		if (has_audio) {
-			_send_packet(audio_codec_context, p_receive_frame, nullptr);
+			audio_drain_id = audio_packets.put_drain();
 		}
 		if (looping) {
-			seek(0);
+			// Rewind without starting a new serial, frames from the end of the last loop are still valid.
+			av_seek_frame(format_context, video_stream->index, 0, AVSEEK_FLAG_BACKWARD);
 		} else {
-			decoder_state = DecoderState::END_OF_STREAM;
+			demux_eof = true;
 		}
 	} else if (read_frame_result == -EAGAIN) {
-		decoder_state = DecoderState::READY;
-		OS::get_singleton()->delay_usec(1000);
+		// The demuxer has no data for us yet and gives us nothing to wait on, retry once the consumer checks for the next frame.
+		_set_decoder_state(DecoderState::READY);
+		demux_waiting_for_input.set();
+		demux_wakeup->wait();
 	} else {
 		print_line(vformat("Failed to read data into avcodec packet: %s", ffmpeg_get_error_message(read_frame_result)));
 	}
 }
 
+bool VideoDecoder::_has_enough_packets() {
+	if (video_packets.get_size_bytes() + audio_packets.get_size_bytes() > PACKET_QUEUE_MAX_BYTES) {
+		return true;
+	}
+	return video_packets.has_enough_packets(PACKET_QUEUE_MIN_PACKETS, PACKET_QUEUE_MIN_DURATION) && (!has_audio || audio_packets.has_enough_packets(PACKET_QUEUE_MIN_PACKETS, PACKET_QUEUE_MIN_DURATION));
+}
+
+bool VideoDecoder::_are_packet_queues_drained() {
+	return video_packets.is_drained(video_drain_id) && (!has_audio || audio_packets.is_drained(audio_drain_id));
+}
+
+void VideoDecoder::_run_decode_worker(PacketQueue &p_queue, AVCodecContext *p_codec_context) {
+	const bool is_video = p_codec_context == video_codec_context;
+	AVFrame *receive_frame = av_frame_alloc();
+
+#ifdef GDEXTENSION
+	String video_decoding_str = vformat("%s decoding %d", is_video ? "Video" : "Audio", OS::get_singleton()->get_thread_caller_id());
+#else
+	String video_decoding_str = vformat("%s decoding %d", is_video ? "Video" : "Audio", Thread::get_caller_id());
+#endif
+	CharString str = video_decoding_str.utf8();
+
+	PacketQueue::Entry entry;
+	while (!thread_abort.is_set()) {
+		if (is_video) {
+			_check_memory_pressure();
+			// Don't decode further ahead than the frame queue depth, the consumer wakes us up when it takes a frame.
+			while (!thread_abort.is_set() && decoded_frames.size() >= (uint32_t)frame_queue_depth.load()) {
+				video_output_wakeup->wait();
+			}
+		}
+
+		if (!p_queue.get(entry)) {
+			break;
+		}
+		// A packet queue slot was freed, the demuxer might be waiting for one.
+		demux_wakeup->post();
+
+		switch (entry.type) {
+			case PacketQueue::FLUSH: {
+				avcodec_flush_buffers(p_codec_context);
+				if (is_video) {
+					video_skip_output_until_time = entry.skip_output_until_time;
+					video_output_epoch = entry.serial;
+				} else {
+					audio_skip_output_until_time = entry.skip_output_until_time;
+					audio_output_epoch = entry.serial;
+					// Whatever the resampler held back belongs to the position before the seek.
+					if (swr_context != nullptr) {
+						swr_init(swr_context);
+					}
+				}
+			} break;
+			case PacketQueue::PACKET: {
+				FrameMarkStart(video_decoding);
+				// EAGAIN means the codec output was full, _send_packet has read it by now so we can try again.
+				while (_send_packet(p_codec_context, receive_frame, entry.packet) == -EAGAIN && !thread_abort.is_set()) {
+				}
+				FrameMarkEnd(video_decoding);
+				av_packet_free(&entry.packet);
+			} break;
+			case PacketQueue::DRAIN: {
+				_send_packet(p_codec_context, receive_frame, nullptr);
+				// A drained codec only accepts new packets after being flushed, this matters when looping.
+				avcodec_flush_buffers(p_codec_context);
+				p_queue.mark_drained(entry.drain_id);
+				demux_wakeup->post();
+			} break;
+		}
+	}
+
+	av_frame_free(&receive_frame);
+}
+
 int VideoDecoder::_send_packet(AVCodecContext *p_codec_context, AVFrame *p_receive_frame, AVPacket *p_packet) {
 	ZoneScopedN("Video/audio decoder send packet");
 	// send the packet for decoding.
@@ -364,7 +707,7 @@ int VideoDecoder::_send_packet(AVCodecContext *p_codec_context, AVFrame *p_recei
 		} else {
 			_read_decoded_audio_frames(p_receive_frame);
 		}
-	} else if (format_context->streams[p_packet->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+	} else if (p_codec_context->codec_type == AVMEDIA_TYPE_VIDEO) {
 		print_line(vformat("Failed to send avcodec packet: %s", ffmpeg_get_error_message(send_packet_result)));
 	}
 
@@ -372,8 +715,6 @@ int VideoDecoder::_send_packet(AVCodecContext *p_codec_context, AVFrame *p_recei
 }
 
 void VideoDecoder::_read_decoded_frames(AVFrame *p_received_frame) {
-	Ref<Image> image;
-	PackedByteArray unwrapped_frame;
 	while (true) {
 		ZoneScopedN("Video decoder read decoded frame");
 		int receive_frame_result = avcodec_receive_frame(video_codec_context, p_received_frame);
@@ -390,54 +731,34 @@ void VideoDecoder::_read_decoded_frames(AVFrame *p_received_frame) {
 		int64_t frame_timestamp = p_received_frame->best_effort_timestamp != AV_NOPTS_VALUE ? p_received_frame->best_effort_timestamp : p_received_frame->pts;
 		double frame_time = (frame_timestamp - video_stream->start_time) * video_time_base_in_seconds * 1000.0;
 
-		if (skip_output_until_time > frame_time || skip_current_outputs.is_set()) {
+		if (video_skip_output_until_time > frame_time || decoded_frames.get_epoch() != video_output_epoch) {
 			continue;
 		}
 
-		Ref<FFmpegFrame> frame;
-		// copy data to a new AVFrame so that `receiveFrame` can be reused.
-		frame.instantiate();
-		av_frame_move_ref(frame->get_frame(), p_received_frame);
+		const Vector2i frame_size = Vector2i(p_received_frame->width, p_received_frame->height);
+		if (frame_size != frame_queue_frame_size || frame_queue_limits_dirty.is_set()) {
+			_update_frame_queue_limits(frame_size);
+		}
 
 		last_decoded_frame_time.set(frame_time);
 
-		if (frame_format == FFmpegFrameFormat::YUV420P || frame_format == FFmpegFrameFormat::YUVA420P) {
+		// The received frame is fully consumed before the next one is received, so it can be worked on in place.
+		if (ffmpeg_get_frame_format_info(frame_format).is_yuv) {
 			// Special path for YUV images
-			Ref<DecodedFrame> yuv_frame = _unwrap_yuv_frame(frame_time, frame, frame_format);
-			decoded_frames_mutex->lock();
-			if (!skip_current_outputs.is_set()) {
-				decoded_frames.push_back(yuv_frame);
+			Ref<DecodedFrame> yuv_frame = _unwrap_yuv_frame(frame_time, p_received_frame, frame_format);
+			av_frame_unref(p_received_frame);
+			if (!yuv_frame.is_valid()) {
+				continue;
 			}
-			decoded_frames_mutex->unlock();
+			_push_output(decoded_frames, yuv_frame, video_output_epoch, video_output_wakeup);
 			continue;
 		}
 
-		// Note: this is the pixel format that the video texture expects internally
-		frame = _ensure_frame_pixel_format(frame, AVPixelFormat::AV_PIX_FMT_RGBA);
-		if (!frame.is_valid()) {
+		Ref<Image> image = _frame_to_rgba_image(p_received_frame);
+		av_frame_unref(p_received_frame);
+		if (!image.is_valid()) {
 			continue;
 		}
-
-		ZoneNamedN(image_unwrap, "Image unwrap", true);
-		// Unwrap the image
-		int width = frame->get_frame()->width;
-		int height = frame->get_frame()->height;
-		{
-			ZoneNamedN(image_unwrap_copy, "Image unwrap copy", true);
-
-			int frame_size = frame->get_frame()->buf[0]->size; // Change this if we ever allow RGBA
-			unwrapped_frame.resize(frame_size);
-			uint8_t *unwrapped_frame_ptrw = unwrapped_frame.ptrw();
-			{
-				ZoneNamedN(image_unwrap_memcopy, "memcpy", true);
-				for (int y = 0; y < height; y++) {
-					memcpy(unwrapped_frame_ptrw, frame->get_frame()->data[0] + y * frame->get_frame()->linesize[0], width * 4);
-					unwrapped_frame_ptrw += width * 4;
-				}
-			}
-			unwrapped_frame.resize(width * height * 4);
-			image = Image::create_from_data(width, height, false, Image::FORMAT_RGBA8, unwrapped_frame);
-		}
 #ifdef FFMPEG_MT_GPU_UPLOAD
 		Ref<ImageTexture> tex;
 		available_textures_mutex->lock();
@@ -456,16 +777,13 @@ void VideoDecoder::_read_decoded_frames(AVFrame *p_received_frame) {
 				tex->update(image);
 			}
 		}
-		decoded_frames_mutex->lock();
-		decoded_frames.push_back(memnew(DecodedFrame(frame_time, tex)));
-		decoded_frames_mutex->unlock();
+		Ref<DecodedFrame> decoded_frame = _acquire_decoded_frame(frame_time, FFmpegFrameFormat::RGBA8);
+		decoded_frame->set_texture(tex);
 #else
-		decoded_frames_mutex->lock();
-		if (!skip_current_outputs.is_set()) {
-			decoded_frames.push_back(memnew(DecodedFrame(frame_time, image)));
-		}
-		decoded_frames_mutex->unlock();
+		Ref<DecodedFrame> decoded_frame = _acquire_decoded_frame(frame_time, FFmpegFrameFormat::RGBA8);
+		decoded_frame->set_image(image);
 #endif
+		_push_output(decoded_frames, decoded_frame, video_output_epoch, video_output_wakeup);
 	}
 }
 
@@ -487,67 +805,209 @@ void VideoDecoder::_read_decoded_audio_frames(AVFrame *p_received_frame) {
 		int64_t frame_timestamp = p_received_frame->best_effort_timestamp != AV_NOPTS_VALUE ? p_received_frame->best_effort_timestamp : p_received_frame->pts;
 		double frame_time = (frame_timestamp - audio_stream->start_time) * audio_time_base_in_seconds * 1000.0;
 
-		if (skip_output_until_time > frame_time || skip_current_outputs.is_set()) {
+		if (audio_skip_output_until_time > frame_time || decoded_audio.get_epoch() != audio_output_epoch) {
 			continue;
 		}
 
-		AVFrame *frame = _ensure_frame_audio_format(p_received_frame, AV_SAMPLE_FMT_FLT);
-
-		if (!frame) {
+		int converted_frame_count = 0;
+		double converted_time = frame_time;
+		{
+			ZoneScopedN("Audio decoder resample");
+			SwrContext *resampler = _get_resampler_context(p_received_frame);
+			// Drop just this frame, the next ones may still convert and the packets behind them must be drained.
+			if (!resampler) {
+				av_frame_unref(p_received_frame);
+				continue;
+			}
+			// Samples the resampler held back from earlier frames come out first.
+			converted_time -= swr_get_delay(resampler, audio_output_sample_rate) * 1000.0 / audio_output_sample_rate;
+			const int max_output_frames = swr_get_out_samples(resampler, p_received_frame->nb_samples);
+			const uint32_t buffer_size = MAX(max_output_frames, 0) * audio_output_ch_layout.nb_channels;
+			if (audio_conversion_buffer.size() < buffer_size) {
+				audio_conversion_buffer.resize(buffer_size);
+			}
+			uint8_t *output = (uint8_t *)audio_conversion_buffer.ptr();
+			converted_frame_count = swr_convert(resampler, &output, max_output_frames, (const uint8_t **)p_received_frame->extended_data, p_received_frame->nb_samples);
 			av_frame_unref(p_received_frame);
-			return;
+			if (converted_frame_count < 0) {
+				print_line("Failed to convert audio frame:", ffmpeg_get_error_message(converted_frame_count));
+				continue;
+			}
 		}
 
-		ERR_FAIL_COND_MSG(av_sample_fmt_is_planar((AVSampleFormat)frame->format), "Audio format should never be planar, bug?");
+		// Frames that are too large for the ring are pushed in pieces, each with its own timestamp.
+		const uint32_t max_block_frames = decoded_audio.get_capacity_frames() / 2;
+		const float *samples = audio_conversion_buffer.ptr();
+		uint32_t frames_pushed = 0;
+		while (frames_pushed < (uint32_t)converted_frame_count) {
+			const uint32_t block_frames = MIN((uint32_t)converted_frame_count - frames_pushed, max_block_frames);
+			const double block_time = converted_time + frames_pushed * 1000.0 / audio_output_sample_rate;
+			if (!_push_audio_output(samples + frames_pushed * audio_output_ch_layout.nb_channels, block_frames, block_time)) {
+				break;
+			}
+			frames_pushed += block_frames;
+		}
+	}
+}
 
-		int data_size = av_samples_get_buffer_size(nullptr, frame->ch_layout.nb_channels, frame->nb_samples, (AVSampleFormat)frame->format, 0);
-		Ref<DecodedAudioFrame> audio_frame = memnew(DecodedAudioFrame(frame_time));
-		audio_frame->sample_data.resize(data_size / sizeof(float));
-		memcpy(audio_frame->sample_data.ptrw(), frame->data[0], data_size);
-		audio_buffer_mutex->lock();
-		if (!skip_current_outputs.is_set()) {
-			decoded_audio_frames.push_back(audio_frame);
+template <class T>
+bool VideoDecoder::_push_output(SPSCRingBuffer<Ref<T>> &p_ring, const Ref<T> &p_output, uint32_t p_epoch, const Ref<core_bind::Semaphore> &p_wakeup) {
+	while (!p_ring.push(p_output, p_epoch)) {
+		// The output went stale while we were waiting or we are shutting down, drop it.
+		if (thread_abort.is_set() || p_ring.get_epoch() != p_epoch) {
+			return false;
 		}
-		audio_buffer_mutex->unlock();
+		// The consumer wakes us up whenever it pops something.
+		p_wakeup->wait();
+	}
+	return true;
+}
 
-		av_frame_unref(p_received_frame);
-		if (frame != p_received_frame) {
-			av_frame_free(&frame);
+bool VideoDecoder::_push_audio_output(const float *p_samples, uint32_t p_frame_count, double p_time) {
+	while (!decoded_audio.push(p_samples, p_frame_count, p_time, audio_output_epoch)) {
+		// Same as _push_output, a full ring stalls the audio decoder until the playback mixes something.
+		if (thread_abort.is_set() || decoded_audio.get_epoch() != audio_output_epoch) {
+			return false;
 		}
+		audio_output_wakeup->wait();
 	}
+	return true;
 }
 
-void VideoDecoder::_scaler_frame_return(Ref<FFmpegFrame> p_scaler_frame) {
-	scaler_frames.push_back(p_scaler_frame);
+FFmpegFrame *VideoDecoder::_pop_free_frame(FFmpegFrame *&r_free_list, const Ref<core_bind::Mutex> &p_mutex) {
+	p_mutex->lock();
+	FFmpegFrame *frame = r_free_list;
+	if (frame != nullptr) {
+		r_free_list = frame->next_free;
+		frame->next_free = nullptr;
+	}
+	p_mutex->unlock();
+	return frame;
 }
 
-Ref<FFmpegFrame> VideoDecoder::_ensure_frame_pixel_format(Ref<FFmpegFrame> p_frame, AVPixelFormat p_target_pixel_format) {
-	ZoneScopedN("Video decoder rescale");
+void VideoDecoder::_push_free_frame(FFmpegFrame *&r_free_list, const Ref<core_bind::Mutex> &p_mutex, FFmpegFrame *p_frame) {
+	p_mutex->lock();
+	p_frame->next_free = r_free_list;
+	r_free_list = p_frame;
+	p_mutex->unlock();
+}
 
-	if (p_frame->get_frame()->format == p_target_pixel_format) {
-		return p_frame;
+void VideoDecoder::_free_frame_list(FFmpegFrame *&r_free_list) {
+	while (r_free_list != nullptr) {
+		FFmpegFrame *next = r_free_list->next_free;
+		memdelete(r_free_list);
+		r_free_list = next;
 	}
+}
+
+void VideoDecoder::_hw_transfer_frame_return(void *p_userdata, FFmpegFrame *p_hw_frame) {
+	VideoDecoder *decoder = (VideoDecoder *)p_userdata;
+	av_frame_unref(p_hw_frame->get_frame());
+	_push_free_frame(decoder->hw_transfer_frames, decoder->hw_transfer_frames_mutex, p_hw_frame);
+}
 
-	int width = p_frame->get_frame()->width;
-	int height = p_frame->get_frame()->height;
+void VideoDecoder::_scaler_frame_return(void *p_userdata, FFmpegFrame *p_scaler_frame) {
+	VideoDecoder *decoder = (VideoDecoder *)p_userdata;
+	// Keep the buffers around, the next frame will most likely have the same size and format.
+	_push_free_frame(decoder->scaler_frames, decoder->scaler_frames_mutex, p_scaler_frame);
+}
 
-	sws_context = sws_getCachedContext(
-			sws_context,
-			width, height, (AVPixelFormat)p_frame->get_frame()->format,
-			width, height, p_target_pixel_format,
-			1, nullptr, nullptr, nullptr);
+static void _free_nothing(void *p_opaque, uint8_t *p_data) {}
 
-	Ref<FFmpegFrame> scaler_frame;
-	{
-		if (scaler_frames.size() > 0) {
-			scaler_frame = scaler_frames.front()->get();
-			scaler_frames.pop_front();
+int VideoDecoder::_get_conversion_slice_count(int p_width, int p_height) const {
+	int slice_count = conversion_slice_count.load();
+	if (slice_count <= 0) {
+		slice_count = MIN((p_width * p_height) / CONVERSION_PIXELS_PER_SLICE, OS::get_singleton()->get_processor_count());
+	}
+	return CLAMP(slice_count, 1, MAX(p_height, 1));
+}
+
+SwsContext *VideoDecoder::_get_scaler_context(int p_width, int p_height, AVPixelFormat p_src_format, AVPixelFormat p_dst_format) {
+	const int slice_count = _get_conversion_slice_count(p_width, p_height);
+	if (sws_context != nullptr && sws_context_width == p_width && sws_context_height == p_height && sws_context_src_format == p_src_format && sws_context_dst_format == p_dst_format && sws_context_slice_count == slice_count) {
+		return sws_context;
+	}
+	if (sws_context != nullptr) {
+		sws_freeContext(sws_context);
+	}
+	av_frame_free(&image_scale_frame);
+
+	// Built by hand rather than with sws_getCachedContext, which has no way of setting the thread count.
+	// swscale's threads each produce a band of output rows from the whole source, so the result is the same as with a single thread.
+	sws_context = sws_alloc_context();
+	ERR_FAIL_NULL_V_MSG(sws_context, nullptr, "Failed to allocate scaler context");
+	av_opt_set_int(sws_context, "srcw", p_width, 0);
+	av_opt_set_int(sws_context, "srch", p_height, 0);
+	av_opt_set_int(sws_context, "src_format", p_src_format, 0);
+	av_opt_set_int(sws_context, "dstw", p_width, 0);
+	av_opt_set_int(sws_context, "dsth", p_height, 0);
+	av_opt_set_int(sws_context, "dst_format", p_dst_format, 0);
+	av_opt_set_int(sws_context, "sws_flags", SWS_FAST_BILINEAR, 0);
+	av_opt_set_int(sws_context, "threads", slice_count, 0);
+	int init_result = sws_init_context(sws_context, nullptr, nullptr);
+	if (init_result < 0) {
+		print_line("Failed to initialize scaler:", ffmpeg_get_error_message(init_result));
+		sws_freeContext(sws_context);
+		sws_context = nullptr;
+		return nullptr;
+	}
+
+	sws_context_width = p_width;
+	sws_context_height = p_height;
+	sws_context_src_format = p_src_format;
+	sws_context_dst_format = p_dst_format;
+	sws_context_slice_count = slice_count;
+	return sws_context;
+}
+
+void VideoDecoder::_convert_yuv_slice(uint32_t p_slice) {
+	const int height = slice_src_frame->height;
+	const int row_start = (height * p_slice) / slice_total;
+	const int row_end = (height * (p_slice + 1)) / slice_total;
+	if (YUVCPUConverter::is_supported_high_bit_depth_format(slice_src_frame->format)) {
+		yuv_cpu_converter.convert_high_bit_depth(slice_src_frame, slice_dst, slice_dst_stride, row_start, row_end);
+	} else {
+		yuv_cpu_converter.convert(slice_src_frame, slice_dst, slice_dst_stride, row_start, row_end);
+	}
+}
+
+void VideoDecoder::_convert_yuv_to_rgba(const AVFrame *p_frame, uint8_t *r_dst, int p_dst_stride) {
+	const int slice_count = _get_conversion_slice_count(p_frame->width, p_frame->height);
+	if (slice_count <= 1) {
+		if (YUVCPUConverter::is_supported_high_bit_depth_format(p_frame->format)) {
+			yuv_cpu_converter.convert_high_bit_depth(p_frame, r_dst, p_dst_stride);
+		} else {
+			yuv_cpu_converter.convert(p_frame, r_dst, p_dst_stride);
 		}
+		return;
 	}
+	// Every row is converted on its own, so the output is identical regardless of how the frame is sliced.
+	slice_src_frame = p_frame;
+	slice_dst = r_dst;
+	slice_dst_stride = p_dst_stride;
+	slice_total = slice_count;
+	WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+	int64_t group_id = pool->add_group_task(callable_mp(this, &VideoDecoder::_convert_yuv_slice), slice_count, slice_count, true, "FFmpeg YUV to RGBA");
+	pool->wait_for_group_task_completion(group_id);
+	slice_src_frame = nullptr;
+	slice_dst = nullptr;
+}
+
+FFmpegFrame *VideoDecoder::_ensure_frame_pixel_format(AVFrame *p_frame, AVPixelFormat p_target_pixel_format) {
+	ZoneScopedN("Video decoder rescale");
+
+	int width = p_frame->width;
+	int height = p_frame->height;
 
-	if (!scaler_frame.is_valid()) {
-		scaler_frame.instantiate();
-		scaler_frame->connect("return_frame", callable_mp(this, &VideoDecoder::_scaler_frame_return));
+	SwsContext *scaler = _get_scaler_context(width, height, (AVPixelFormat)p_frame->format, p_target_pixel_format);
+	if (scaler == nullptr) {
+		return nullptr;
+	}
+
+	FFmpegFrame *scaler_frame = _pop_free_frame(scaler_frames, scaler_frames_mutex);
+	if (scaler_frame == nullptr) {
+		scaler_frame = memnew(FFmpegFrame);
+		scaler_frame->set_return_func(_scaler_frame_return, this);
 	}
 
 	// (re)initialize the scaler frame if needed.
@@ -563,155 +1023,499 @@ Ref<FFmpegFrame> VideoDecoder::_ensure_frame_pixel_format(Ref<FFmpegFrame> p_fra
 
 		if (get_buffer_result < 0) {
 			print_line("Failed to allocate SWS frame buffer:", ffmpeg_get_error_message(get_buffer_result));
-			p_frame->do_return();
-			return Ref<FFmpegFrame>();
+			av_frame_unref(scaler_frame->get_frame());
+			scaler_frame->do_return();
+			return nullptr;
 		}
 	}
 
-	int scaler_result = sws_scale(
-			sws_context,
-			p_frame->get_frame()->data, p_frame->get_frame()->linesize, 0, height,
-			scaler_frame->get_frame()->data, scaler_frame->get_frame()->linesize);
-
-	// return the original frame regardless of the scaler result.
-	p_frame->do_return();
+	int scaler_result = sws_scale_frame(scaler, scaler_frame->get_frame(), p_frame);
 
 	if (scaler_result < 0) {
 		print_line("Failed to scale frame:", ffmpeg_get_error_message(scaler_result));
-		return Ref<FFmpegFrame>();
+		scaler_frame->do_return();
+		return nullptr;
 	}
 
 	return scaler_frame;
 }
 
-Ref<DecodedFrame> VideoDecoder::_unwrap_yuv_frame(double p_frame_time, Ref<FFmpegFrame> p_frame, FFmpegFrameFormat p_out_format) {
-	PackedByteArray temp_frame_storage;
-	Ref<DecodedFrame> out_frame = memnew(DecodedFrame(p_frame_time, Ref<Image>()));
-	const int frame_plane_count = p_out_format == FFmpegFrameFormat::YUV420P ? 3 : 4;
-	for (size_t plane_i = 0; plane_i < frame_plane_count; plane_i++) {
-		ZoneNamedN(yuv_image_unwrap_copy, "YUV Image unwrap copy", true);
+bool VideoDecoder::_can_decode_into_image_buffer(AVCodecContext *p_codec_context, int p_format, int p_width, int p_height) {
+	if (p_format != AV_PIX_FMT_RGBA || !(p_codec_context->codec->capabilities & AV_CODEC_CAP_DR1)) {
+		return false;
+	}
+	int aligned_width = p_width;
+	int aligned_height = p_height;
+	int linesize_align[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2(p_codec_context, &aligned_width, &aligned_height, linesize_align);
+	// Image data has to be tightly packed, so only take over the allocation when the codec
+	// doesn't need padding rows or columns and is fine with a tight stride.
+	return aligned_width == p_width && aligned_height == p_height && (p_width * 4) % linesize_align[0] == 0;
+}
 
-		int width = p_frame->get_frame()->width;
-		int height = p_frame->get_frame()->height;
+int VideoDecoder::_get_video_buffer(AVCodecContext *p_codec_context, AVFrame *p_frame, int p_flags) {
+	if (!_can_decode_into_image_buffer(p_codec_context, p_frame->format, p_frame->width, p_frame->height)) {
+		return avcodec_default_get_buffer2(p_codec_context, p_frame, p_flags);
+	}
 
-		if (plane_i > 0 && plane_i < 3) {
-			width = Math::ceil(width / 2.0f);
-			height = Math::ceil(height / 2.0f);
-		}
+	// The codec decodes straight into Godot owned memory that later becomes the Image's data.
+	VideoDecoder *decoder = (VideoDecoder *)p_codec_context->opaque;
+	VideoBuffer *video_buffer = memnew(VideoBuffer);
+	video_buffer->decoder = decoder;
+	video_buffer->data = decoder->frame_buffer_pool.acquire(p_frame->width * p_frame->height * 4);
+	if (video_buffer->data.is_empty()) {
+		memdelete(video_buffer);
+		return AVERROR(ENOMEM);
+	}
+	// Read only, so codecs that keep reference frames copy them instead of writing into data a presented Image still holds.
+	p_frame->buf[0] = av_buffer_create(video_buffer->data.ptrw(), video_buffer->data.size(), _free_video_buffer, video_buffer, AV_BUFFER_FLAG_READONLY);
+	if (p_frame->buf[0] == nullptr) {
+		memdelete(video_buffer);
+		return AVERROR(ENOMEM);
+	}
+	decoder->video_buffers_mutex->lock();
+	decoder->video_buffers.insert(video_buffer);
+	decoder->video_buffers_mutex->unlock();
+	p_frame->data[0] = p_frame->buf[0]->data;
+	p_frame->linesize[0] = p_frame->width * 4;
+	p_frame->extended_data = p_frame->data;
+	return 0;
+}
+
+void VideoDecoder::_free_video_buffer(void *p_opaque, uint8_t *p_data) {
+	VideoBuffer *video_buffer = (VideoBuffer *)p_opaque;
+	VideoDecoder *decoder = video_buffer->decoder;
+	decoder->video_buffers_mutex->lock();
+	decoder->video_buffers.erase(video_buffer);
+	decoder->video_buffers_mutex->unlock();
+	memdelete(video_buffer);
+}
 
-		const int plane_size = p_frame->get_frame()->linesize[plane_i] * height;
-		temp_frame_storage.resize(plane_size);
-		uint8_t *unwrapped_frame_ptrw = temp_frame_storage.ptrw();
+bool VideoDecoder::_get_own_video_buffer_data(const AVFrame *p_frame, PackedByteArray &r_data) {
+	if (p_frame->buf[0] == nullptr || p_frame->format != AV_PIX_FMT_RGBA) {
+		return false;
+	}
+	// Only looked up, the opaque of a buffer FFmpeg allocated is never dereferenced.
+	VideoBuffer *video_buffer = (VideoBuffer *)av_buffer_get_opaque(p_frame->buf[0]);
+	video_buffers_mutex->lock();
+	const bool own = video_buffers.has(video_buffer);
+	video_buffers_mutex->unlock();
+	if (!own) {
+		return false;
+	}
+	// A cropped frame or one smaller than its allocation doesn't map onto a tightly packed Image.
+	const int64_t image_size = (int64_t)p_frame->width * p_frame->height * 4;
+	if (p_frame->data[0] != video_buffer->data.ptr() || p_frame->linesize[0] != p_frame->width * 4 || video_buffer->data.size() != image_size) {
+		return false;
+	}
+	r_data = video_buffer->data;
+	return true;
+}
+
+Ref<Image> VideoDecoder::_frame_to_rgba_image(AVFrame *p_frame) {
+	ZoneScopedN("Image unwrap");
+	const int width = p_frame->width;
+	const int height = p_frame->height;
+	PackedByteArray image_data;
+
+	if (_get_own_video_buffer_data(p_frame, image_data)) {
+		// Decoded by _get_video_buffer, the Image shares the buffer with the frame, no copy needed.
+	} else if (frame_format == FFmpegFrameFormat::RGBAH && YUVCPUConverter::is_supported_high_bit_depth_format(p_frame->format)) {
+		ZoneNamedN(image_unwrap_yuv_high_bit_depth, "Image unwrap YUV high bit depth", true);
+		image_data = frame_buffer_pool.acquire(width * height * 8);
+		_convert_yuv_to_rgba(p_frame, image_data.ptrw(), width * 8);
+		return Image::create_from_data(width, height, false, Image::FORMAT_RGBAH, image_data);
+	} else if (YUVCPUConverter::is_supported_format(p_frame->format)) {
+		// Common YUV layouts go through our own SIMD converter instead of swscale's generic path.
+		ZoneNamedN(image_unwrap_yuv, "Image unwrap YUV", true);
+		image_data = frame_buffer_pool.acquire(width * height * 4);
+		_convert_yuv_to_rgba(p_frame, image_data.ptrw(), width * 4);
+	} else if (p_frame->format != AV_PIX_FMT_RGBA && (width * 4) % SWS_STRIDE_ALIGNMENT == 0) {
+		// Scale straight into the Image's data using a tight stride.
+		SwsContext *scaler = _get_scaler_context(width, height, (AVPixelFormat)p_frame->format, AV_PIX_FMT_RGBA);
+		if (scaler == nullptr) {
+			return Ref<Image>();
+		}
+		image_data = frame_buffer_pool.acquire(width * height * 4);
+		// sws_scale_frame wants reference counted frames, the buffer doesn't own the Image data so freeing it is a no-op.
+		image_scale_frame->format = AV_PIX_FMT_RGBA;
+		image_scale_frame->width = width;
+		image_scale_frame->height = height;
+		image_scale_frame->data[0] = image_data.ptrw();
+		image_scale_frame->linesize[0] = width * 4;
+		image_scale_frame->buf[0] = av_buffer_create(image_scale_frame->data[0], image_data.size(), _free_nothing, nullptr, 0);
+		ERR_FAIL_NULL_V(image_scale_frame->buf[0], Ref<Image>());
+		int scaler_result;
 		{
-			ZoneNamedN(yuv_image_unwrap_memcopy, "YUV memcpy", true);
-			for (int y = 0; y < height; y++) {
-				memcpy(unwrapped_frame_ptrw, p_frame->get_frame()->data[plane_i] + y * p_frame->get_frame()->linesize[plane_i], width);
-				unwrapped_frame_ptrw += width;
+			ZoneNamedN(image_unwrap_scale, "Image unwrap scale", true);
+			scaler_result = sws_scale_frame(scaler, image_scale_frame, p_frame);
+		}
+		av_frame_unref(image_scale_frame);
+		if (scaler_result < 0) {
+			print_line("Failed to scale frame:", ffmpeg_get_error_message(scaler_result));
+			return Ref<Image>();
+		}
+	} else {
+		// Padded rows on either side, go through a scaler frame if needed and copy row by row.
+		const AVFrame *rgba_frame = p_frame;
+		FFmpegFrame *scaler_frame = nullptr;
+		if (p_frame->format != AV_PIX_FMT_RGBA) {
+			// Note: this is the pixel format that the video texture expects internally
+			scaler_frame = _ensure_frame_pixel_format(p_frame, AVPixelFormat::AV_PIX_FMT_RGBA);
+			if (scaler_frame == nullptr) {
+				return Ref<Image>();
 			}
+			rgba_frame = scaler_frame->get_frame();
+		}
+		ZoneNamedN(image_unwrap_memcopy, "memcpy", true);
+		image_data = frame_buffer_pool.acquire(width * height * 4);
+		uint8_t *image_data_ptrw = image_data.ptrw();
+		for (int y = 0; y < height; y++) {
+			memcpy(image_data_ptrw, rgba_frame->data[0] + y * rgba_frame->linesize[0], width * 4);
+			image_data_ptrw += width * 4;
+		}
+		if (scaler_frame != nullptr) {
+			scaler_frame->do_return();
 		}
-		temp_frame_storage.resize(width * height);
-		out_frame->set_yuv_image_plane(plane_i, Image::create_from_data(width, height, false, Image::FORMAT_R8, temp_frame_storage));
 	}
 
-	out_frame->set_format(p_out_format);
-
-	return out_frame;
+	return Image::create_from_data(width, height, false, Image::FORMAT_RGBA8, image_data);
 }
 
-AVFrame *VideoDecoder::_ensure_frame_audio_format(AVFrame *p_frame, AVSampleFormat p_target_audio_format) {
-	ZoneScopedN("Audio decoder rescale");
-	if (p_frame->format == p_target_audio_format) {
-		return p_frame;
+Ref<DecodedFrame> VideoDecoder::_acquire_decoded_frame(double p_time, FFmpegFrameFormat p_format) {
+	Ref<DecodedFrame> frame;
+	decoded_frame_pool_mutex->lock();
+	if (decoded_frame_pool.size() > 0) {
+		frame = decoded_frame_pool[decoded_frame_pool.size() - 1];
+		decoded_frame_pool.remove_at(decoded_frame_pool.size() - 1);
 	}
+	decoded_frame_pool_mutex->unlock();
 
-	int obtain_swr_ctx_result = swr_alloc_set_opts2(
-			&swr_context,
-			&audio_codec_context->ch_layout, p_target_audio_format, audio_codec_context->sample_rate,
-			&audio_codec_context->ch_layout, audio_codec_context->sample_fmt, audio_codec_context->sample_rate,
-			0, nullptr);
+	// The frame was returned while something else still holds on to it, leave it to them.
+	if (!frame.is_valid() || frame->get_reference_count() > 1) {
+		frame = Ref<DecodedFrame>(memnew(DecodedFrame(p_time, Ref<Image>())));
+	}
+	frame->set_time(p_time);
+	frame->set_format(p_format);
+	return frame;
+}
 
-	if (obtain_swr_ctx_result < 0) {
-		print_line("Failed to obtain SWR context");
-		return nullptr;
+Ref<DecodedFrame> VideoDecoder::_unwrap_yuv_frame(double p_frame_time, AVFrame *p_frame, FFmpegFrameFormat p_out_format) {
+	const FFmpegFrameFormatInfo &format_info = ffmpeg_get_frame_format_info(p_out_format);
+
+	// Decoders may switch pixel formats mid-stream, bring such frames back to the format the converter expects.
+	const AVFrame *src_frame = p_frame;
+	FFmpegFrame *scaler_frame = nullptr;
+	if (p_frame->format != format_info.pixel_format) {
+		scaler_frame = _ensure_frame_pixel_format(p_frame, format_info.pixel_format);
+		ERR_FAIL_NULL_V(scaler_frame, Ref<DecodedFrame>());
+		src_frame = scaler_frame->get_frame();
 	}
-	AVFrame *out_frame;
 
-	out_frame = av_frame_alloc();
-	out_frame->format = p_target_audio_format;
-	out_frame->ch_layout = audio_codec_context->ch_layout;
-	out_frame->sample_rate = audio_codec_context->sample_rate;
-	out_frame->nb_samples = p_frame->nb_samples;
+	Ref<DecodedFrame> out_frame = _acquire_decoded_frame(p_frame_time, p_out_format);
+	const int frame_plane_count = format_info.plane_count;
+
+	// In bytes, high bit depth formats take two per sample.
+	int plane_widths[4];
+	int plane_heights[4];
+	int plane_offsets[4];
+	int total_size = 0;
+	for (int plane_i = 0; plane_i < frame_plane_count; plane_i++) {
+		plane_widths[plane_i] = format_info.get_plane_row_size(plane_i, src_frame->width);
+		plane_heights[plane_i] = format_info.get_plane_height(plane_i, src_frame->height);
+		plane_offsets[plane_i] = total_size;
+		total_size += plane_widths[plane_i] * plane_heights[plane_i];
+	}
 
-	int get_buffer_result = av_frame_get_buffer(out_frame, 0);
+	// The GPU converter reads the buffer as 32-bit words, keep the size a multiple of 4.
+	PackedByteArray yuv_data = frame_buffer_pool.acquire((total_size + 3) & ~3);
+	uint8_t *yuv_data_ptrw = yuv_data.ptrw();
+	for (int plane_i = 0; plane_i < frame_plane_count; plane_i++) {
+		ZoneNamedN(yuv_image_unwrap_copy, "YUV Image unwrap copy", true);
+		const int width = plane_widths[plane_i];
+		const int height = plane_heights[plane_i];
+		uint8_t *plane_ptrw = yuv_data_ptrw + plane_offsets[plane_i];
+		if (src_frame->linesize[plane_i] == width) {
+			memcpy(plane_ptrw, src_frame->data[plane_i], width * height);
+			continue;
+		}
+		for (int y = 0; y < height; y++) {
+			memcpy(plane_ptrw, src_frame->data[plane_i] + y * src_frame->linesize[plane_i], width);
+			plane_ptrw += width;
+		}
+	}
+	out_frame->set_yuv_data(yuv_data, plane_offsets, frame_plane_count);
 
-	if (get_buffer_result < 0) {
-		print_line("Failed to allocate SWR frame buffer:", ffmpeg_get_error_message(get_buffer_result));
-		av_frame_unref(out_frame);
-		return nullptr;
+	if (scaler_frame != nullptr) {
+		scaler_frame->do_return();
 	}
+	return out_frame;
+}
 
-	int converter_result = swr_convert_frame(swr_context, out_frame, p_frame);
+SwrContext *VideoDecoder::_get_resampler_context(const AVFrame *p_frame) {
+	if (swr_context != nullptr && swr_context_src_format == p_frame->format && swr_context_src_sample_rate == p_frame->sample_rate && av_channel_layout_compare(&swr_context_src_ch_layout, &p_frame->ch_layout) == 0) {
+		return swr_context;
+	}
+	swr_free(&swr_context);
+	av_channel_layout_uninit(&swr_context_src_ch_layout);
 
-	if (converter_result < 0) {
-		print_line("Failed to convert audio frame:", ffmpeg_get_error_message(converter_result));
-		av_frame_unref(out_frame);
+	// Some decoders only report the channel count, assume the usual layout for it.
+	AVChannelLayout src_ch_layout = {};
+	if (p_frame->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC) {
+		av_channel_layout_default(&src_ch_layout, p_frame->ch_layout.nb_channels);
+	} else {
+		av_channel_layout_copy(&src_ch_layout, &p_frame->ch_layout);
+	}
+	int result = swr_alloc_set_opts2(
+			&swr_context,
+			&audio_output_ch_layout, AV_SAMPLE_FMT_FLT, audio_output_sample_rate,
+			&src_ch_layout, (AVSampleFormat)p_frame->format, p_frame->sample_rate,
+			0, nullptr);
+	av_channel_layout_uninit(&src_ch_layout);
+	if (result >= 0) {
+		result = swr_init(swr_context);
+	}
+	if (result < 0) {
+		print_line("Failed to initialize resampler:", ffmpeg_get_error_message(result));
+		swr_free(&swr_context);
 		return nullptr;
 	}
 
-	return out_frame;
+	swr_context_src_format = (AVSampleFormat)p_frame->format;
+	swr_context_src_sample_rate = p_frame->sample_rate;
+	av_channel_layout_copy(&swr_context_src_ch_layout, &p_frame->ch_layout);
+	return swr_context;
 }
 
-String VideoDecoder::_codec_id_to_preferred_decoder_name(AVCodecID p_codec_id) const {
-	switch (p_codec_id) {
-		case AVCodecID::AV_CODEC_ID_VP8: {
-			return "libvpx";
+VideoDecoder::HardwareVideoDecoder VideoDecoder::from_av_hw_device_type(AVHWDeviceType p_device_type) {
+	switch (p_device_type) {
+		case AV_HWDEVICE_TYPE_CUDA: {
+			return HardwareVideoDecoder::NVDEC;
 		} break;
-		case AVCodecID::AV_CODEC_ID_VP9: {
-			return "libvpx-vp9";
+		case AV_HWDEVICE_TYPE_QSV: {
+			return HardwareVideoDecoder::INTEL_QUICK_SYNC;
 		} break;
-		case AVCodecID::AV_CODEC_ID_HEVC: {
-			return "hevc";
+		case AV_HWDEVICE_TYPE_DXVA2:
+		case AV_HWDEVICE_TYPE_D3D11VA: {
+			return HardwareVideoDecoder::DXVA2;
 		} break;
-		case AVCodecID::AV_CODEC_ID_AV1: {
-			return "libaom-av1";
+		case AV_HWDEVICE_TYPE_VDPAU: {
+			return HardwareVideoDecoder::VDPAU;
+		} break;
+		case AV_HWDEVICE_TYPE_VAAPI: {
+			return HardwareVideoDecoder::VAAPI;
+		} break;
+		case AV_HWDEVICE_TYPE_MEDIACODEC: {
+			return HardwareVideoDecoder::ANDROID_MEDIACODEC;
+		} break;
+		case AV_HWDEVICE_TYPE_VIDEOTOOLBOX: {
+			return HardwareVideoDecoder::APPLE_VIDEOTOOLBOX;
 		} break;
 		default: {
 		} break;
 	}
-	return String();
+	return HardwareVideoDecoder::NONE;
 }
 
-void VideoDecoder::seek(double p_time, bool p_wait) {
-	decoded_frames_mutex->lock();
-	audio_buffer_mutex->lock();
+Vector<VideoDecoder::AvailableDecoderInfo> VideoDecoder::get_available_video_decoders(const AVInputFormat *p_format, AVCodecID p_codec_id, BitField<HardwareVideoDecoder> p_target_decoders) {
+	Vector<AvailableDecoderInfo> available_decoders;
+	const int width = video_stream != nullptr ? video_stream->codecpar->width : 0;
+	const int height = video_stream != nullptr ? video_stream->codecpar->height : 0;
+	// Ranked by the registry, each decoder is listed once per usable hardware device type and then once for software decoding.
+	for (const Ref<FFmpegCodec> &codec : FFmpegDecoderRegistry::get_singleton()->get_ranked_decoders(p_codec_id, width, height, video_has_alpha)) {
+		for (const AVHWDeviceType device_type : codec->get_supported_hw_device_types()) {
+			const HardwareVideoDecoder hw_decoder = from_av_hw_device_type(device_type);
+			if (hw_decoder != HardwareVideoDecoder::NONE && p_target_decoders.has_flag(hw_decoder)) {
+				available_decoders.push_back({ codec, device_type });
+			}
+		}
+		available_decoders.push_back({ codec, AV_HWDEVICE_TYPE_NONE });
+	}
+	return available_decoders;
+}
 
-	decoded_frames.clear();
-	decoded_audio_frames.clear();
+void VideoDecoder::seek(double p_time, bool p_wait) {
+	// Flushing from the consumer side drops everything that is queued and starts a new epoch,
+	// whatever the decode workers output before they get to the flush entry of the seek is discarded.
+	const uint32_t video_epoch = decoded_frames.flush();
+	const uint32_t audio_epoch = decoded_audio.flush();
+	frames_popped_since_seek = 0;
+	frame_queue_starved = false;
 
 	last_decoded_frame_time.set(p_time);
-	skip_current_outputs.set();
-	decoded_frames_mutex->unlock();
-	audio_buffer_mutex->unlock();
-	if (p_wait) {
-		decoder_commands.push_and_sync(this, &VideoDecoder::_seek_command, p_time);
-	} else {
-		decoder_commands.push(this, &VideoDecoder::_seek_command, p_time);
+	// Workers blocked on a full output ring need to notice the new epoch.
+	video_output_wakeup->post();
+	audio_output_wakeup->post();
+	// The demuxer thread might be asleep, so instead of letting the command queue block on it
+	// we push the command, wake the thread up and only then wait for the seek to happen.
+	const bool wait_for_seek = p_wait && demux_thread != nullptr;
+	decoder_commands.push(this, &VideoDecoder::_seek_command, p_time, video_epoch, audio_epoch, wait_for_seek);
+	demux_wakeup->post();
+	if (wait_for_seek) {
+		seek_done->wait();
+	}
+}
+
+void VideoDecoder::open() {
+	ERR_FAIL_COND_MSG(format_context != nullptr, "The file has already been opened.");
+	const uint64_t open_start_usec = OS::get_singleton()->get_ticks_usec();
+	prepare_decoding();
+	Error codec_context_create_error = recreate_codec_context();
+	open_latency_usec = OS::get_singleton()->get_ticks_usec() - open_start_usec;
+
+	if (video_stream == nullptr || codec_context_create_error != OK) {
+		_set_decoder_state(DecoderState::FAULTED);
 	}
 }
 
 void VideoDecoder::start_decoding() {
-	ERR_FAIL_COND_MSG(thread != nullptr, "Cannot start decoding once already started");
+	ERR_FAIL_COND_MSG(demux_thread != nullptr, "Cannot start decoding once already started");
 	if (format_context == nullptr) {
-		prepare_decoding();
-		Error codec_context_create_error = recreate_codec_context();
+		open();
+	}
+	if (decoder_state.load() == DecoderState::FAULTED) {
+		return;
+	}
+
+	_start_keyframe_index();
 
-		if (video_stream == nullptr || codec_context_create_error != OK) {
-			decoder_state = DecoderState::FAULTED;
-			return;
+	video_packets.set_time_base(video_stream->time_base);
+	if (has_audio) {
+		audio_packets.set_time_base(audio_stream->time_base);
+		audio_decode_thread = memnew(std::thread(_audio_decode_thread_func, this));
+	}
+	video_decode_thread = memnew(std::thread(_video_decode_thread_func, this));
+	demux_thread = memnew(std::thread(_demux_thread_func, this));
+}
+
+bool VideoDecoder::is_decoding_started() const {
+	return demux_thread != nullptr;
+}
+
+bool VideoDecoder::_decode_attached_picture(AVFrame *r_frame) {
+	AVStream *cover_stream = nullptr;
+	for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+		AVStream *stream = format_context->streams[i];
+		if ((stream->disposition & AV_DISPOSITION_ATTACHED_PIC) && stream->attached_pic.size > 0) {
+			cover_stream = stream;
+			break;
 		}
 	}
+	if (cover_stream == nullptr) {
+		return false;
+	}
 
-	thread = memnew(std::thread(_thread_func, this));
+	const AVCodec *codec = avcodec_find_decoder(cover_stream->codecpar->codec_id);
+	if (codec == nullptr) {
+		return false;
+	}
+	AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+	ERR_FAIL_NULL_V(codec_context, false);
+	bool got_frame = false;
+	if (avcodec_parameters_to_context(codec_context, cover_stream->codecpar) >= 0 && avcodec_open2(codec_context, codec, nullptr) >= 0) {
+		// Cover art is a single packet, send it and drain the codec right away.
+		avcodec_send_packet(codec_context, &cover_stream->attached_pic);
+		avcodec_send_packet(codec_context, nullptr);
+		got_frame = avcodec_receive_frame(codec_context, r_frame) >= 0;
+	}
+	avcodec_free_context(&codec_context);
+	return got_frame;
+}
+
+bool VideoDecoder::_decode_first_video_frame(AVFrame *r_frame) {
+	AVPacket *packet = av_packet_alloc();
+	bool got_frame = false;
+	bool draining = false;
+	while (!got_frame) {
+		if (!draining) {
+			const int read_result = av_read_frame(format_context, packet);
+			if (read_result < 0) {
+				// Frame threaded codecs hold on to a few packets before outputting anything.
+				avcodec_send_packet(video_codec_context, nullptr);
+				draining = true;
+			} else {
+				const bool is_video_packet = packet->stream_index == video_stream->index;
+				if (is_video_packet) {
+					avcodec_send_packet(video_codec_context, packet);
+				}
+				av_packet_unref(packet);
+				if (!is_video_packet) {
+					continue;
+				}
+			}
+		}
+		const int receive_result = avcodec_receive_frame(video_codec_context, r_frame);
+		got_frame = receive_result >= 0;
+		if (!got_frame && (draining || receive_result != -EAGAIN)) {
+			break;
+		}
+	}
+	av_packet_free(&packet);
+
+	// Rewind so the demuxer thread starts from the beginning once decoding starts.
+	avcodec_flush_buffers(video_codec_context);
+	const int64_t start_time = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+	av_seek_frame(format_context, video_stream->index, start_time, AVSEEK_FLAG_BACKWARD);
+	return got_frame;
+}
+
+Ref<DecodedFrame> VideoDecoder::_poster_frame_from_av_frame(const AVFrame *p_frame) {
+	// Cover art rarely matches the video, bring it to the size and format the output is set up for.
+	const int width = video_codec_context->width > 0 ? video_codec_context->width : p_frame->width;
+	const int height = video_codec_context->height > 0 ? video_codec_context->height : p_frame->height;
+	const FFmpegFrameFormatInfo &format_info = ffmpeg_get_frame_format_info(frame_format);
+	const AVPixelFormat dst_format = format_info.is_yuv ? format_info.pixel_format : AV_PIX_FMT_RGBA;
+
+	SwsContext *scaler = sws_getContext(p_frame->width, p_frame->height, (AVPixelFormat)p_frame->format, width, height, dst_format, SWS_BILINEAR, nullptr, nullptr, nullptr);
+	ERR_FAIL_NULL_V_MSG(scaler, Ref<DecodedFrame>(), "Failed to create the poster frame scaler.");
+	AVFrame *scaled_frame = av_frame_alloc();
+	scaled_frame->format = dst_format;
+	scaled_frame->width = width;
+	scaled_frame->height = height;
+	int scale_result = av_frame_get_buffer(scaled_frame, 0);
+	if (scale_result >= 0) {
+		scale_result = sws_scale_frame(scaler, scaled_frame, p_frame);
+	}
+	sws_freeContext(scaler);
+
+	Ref<DecodedFrame> poster_frame;
+	if (scale_result < 0) {
+		print_line("Failed to scale the poster frame:", ffmpeg_get_error_message(scale_result));
+	} else if (format_info.is_yuv) {
+		poster_frame = _unwrap_yuv_frame(0.0, scaled_frame, frame_format);
+	} else {
+		PackedByteArray image_data;
+		image_data.resize(width * height * 4);
+		uint8_t *image_data_ptrw = image_data.ptrw();
+		for (int y = 0; y < height; y++) {
+			memcpy(image_data_ptrw + y * width * 4, scaled_frame->data[0] + y * scaled_frame->linesize[0], width * 4);
+		}
+		Ref<Image> image = Image::create_from_data(width, height, false, Image::FORMAT_RGBA8, image_data);
+		if (frame_format == FFmpegFrameFormat::RGBAH) {
+			image->convert(Image::FORMAT_RGBAH);
+		}
+		poster_frame = _acquire_decoded_frame(0.0, frame_format);
+		poster_frame->set_image(image);
+	}
+	av_frame_free(&scaled_frame);
+	return poster_frame;
+}
+
+Ref<DecodedFrame> VideoDecoder::decode_poster_frame() {
+	ERR_FAIL_COND_V_MSG(demux_thread != nullptr, Ref<DecodedFrame>(), "The poster frame has to be decoded before decoding starts.");
+	ERR_FAIL_COND_V(video_stream == nullptr || video_codec_context == nullptr, Ref<DecodedFrame>());
+
+	AVFrame *frame = av_frame_alloc();
+	cached_poster_frame.unref();
+	if (_decode_attached_picture(frame) || _decode_first_video_frame(frame)) {
+		cached_poster_frame = _poster_frame_from_av_frame(frame);
+	}
+	av_frame_free(&frame);
+	return cached_poster_frame;
+}
+
+Ref<DecodedFrame> VideoDecoder::get_poster_frame() const {
+	return cached_poster_frame;
 }
 
 void VideoDecoder::return_frames(Vector<Ref<DecodedFrame>> p_frames) {
@@ -721,30 +1525,73 @@ void VideoDecoder::return_frames(Vector<Ref<DecodedFrame>> p_frames) {
 }
 
 void VideoDecoder::return_frame(Ref<DecodedFrame> p_frame) {
-	available_textures_mutex->lock();
-	available_textures.push_back(p_frame->get_texture());
-	available_textures_mutex->unlock();
+	if (p_frame->get_texture().is_valid()) {
+		available_textures_mutex->lock();
+		available_textures.push_back(p_frame->get_texture());
+		available_textures_mutex->unlock();
+	}
+	if (p_frame->get_image().is_valid()) {
+		frame_buffer_pool.release(p_frame->get_image()->get_data());
+	}
+	if (p_frame->get_yuv_plane_count() > 0) {
+		frame_buffer_pool.release(p_frame->get_yuv_data());
+	}
+
+	// Drop our references to the data so the pooled buffers become exclusively owned again.
+	p_frame->clear();
+	decoded_frame_pool_mutex->lock();
+	if (decoded_frame_pool.size() < (uint32_t)DECODED_FRAMES_CAPACITY) {
+		decoded_frame_pool.push_back(p_frame);
+	}
+	decoded_frame_pool_mutex->unlock();
 }
 
-Vector<Ref<DecodedFrame>> VideoDecoder::get_decoded_frames() {
-	Vector<Ref<DecodedFrame>> frames;
-	decoded_frames_mutex->lock();
-	frames = decoded_frames.duplicate();
-	decoded_frames.clear();
-	decoded_frames_mutex->unlock();
-	return frames;
+void VideoDecoder::trim_frame_buffer_pool() {
+	frame_buffer_pool.trim();
 }
 
-Vector<Ref<DecodedAudioFrame>> VideoDecoder::get_decoded_audio_frames() {
-	audio_buffer_mutex->lock();
-	Vector<Ref<DecodedAudioFrame>> frames = decoded_audio_frames.duplicate();
-	decoded_audio_frames.clear();
-	audio_buffer_mutex->unlock();
-	return frames;
+Ref<DecodedFrame> VideoDecoder::peek_decoded_frame() {
+	if (demux_waiting_for_input.is_set()) {
+		demux_waiting_for_input.clear();
+		demux_wakeup->post();
+	}
+	Ref<DecodedFrame> *frame = decoded_frames.peek();
+	if (frame == nullptr) {
+		_on_frame_queue_starved();
+		return Ref<DecodedFrame>();
+	}
+	return *frame;
+}
+
+Ref<DecodedFrame> VideoDecoder::pop_decoded_frame() {
+	Ref<DecodedFrame> frame;
+	if (decoded_frames.pop(frame)) {
+		_on_frame_popped();
+		// A slot was freed, let the video worker know it can continue.
+		video_output_wakeup->post();
+	}
+	return frame;
+}
+
+bool VideoDecoder::peek_decoded_audio(double &r_time, uint32_t &r_frame_count, uint32_t &r_sample_offset) {
+	return decoded_audio.peek(r_time, r_frame_count, r_sample_offset);
+}
+
+void VideoDecoder::pop_decoded_audio() {
+	decoded_audio.pop();
+	audio_output_wakeup->post();
+}
+
+const PackedFloat32Array &VideoDecoder::get_decoded_audio_samples() const {
+	return decoded_audio.get_samples();
 }
 
 VideoDecoder::DecoderState VideoDecoder::get_decoder_state() const {
-	return decoder_state;
+	return decoder_state.load();
+}
+
+bool VideoDecoder::is_seek_pending() const {
+	return completed_seek_epoch.load() != decoded_frames.get_epoch();
 }
 
 double VideoDecoder::get_last_decoded_frame_time() const {
@@ -759,6 +1606,154 @@ double VideoDecoder::get_duration() const {
 	return duration;
 }
 
+int64_t VideoDecoder::get_frame_count() const {
+	const KeyframeIndex *index = _get_keyframe_index();
+	if (index != nullptr) {
+		return index->get_frame_count();
+	}
+	if (video_stream != nullptr && video_stream->nb_frames > 0) {
+		return video_stream->nb_frames;
+	}
+	return (int64_t)Math::round(duration / frame_duration);
+}
+
+double VideoDecoder::get_frame_time(int64_t p_frame) const {
+	const KeyframeIndex *index = _get_keyframe_index();
+	const KeyframeIndex::Entry *keyframe = index != nullptr ? index->find_keyframe_for_frame(p_frame) : nullptr;
+	if (keyframe == nullptr) {
+		return p_frame * frame_duration;
+	}
+	// Frames past the keyframe are assumed to be evenly spaced.
+	const int64_t start_time = video_stream->start_time != AV_NOPTS_VALUE ? video_stream->start_time : 0;
+	return (keyframe->pts - start_time) * video_time_base_in_seconds * 1000.0 + (p_frame - keyframe->frame_number) * frame_duration;
+}
+
+void VideoDecoder::set_keyframe_index_enabled(bool p_enabled) {
+	keyframe_index_enabled = p_enabled;
+}
+
+uint64_t VideoDecoder::get_open_latency_usec() const {
+	return open_latency_usec;
+}
+
+bool VideoDecoder::is_keyframe_index_ready() const {
+	return _get_keyframe_index() != nullptr;
+}
+
+void VideoDecoder::set_frame_queue_memory_budget(int64_t p_bytes) {
+	frame_queue_memory_budget.store(MAX(p_bytes, (int64_t)0));
+	frame_queue_limits_dirty.set();
+}
+
+int64_t VideoDecoder::get_frame_queue_memory_budget() const {
+	return frame_queue_memory_budget.load();
+}
+
+void VideoDecoder::set_frame_queue_target_duration(double p_msec) {
+	frame_queue_target_duration.store(MAX(p_msec, 0.0));
+	frame_queue_limits_dirty.set();
+}
+
+double VideoDecoder::get_frame_queue_target_duration() const {
+	return frame_queue_target_duration.load();
+}
+
+void VideoDecoder::set_conversion_slice_count(int p_slice_count) {
+	conversion_slice_count.store(MAX(p_slice_count, 0));
+}
+
+int VideoDecoder::get_conversion_slice_count() const {
+	return conversion_slice_count.load();
+}
+
+int VideoDecoder::get_frame_queue_depth() const {
+	return frame_queue_depth.load();
+}
+
+int VideoDecoder::get_frame_queue_max_depth() const {
+	return frame_queue_max_depth.load();
+}
+
+uint64_t VideoDecoder::get_frame_queue_stall_count() const {
+	return frame_queue_stall_count.load();
+}
+
+void VideoDecoder::set_io_buffer_size(int p_bytes) {
+	ERR_FAIL_COND_MSG(io_context != nullptr, "The I/O buffer size can't be changed once the file is open.");
+	io_buffer_size = MAX(p_bytes, 4096);
+}
+
+int VideoDecoder::get_io_buffer_size() const {
+	return io_buffer_size;
+}
+
+void VideoDecoder::set_read_ahead_size(int64_t p_bytes) {
+	ERR_FAIL_COND_MSG(input_source != nullptr, "The read ahead size can't be changed once the file is open.");
+	read_ahead_size = MAX(p_bytes, (int64_t)0);
+}
+
+int64_t VideoDecoder::get_read_ahead_size() const {
+	return read_ahead_size;
+}
+
+void VideoDecoder::set_memory_map_enabled(bool p_enabled) {
+	ERR_FAIL_COND_MSG(input_source != nullptr, "Memory mapping can't be toggled once the file is open.");
+	memory_map_enabled = p_enabled;
+}
+
+bool VideoDecoder::is_memory_map_enabled() const {
+	return memory_map_enabled;
+}
+
+void VideoDecoder::set_audio_buffer_duration(double p_msec) {
+	ERR_FAIL_COND_MSG(audio_codec_context != nullptr, "The audio buffer duration can't be changed once the file is open.");
+	audio_buffer_duration = MAX(p_msec, 20.0);
+}
+
+double VideoDecoder::get_audio_buffer_duration() const {
+	return audio_buffer_duration;
+}
+
+void VideoDecoder::set_audio_output_mix_rate(int p_mix_rate) {
+	ERR_FAIL_COND_MSG(audio_codec_context != nullptr, "The audio output mix rate can't be changed once the file is open.");
+	audio_output_mix_rate = MAX(p_mix_rate, 0);
+}
+
+int VideoDecoder::get_audio_output_mix_rate() const {
+	return audio_output_mix_rate;
+}
+
+void VideoDecoder::set_audio_output_channel_count(int p_channel_count) {
+	ERR_FAIL_COND_MSG(audio_codec_context != nullptr, "The audio output channel count can't be changed once the file is open.");
+	ERR_FAIL_COND_MSG(p_channel_count < 0 || p_channel_count > 8 || (p_channel_count > 2 && p_channel_count % 2 != 0), vformat("Godot can't mix %d audio channels.", p_channel_count));
+	audio_output_channel_count = p_channel_count;
+}
+
+int VideoDecoder::get_audio_output_channel_count() const {
+	return audio_output_channel_count;
+}
+
+bool VideoDecoder::is_input_memory_mapped() const {
+	return input_memory_mapped;
+}
+
+int64_t VideoDecoder::get_input_bytes_read() const {
+	return input_source != nullptr ? input_source->get_bytes_read() : 0;
+}
+
+int64_t VideoDecoder::get_input_stall_count() const {
+	return input_source != nullptr ? input_source->get_stall_count() : 0;
+}
+
+double VideoDecoder::get_input_hit_rate() const {
+	if (input_source == nullptr) {
+		return 0.0;
+	}
+	const int64_t hits = input_source->get_hit_count();
+	const int64_t reads = hits + input_source->get_stall_count();
+	return reads > 0 ? hits / (double)reads : 0.0;
+}
+
 Vector2i VideoDecoder::get_size() const {
 	if (video_codec_context) {
 		return Vector2i(video_codec_context->width, video_codec_context->height);
@@ -767,33 +1762,80 @@ Vector2i VideoDecoder::get_size() const {
 }
 
 int VideoDecoder::get_audio_mix_rate() const {
-	if (audio_stream) {
-		return audio_codec_context->sample_rate;
+	if (has_audio) {
+		return audio_output_sample_rate;
 	}
 	return 0;
 }
 
 int VideoDecoder::get_audio_channel_count() const {
-	if (audio_stream) {
-		return audio_codec_context->ch_layout.nb_channels;
+	if (has_audio) {
+		return audio_output_ch_layout.nb_channels;
 	}
 	return 0;
 }
 
-VideoDecoder::VideoDecoder(Ref<FileAccess> p_file) {
-	video_file = p_file;
+void VideoDecoder::_initialize() {
+	frame_queue_memory_budget.store(DEFAULT_FRAME_QUEUE_MEMORY_BUDGET);
+	frame_queue_target_duration.store(DEFAULT_FRAME_QUEUE_TARGET_DURATION);
+	io_buffer_size = DEFAULT_IO_BUFFER_SIZE;
+	read_ahead_size = DEFAULT_READ_AHEAD_SIZE;
+	audio_buffer_duration = DEFAULT_AUDIO_BUFFER_DURATION;
+	frame_queue_depth.store(MIN_FRAME_QUEUE_DEPTH);
+	frame_queue_base_depth.store(MIN_FRAME_QUEUE_DEPTH);
+	frame_queue_max_depth.store(DECODED_FRAMES_CAPACITY);
 	available_textures_mutex.instantiate();
 	hw_transfer_frames_mutex.instantiate();
 	scaler_frames_mutex.instantiate();
-	decoded_frames_mutex.instantiate();
-	audio_buffer_mutex.instantiate();
+	decoded_frame_pool_mutex.instantiate();
+	video_buffers_mutex.instantiate();
+	decoded_frames.init(DECODED_FRAMES_CAPACITY);
+	demux_wakeup.instantiate();
+	video_output_wakeup.instantiate();
+	audio_output_wakeup.instantiate();
+	seek_done.instantiate();
+	image_scale_frame = av_frame_alloc();
+}
+
+VideoDecoder::VideoDecoder(Ref<FileAccess> p_file) {
+	video_file = p_file;
+	_initialize();
+}
+
+VideoDecoder::VideoDecoder(const PackedByteArray &p_data, const String &p_path) {
+	source_data = p_data;
+	source_data_path = p_path;
+	_initialize();
 }
 
 VideoDecoder::~VideoDecoder() {
-	if (thread != nullptr) {
+	if (keyframe_index_thread != nullptr) {
+		keyframe_index_abort.set();
+		keyframe_index_thread->join();
+		memdelete(keyframe_index_thread);
+	}
+
+	if (demux_thread != nullptr) {
 		thread_abort.set_to(true);
-		thread->join();
-		memdelete(thread);
+		video_packets.abort();
+		audio_packets.abort();
+		demux_wakeup->post();
+		video_output_wakeup->post();
+		audio_output_wakeup->post();
+		demux_thread->join();
+		memdelete(demux_thread);
+		video_decode_thread->join();
+		memdelete(video_decode_thread);
+		if (audio_decode_thread != nullptr) {
+			audio_decode_thread->join();
+			memdelete(audio_decode_thread);
+		}
+	}
+
+	// Only once the demuxer thread is gone, seeks look keyframes up in the index.
+	KeyframeIndex *index = keyframe_index.exchange(nullptr);
+	if (index != nullptr) {
+		memdelete(index);
 	}
 
 	if (format_context != nullptr && input_opened) {
@@ -808,6 +1850,9 @@ VideoDecoder::~VideoDecoder() {
 		avcodec_free_context(&audio_codec_context);
 	}
 
+	_free_frame_list(scaler_frames);
+	_free_frame_list(hw_transfer_frames);
+
 	if (sws_context != nullptr) {
 		sws_freeContext(sws_context);
 	}
@@ -815,16 +1860,23 @@ VideoDecoder::~VideoDecoder() {
 	if (swr_context != nullptr) {
 		swr_free(&swr_context);
 	}
+	av_channel_layout_uninit(&swr_context_src_ch_layout);
+	av_channel_layout_uninit(&audio_output_ch_layout);
 
 	if (io_context != nullptr) {
 		av_free(io_context->buffer);
 		avio_context_free(&io_context);
 	}
+
+	if (input_source != nullptr) {
+		memdelete(input_source);
+	}
 }
 
 DecodedFrame::DecodedFrame(double p_time, Ref<ImageTexture> p_texture) {
 	time = p_time;
 	texture = p_texture;
+	format = FFmpegFrameFormat::RGBA8;
 }
 
 DecodedFrame::DecodedFrame(double p_time, Ref<Image> p_image) {
@@ -837,26 +1889,31 @@ Ref<ImageTexture> DecodedFrame::get_texture() const { return texture; }
 
 void DecodedFrame::set_texture(const Ref<ImageTexture> &p_texture) { texture = p_texture; }
 
-double DecodedFrame::get_time() const { return time; }
-
-void DecodedFrame::set_time(double p_time) { time = p_time; }
+void DecodedFrame::set_image(const Ref<Image> &p_image) { image = p_image; }
 
-void DecodedFrame::set_yuv_image_plane(int p_plane_idx, Ref<Image> p_image) {
-	ERR_FAIL_INDEX((size_t)p_plane_idx, std::size(yuv_images));
-	yuv_images[p_plane_idx] = p_image;
+void DecodedFrame::clear() {
+	texture.unref();
+	image.unref();
+	yuv_data = PackedByteArray();
+	yuv_plane_count = 0;
 }
 
-Ref<Image> DecodedFrame::get_yuv_image_plane(int p_plane_idx) const {
-	ERR_FAIL_INDEX_V((size_t)p_plane_idx, std::size(yuv_images), Ref<Image>());
-	return yuv_images[p_plane_idx];
-}
+double DecodedFrame::get_time() const { return time; }
 
-double DecodedAudioFrame::get_time() const {
-	return time;
+void DecodedFrame::set_time(double p_time) { time = p_time; }
+
+void DecodedFrame::set_yuv_data(const PackedByteArray &p_data, const int *p_plane_offsets, int p_plane_count) {
+	ERR_FAIL_INDEX(p_plane_count - 1, (int)std::size(yuv_plane_offsets));
+	yuv_data = p_data;
+	yuv_plane_count = p_plane_count;
+	for (int i = 0; i < p_plane_count; i++) {
+		yuv_plane_offsets[i] = p_plane_offsets[i];
+	}
 }
 
-PackedFloat32Array DecodedAudioFrame::get_sample_data() const {
-	return sample_data;
+int DecodedFrame::get_yuv_plane_offset(int p_plane_idx) const {
+	ERR_FAIL_INDEX_V(p_plane_idx, yuv_plane_count, -1);
+	return yuv_plane_offsets[p_plane_idx];
 }
 String ffmpeg_get_error_message(int p_error_code) {
 	const uint64_t buffer_size = 256;
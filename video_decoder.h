@@ -44,6 +44,7 @@
 #include <godot_cpp/classes/os.hpp>
 #include <godot_cpp/core/mutex_lock.hpp>
 #include <godot_cpp/godot.hpp>
+#include <godot_cpp/templates/hash_set.hpp>
 #include <godot_cpp/templates/list.hpp>
 
 using namespace godot;
@@ -52,18 +53,27 @@ using namespace godot;
 
 #include "core/io/file_access.h"
 #include "core/templates/command_queue_mt.h"
+#include "core/templates/hash_set.h"
 #include "scene/resources/image_texture.h"
 
 #endif
 
+#include "audio_sample_ring.h"
 #include "ffmpeg_codec.h"
 #include "ffmpeg_frame.h"
+#include "frame_buffer_pool.h"
+#include "input_source.h"
+#include "keyframe_index.h"
+#include "packet_queue.h"
+#include "spsc_ring_buffer.h"
+#include "yuv_cpu_converter.h"
 extern "C" {
 #include "libavformat/avformat.h"
 #include "libswresample/swresample.h"
 #include "libswscale/swscale.h"
 }
 
+#include <atomic>
 #include <thread>
 
 String ffmpeg_get_error_message(int p_error_code);
@@ -72,25 +82,75 @@ enum FFmpegFrameFormat {
 	RGBA8,
 	YUV420P,
 	YUVA420P,
+	NV12,
+	YUV422P,
+	YUV444P,
+	YUV420P10,
+	YUV420P12,
+	P010,
+	// Half float RGBA, what high bit depth frames are converted to on the CPU.
+	RGBAH,
+	FRAME_FORMAT_MAX,
 };
 
+// Memory layout of a FFmpegFrameFormat, YUV formats are carried plane by plane as described here.
+struct FFmpegFrameFormatInfo {
+	AVPixelFormat pixel_format;
+	bool is_yuv;
+	// Planes as stored in memory, U and V share a single plane when chroma is interleaved.
+	int plane_count;
+	// log2 of the horizontal and vertical chroma subsampling.
+	int chroma_shift_x;
+	int chroma_shift_y;
+	bool interleaved_chroma;
+	bool has_alpha;
+	int bit_depth;
+	int bytes_per_sample;
+	// Right shift bringing samples down to bit_depth, P010 stores its 10 bits at the top of each 16-bit sample.
+	int sample_shift;
+
+	bool is_chroma_plane(int p_plane) const { return p_plane > 0 && p_plane < (interleaved_chroma ? 2 : 3); }
+	int get_plane_width(int p_plane, int p_frame_width) const {
+		if (!is_chroma_plane(p_plane)) {
+			return p_frame_width;
+		}
+		const int chroma_width = (p_frame_width + (1 << chroma_shift_x) - 1) >> chroma_shift_x;
+		return interleaved_chroma ? chroma_width * 2 : chroma_width;
+	}
+	int get_plane_height(int p_plane, int p_frame_height) const {
+		return is_chroma_plane(p_plane) ? (p_frame_height + (1 << chroma_shift_y) - 1) >> chroma_shift_y : p_frame_height;
+	}
+	// Bytes per row of a tightly packed plane.
+	int get_plane_row_size(int p_plane, int p_frame_width) const { return get_plane_width(p_plane, p_frame_width) * bytes_per_sample; }
+};
+
+const FFmpegFrameFormatInfo &ffmpeg_get_frame_format_info(FFmpegFrameFormat p_format);
+
 class DecodedFrame : public RefCounted {
 	double time;
 	Ref<ImageTexture> texture;
 	Ref<Image> image;
-	Ref<Image> yuv_images[4];
+	// YUV frames keep all of their planes tightly packed in a single buffer.
+	PackedByteArray yuv_data;
+	int yuv_plane_offsets[4] = {};
+	int yuv_plane_count = 0;
 	FFmpegFrameFormat format;
 
 public:
 	Ref<ImageTexture> get_texture() const;
 	void set_texture(const Ref<ImageTexture> &p_texture);
 	Ref<Image> get_image() const { return image; };
+	void set_image(const Ref<Image> &p_image);
+	// Drops all frame data, used when the frame is recycled.
+	void clear();
 
 	double get_time() const;
 	void set_time(double p_time);
 
-	void set_yuv_image_plane(int p_plane_idx, Ref<Image> p_image);
-	Ref<Image> get_yuv_image_plane(int p_plane_idx) const;
+	void set_yuv_data(const PackedByteArray &p_data, const int *p_plane_offsets, int p_plane_count);
+	PackedByteArray get_yuv_data() const { return yuv_data; }
+	int get_yuv_plane_count() const { return yuv_plane_count; }
+	int get_yuv_plane_offset(int p_plane_idx) const;
 
 	DecodedFrame(double p_time, Ref<ImageTexture> p_texture);
 	DecodedFrame(double p_time, Ref<Image> p_image);
@@ -99,16 +159,6 @@ public:
 	void set_format(const FFmpegFrameFormat &p_format) { format = p_format; }
 };
 
-class DecodedAudioFrame : public RefCounted {
-	double time;
-
-public:
-	PackedFloat32Array sample_data;
-	double get_time() const;
-	PackedFloat32Array get_sample_data() const;
-	DecodedAudioFrame(double p_time) { time = p_time; };
-};
-
 class VideoDecoder : public RefCounted {
 public:
 	enum HardwareVideoDecoder {
@@ -132,66 +182,211 @@ public:
 
 private:
 	FFmpegFrameFormat frame_format;
-	Vector<Ref<DecodedAudioFrame>> decoded_audio_frames;
-
-	Ref<core_bind::Mutex> audio_buffer_mutex;
+	AudioSampleRing decoded_audio;
+	// Sizes decoded_audio once the audio codec is open.
+	double audio_buffer_duration = 0.0;
 
+	// Built by _get_scaler_context, recreated whenever the conversion parameters change.
 	SwsContext *sws_context = nullptr;
+	int sws_context_width = 0;
+	int sws_context_height = 0;
+	AVPixelFormat sws_context_src_format = AV_PIX_FMT_NONE;
+	AVPixelFormat sws_context_dst_format = AV_PIX_FMT_NONE;
+	int sws_context_slice_count = 0;
+	// Wraps Image data so sws_scale_frame can write to it.
+	AVFrame *image_scale_frame = nullptr;
+	YUVCPUConverter yuv_cpu_converter;
+	// 0 picks the slice count from the frame size and the number of cores.
+	std::atomic<int> conversion_slice_count{ 0 };
+	// State of the slice conversion currently running on the WorkerThreadPool.
+	const AVFrame *slice_src_frame = nullptr;
+	uint8_t *slice_dst = nullptr;
+	int slice_dst_stride = 0;
+	int slice_total = 0;
+	// Built by _get_resampler_context, converts decoded audio to the output layout and rate in one pass.
 	SwrContext *swr_context = nullptr;
-	DecoderState decoder_state = DecoderState::READY;
+	AVSampleFormat swr_context_src_format = AV_SAMPLE_FMT_NONE;
+	int swr_context_src_sample_rate = 0;
+	AVChannelLayout swr_context_src_ch_layout = {};
+	LocalVector<float> audio_conversion_buffer;
+	// Layout and rate of everything pushed into decoded_audio, set up with the audio codec.
+	AVChannelLayout audio_output_ch_layout = {};
+	int audio_output_sample_rate = 0;
+	// 0 keeps the sample rate or the channel count of the source.
+	int audio_output_mix_rate = 0;
+	int audio_output_channel_count = 0;
+	std::atomic<DecoderState> decoder_state{ DecoderState::READY };
 	mutable CommandQueueMT decoder_commands;
+	// Posted whenever the demuxer thread may have new work: a worker took a packet, a command was pushed or the thread is being aborted.
+	Ref<core_bind::Semaphore> demux_wakeup;
+	// The demuxer returned EAGAIN and sleeps until the consumer next peeks for a frame.
+	SafeFlag demux_waiting_for_input;
+	// Posted whenever the consumer frees a slot in the corresponding output ring.
+	Ref<core_bind::Semaphore> video_output_wakeup;
+	Ref<core_bind::Semaphore> audio_output_wakeup;
+	Ref<core_bind::Semaphore> seek_done;
+	// Video epoch of the last seek the demuxer thread carried out, the epoch acts as the seek generation token.
+	std::atomic<uint32_t> completed_seek_epoch{ 0 };
 	AVStream *video_stream = nullptr;
 	AVStream *audio_stream = nullptr;
 	AVIOContext *io_context = nullptr;
+	// Created when the file is opened, the AVIO callbacks read through it.
+	InputSource *input_source = nullptr;
+	int io_buffer_size = 0;
+	int64_t read_ahead_size = 0;
+	bool memory_map_enabled = true;
+	bool input_memory_mapped = false;
 	AVFormatContext *format_context = nullptr;
 	AVCodecContext *video_codec_context = nullptr;
 	AVCodecContext *audio_codec_context = nullptr;
 	bool input_opened = false;
 	bool has_audio = false;
+	// The video stream is tagged as carrying WebM alpha.
+	bool video_has_alpha = false;
 	bool hw_decoding_allowed = false;
 	double video_time_base_in_seconds;
 	double audio_time_base_in_seconds;
 	double duration;
-	double skip_output_until_time = -1.0;
-	SafeFlag skip_current_outputs;
+	double frame_duration = 1000.0 / 30.0;
+	// Owned by the decode workers, updated whenever they reach a flush entry in their packet queue.
+	double video_skip_output_until_time = -1.0;
+	double audio_skip_output_until_time = -1.0;
+	// Epochs the decode workers tag their output with, anything tagged with an epoch older than the ring's is dropped.
+	uint32_t video_output_epoch = 0;
+	uint32_t audio_output_epoch = 0;
 	SafeNumeric<float> last_decoded_frame_time;
 	Ref<FileAccess> video_file;
+	// Used instead of video_file when the video is already in memory.
+	PackedByteArray source_data;
+	String source_data_path;
 	BitField<HardwareVideoDecoder> target_hw_video_decoders = HardwareVideoDecoder::ANY;
 	Ref<core_bind::Mutex> available_textures_mutex;
 	List<Ref<ImageTexture>> available_textures;
+	// Intrusive free lists of recycled FFmpegFrames.
 	Ref<core_bind::Mutex> hw_transfer_frames_mutex;
-	List<Ref<FFmpegFrame>> hw_transfer_frames;
+	FFmpegFrame *hw_transfer_frames = nullptr;
 	Ref<core_bind::Mutex> scaler_frames_mutex;
-	List<Ref<FFmpegFrame>> scaler_frames;
-	Ref<core_bind::Mutex> decoded_frames_mutex;
-	Vector<Ref<DecodedFrame>> decoded_frames;
-	std::thread *thread = nullptr;
+	FFmpegFrame *scaler_frames = nullptr;
+	// Frame data _get_video_buffer() lets the codec decode into, the Image takes it over without a copy.
+	struct VideoBuffer {
+		VideoDecoder *decoder = nullptr;
+		PackedByteArray data;
+	};
+	// Live buffers allocated by _get_video_buffer(), any other buffer in a frame belongs to FFmpeg.
+	Ref<core_bind::Mutex> video_buffers_mutex;
+	HashSet<VideoBuffer *> video_buffers;
+	// DecodedFrames handed back through return_frame(), reused for later output.
+	Ref<core_bind::Mutex> decoded_frame_pool_mutex;
+	LocalVector<Ref<DecodedFrame>> decoded_frame_pool;
+	SPSCRingBuffer<Ref<DecodedFrame>> decoded_frames;
+	Ref<DecodedFrame> cached_poster_frame;
+	// Frame data handed back through return_frame(), bounded by the frame queue memory budget.
+	FrameBufferPool frame_buffer_pool;
+	// Decoded frame queue sizing, the depth is derived from a memory budget and a target duration
+	// and then adapted at runtime: stalls grow it, memory pressure shrinks it.
+	std::atomic<int64_t> frame_queue_memory_budget;
+	std::atomic<double> frame_queue_target_duration;
+	SafeFlag frame_queue_limits_dirty;
+	std::atomic<int> frame_queue_depth;
+	std::atomic<int> frame_queue_base_depth;
+	std::atomic<int> frame_queue_max_depth;
+	std::atomic<uint64_t> frame_queue_stall_count = { 0 };
+	// Video decode worker only.
+	Vector2i frame_queue_frame_size;
+	int64_t frame_queue_frame_size_bytes = 0;
+	uint64_t last_memory_pressure_check_usec = 0;
+	// Consumer thread only.
+	bool frame_queue_starved = false;
+	int frames_popped_since_seek = 0;
+	uint64_t last_frame_queue_adjustment_usec = 0;
+
+	// Demuxed packets waiting to be decoded, their serials match the epochs of the output rings.
+	PacketQueue video_packets;
+	PacketQueue audio_packets;
+	// Demuxer thread only.
+	bool demux_eof = false;
+	uint32_t video_drain_id = 0;
+	uint32_t audio_drain_id = 0;
+
+	std::thread *demux_thread = nullptr;
+	std::thread *video_decode_thread = nullptr;
+	std::thread *audio_decode_thread = nullptr;
 	SafeFlag thread_abort;
 	AVCodec const *forced_video_codec = nullptr;
+	// Time open() took to open the file and the codecs.
+	uint64_t open_latency_usec = 0;
+
+	// Loaded from the user cache or built in the background on the first open, null until ready.
+	bool keyframe_index_enabled = true;
+	// Mutable since it can be picked up lazily from the sidecar another decoder wrote, see _get_keyframe_index().
+	mutable std::atomic<KeyframeIndex *> keyframe_index{ nullptr };
+	// Set when another decoder was already indexing the file as this one was opened.
+	mutable std::atomic<bool> keyframe_index_pending{ false };
+	std::thread *keyframe_index_thread = nullptr;
+	SafeFlag keyframe_index_abort;
+	String keyframe_index_source_path;
 
 	bool looping = false;
 
+	void _initialize();
 	static int _read_packet_callback(void *p_opaque, uint8_t *p_buf, int p_buf_size);
 	static int64_t _stream_seek_callback(void *p_opaque, int64_t p_offset, int p_whence);
 	void prepare_decoding();
 	Error recreate_codec_context();
 	static HardwareVideoDecoder from_av_hw_device_type(AVHWDeviceType p_device_type);
 
-	void _seek_command(double p_target_timestamp);
-	static void _thread_func(void *userdata);
-	void _decode_next_frame(AVPacket *p_packet, AVFrame *p_receive_frame);
+	static bool _is_valid_state_transition(DecoderState p_from, DecoderState p_to);
+	bool _set_decoder_state(DecoderState p_state);
+
+	void _update_frame_queue_limits(const Vector2i &p_frame_size);
+	void _check_memory_pressure();
+	void _on_frame_queue_starved();
+	void _on_frame_popped();
+
+	void _start_keyframe_index();
+	const KeyframeIndex *_get_keyframe_index() const;
+	static void _keyframe_index_thread_func(void *userdata);
+	bool _seek_to_keyframe(int64_t p_target_pts);
+	void _seek_command(double p_target_timestamp, uint32_t p_video_epoch, uint32_t p_audio_epoch, bool p_notify);
+	static void _demux_thread_func(void *userdata);
+	static void _video_decode_thread_func(void *userdata);
+	static void _audio_decode_thread_func(void *userdata);
+	void _demux_next_packet(AVPacket *p_packet);
+	bool _has_enough_packets();
+	bool _are_packet_queues_drained();
+	void _run_decode_worker(PacketQueue &p_queue, AVCodecContext *p_codec_context);
 	int _send_packet(AVCodecContext *p_codec_context, AVFrame *p_receive_frame, AVPacket *p_packet);
 	void _try_disable_hw_decoding(int p_error_code);
 	void _read_decoded_frames(AVFrame *p_received_frame);
 	void _read_decoded_audio_frames(AVFrame *p_received_frame);
-
-	void _hw_transfer_frame_return(Ref<FFmpegFrame> p_hw_frame);
-	void _scaler_frame_return(Ref<FFmpegFrame> p_hw_frame);
-
-	Ref<FFmpegFrame> _ensure_frame_pixel_format(Ref<FFmpegFrame> p_frame, AVPixelFormat p_target_pixel_format);
-	Ref<DecodedFrame> _unwrap_yuv_frame(double p_frame_time, Ref<FFmpegFrame> p_frame, FFmpegFrameFormat p_out_format);
-	AVFrame *_ensure_frame_audio_format(AVFrame *p_frame, AVSampleFormat p_target_audio_format);
-	String _codec_id_to_preferred_decoder_name(AVCodecID p_codec_id) const;
+	template <class T>
+	bool _push_output(SPSCRingBuffer<Ref<T>> &p_ring, const Ref<T> &p_output, uint32_t p_epoch, const Ref<core_bind::Semaphore> &p_wakeup);
+	bool _push_audio_output(const float *p_samples, uint32_t p_frame_count, double p_time);
+
+	static FFmpegFrame *_pop_free_frame(FFmpegFrame *&r_free_list, const Ref<core_bind::Mutex> &p_mutex);
+	static void _push_free_frame(FFmpegFrame *&r_free_list, const Ref<core_bind::Mutex> &p_mutex, FFmpegFrame *p_frame);
+	static void _free_frame_list(FFmpegFrame *&r_free_list);
+	static void _hw_transfer_frame_return(void *p_userdata, FFmpegFrame *p_hw_frame);
+	static void _scaler_frame_return(void *p_userdata, FFmpegFrame *p_scaler_frame);
+	Ref<DecodedFrame> _acquire_decoded_frame(double p_time, FFmpegFrameFormat p_format);
+
+	static bool _can_decode_into_image_buffer(AVCodecContext *p_codec_context, int p_format, int p_width, int p_height);
+	static int _get_video_buffer(AVCodecContext *p_codec_context, AVFrame *p_frame, int p_flags);
+	static void _free_video_buffer(void *p_opaque, uint8_t *p_data);
+	// Returns the data of p_frame's buffer if _get_video_buffer() allocated it and the frame covers all of it.
+	bool _get_own_video_buffer_data(const AVFrame *p_frame, PackedByteArray &r_data);
+	int _get_conversion_slice_count(int p_width, int p_height) const;
+	SwsContext *_get_scaler_context(int p_width, int p_height, AVPixelFormat p_src_format, AVPixelFormat p_dst_format);
+	void _convert_yuv_slice(uint32_t p_slice);
+	void _convert_yuv_to_rgba(const AVFrame *p_frame, uint8_t *r_dst, int p_dst_stride);
+	Ref<Image> _frame_to_rgba_image(AVFrame *p_frame);
+	// Scales p_frame into a pooled frame, the caller has to do_return() it once done.
+	FFmpegFrame *_ensure_frame_pixel_format(AVFrame *p_frame, AVPixelFormat p_target_pixel_format);
+	Ref<DecodedFrame> _unwrap_yuv_frame(double p_frame_time, AVFrame *p_frame, FFmpegFrameFormat p_out_format);
+	SwrContext *_get_resampler_context(const AVFrame *p_frame);
+	bool _decode_attached_picture(AVFrame *r_frame);
+	bool _decode_first_video_frame(AVFrame *r_frame);
+	Ref<DecodedFrame> _poster_frame_from_av_frame(const AVFrame *p_frame);
 
 public:
 	struct AvailableDecoderInfo {
@@ -199,22 +394,89 @@ public:
 		AVHWDeviceType device_type;
 	};
 	void seek(double p_time, bool p_wait = false);
+	// Opens the file and the codecs without starting any threads, start_decoding() does this itself if needed.
+	void open();
 	void start_decoding();
+	bool is_decoding_started() const;
+	// Cover art if the file has any, the first video frame otherwise. Must be called after open() and before start_decoding(),
+	// the frame has the size and format of the video frames.
+	Ref<DecodedFrame> decode_poster_frame();
+	// The frame decode_poster_frame() returned, kept so a pooled decoder can show it again.
+	Ref<DecodedFrame> get_poster_frame() const;
 	Vector<AvailableDecoderInfo> get_available_video_decoders(const AVInputFormat *p_format, AVCodecID p_codec_id, BitField<HardwareVideoDecoder> p_target_decoders);
 	void return_frames(Vector<Ref<DecodedFrame>> p_frames);
 	void return_frame(Ref<DecodedFrame> p_frame);
-	Vector<Ref<DecodedFrame>> get_decoded_frames();
-	Vector<Ref<DecodedAudioFrame>> get_decoded_audio_frames();
+	void trim_frame_buffer_pool();
+	// Consumer side of the decoded frame rings, must only be called from a single thread.
+	Ref<DecodedFrame> peek_decoded_frame();
+	Ref<DecodedFrame> pop_decoded_frame();
+	// Describes the oldest block of decoded audio, its samples start at r_sample_offset in get_decoded_audio_samples().
+	bool peek_decoded_audio(double &r_time, uint32_t &r_frame_count, uint32_t &r_sample_offset);
+	void pop_decoded_audio();
+	const PackedFloat32Array &get_decoded_audio_samples() const;
 	DecoderState get_decoder_state() const;
+	// True until the demuxer thread has carried out the last seek, the decoder state may still be stale until then.
+	bool is_seek_pending() const;
 	double get_last_decoded_frame_time() const;
 	bool is_running() const;
 	double get_duration() const;
+	// Exact once the keyframe index is ready, estimated from the container until then.
+	int64_t get_frame_count() const;
+	// Presentation time of a frame in msec.
+	double get_frame_time(int64_t p_frame) const;
+	// Must be called before start_decoding().
+	void set_keyframe_index_enabled(bool p_enabled);
+	bool is_keyframe_index_ready() const;
+	uint64_t get_open_latency_usec() const;
 	Vector2i get_size() const;
 	int get_audio_mix_rate() const;
 	int get_audio_channel_count() const;
 	FFmpegFrameFormat get_frame_format() const { return frame_format; }
 
+	void set_frame_queue_memory_budget(int64_t p_bytes);
+	int64_t get_frame_queue_memory_budget() const;
+	void set_frame_queue_target_duration(double p_msec);
+	double get_frame_queue_target_duration() const;
+	int get_frame_queue_depth() const;
+	int get_frame_queue_max_depth() const;
+	uint64_t get_frame_queue_stall_count() const;
+
+	// Number of horizontal slices RGBA conversion is split into, converted in parallel. 0 means automatic.
+	void set_conversion_slice_count(int p_slice_count);
+	int get_conversion_slice_count() const;
+
+	// Size of the buffer FFmpeg reads the file into, must be set before the file is opened.
+	void set_io_buffer_size(int p_bytes);
+	int get_io_buffer_size() const;
+	// How much of the file is read ahead of the demuxer on a background thread, 0 reads on the demuxer thread instead.
+	// Must be set before the file is opened.
+	void set_read_ahead_size(int64_t p_bytes);
+	int64_t get_read_ahead_size() const;
+	// Reads plain files on disk through a memory mapping, other files fall back to the read ahead or direct reads.
+	// Must be set before the file is opened.
+	void set_memory_map_enabled(bool p_enabled);
+	bool is_memory_map_enabled() const;
+	// How much decoded audio is buffered ahead of the playback, the audio decoder waits once it's full.
+	// Must be set before the file is opened.
+	void set_audio_buffer_duration(double p_msec);
+	double get_audio_buffer_duration() const;
+	// Sample rate decoded audio is resampled to, usually the AudioServer mix rate. Must be set before the file is opened.
+	void set_audio_output_mix_rate(int p_mix_rate);
+	int get_audio_output_mix_rate() const;
+	// Channel count decoded audio is up or downmixed to, must be one Godot can mix (1, 2, 4, 6 or 8).
+	// Must be set before the file is opened.
+	void set_audio_output_channel_count(int p_channel_count);
+	int get_audio_output_channel_count() const;
+	bool is_input_memory_mapped() const;
+	int64_t get_input_bytes_read() const;
+	// Reads that had to wait on the read ahead thread.
+	int64_t get_input_stall_count() const;
+	// Share of reads served straight from the read ahead window.
+	double get_input_hit_rate() const;
+
 	VideoDecoder(Ref<FileAccess> p_file);
+	// p_path is only used to find the video's caches, it may be empty.
+	VideoDecoder(const PackedByteArray &p_data, const String &p_path);
 	~VideoDecoder();
 };
 
@@ -0,0 +1,915 @@
+/**************************************************************************/
+/*  yuv_cpu_converter.cpp                                                 */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#include "yuv_cpu_converter.h"
+
+extern "C" {
+#include "libavutil/cpu.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+#include "libswscale/swscale.h"
+}
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define YUV_CPU_CONVERTER_X86
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define YUV_TARGET_SSE2 __attribute__((target("sse2")))
+#define YUV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define YUV_TARGET_SSE2
+#define YUV_TARGET_AVX2
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define YUV_CPU_CONVERTER_NEON
+#include <arm_neon.h>
+#endif
+
+static constexpr int COEFFICIENT_BITS = 13;
+static constexpr int32_t COEFFICIENT_ROUNDING = 1 << (COEFFICIENT_BITS - 1);
+// NV12 rows are converted in blocks of this many pixels, must be even so chroma samples stay paired.
+static constexpr int NV12_BLOCK_WIDTH = 2048;
+// Smallest normal half float, anything below is flushed to zero when converting.
+static constexpr float HALF_MIN_NORMAL = 6.103515625e-05f;
+static constexpr uint16_t HALF_ONE = 0x3C00;
+// check_kernels repeats each conversion for at least this long to measure its throughput.
+static constexpr int64_t KERNEL_CHECK_DURATION_USEC = 200000;
+
+// Packs two 16-bit coefficients into one 32-bit lane, the layout madd expects.
+static inline int32_t _pack_coefficient_pair(int32_t p_a, int32_t p_b) {
+	return (int32_t)(((uint32_t)p_a & 0xFFFF) | ((uint32_t)p_b << 16));
+}
+
+static inline uint8_t _clamp_channel(int32_t p_value) {
+	p_value = (p_value + COEFFICIENT_ROUNDING) >> COEFFICIENT_BITS;
+	return p_value < 0 ? 0 : (p_value > 255 ? 255 : p_value);
+}
+
+static void _yuv_to_rgba_row_c(const uint8_t *p_y, const uint8_t *p_u, const uint8_t *p_v, const uint8_t *p_a, uint8_t *r_dst, int p_width, const YUVCoefficients &p_coefficients) {
+	for (int x = 0; x < p_width; x++) {
+		const int32_t y = (p_y[x] - p_coefficients.y_offset) * p_coefficients.y_scale;
+		const int32_t u = p_u[x >> 1] - 128;
+		const int32_t v = p_v[x >> 1] - 128;
+		r_dst[0] = _clamp_channel(y + p_coefficients.cr_r * v);
+		r_dst[1] = _clamp_channel(y - p_coefficients.cb_g * u - p_coefficients.cr_g * v);
+		r_dst[2] = _clamp_channel(y + p_coefficients.cb_b * u);
+		r_dst[3] = p_a ? p_a[x] : 255;
+		r_dst += 4;
+	}
+}
+
+// Only valid for values in [0, 1], which saves handling infinities and NaNs. The SIMD paths use the same bit trick.
+static inline uint16_t _unit_float_to_half(float p_value) {
+	if (p_value < HALF_MIN_NORMAL) {
+		return 0;
+	}
+	uint32_t bits;
+	memcpy(&bits, &p_value, sizeof(bits));
+	// Round to nearest even, then rebias the exponent from 127 to 15.
+	bits += 0x0FFF + ((bits >> 13) & 1);
+	return (uint16_t)((bits >> 13) - (112 << 10));
+}
+
+static inline float _clamp_unit(float p_value) {
+	return p_value < 0.0f ? 0.0f : (p_value > 1.0f ? 1.0f : p_value);
+}
+
+static void _yuv16_to_rgbah_row_c(const uint16_t *p_y, const uint16_t *p_u, const uint16_t *p_v, uint16_t *r_dst, int p_width, const YUVFloatCoefficients &p_coefficients) {
+	const int shift = p_coefficients.sample_shift;
+	for (int x = 0; x < p_width; x++) {
+		const float y = ((float)(p_y[x] >> shift) - p_coefficients.y_offset) * p_coefficients.y_scale;
+		const float u = (float)(p_u[x >> 1] >> shift) - p_coefficients.chroma_offset;
+		const float v = (float)(p_v[x >> 1] >> shift) - p_coefficients.chroma_offset;
+		r_dst[0] = _unit_float_to_half(_clamp_unit(y + p_coefficients.cr_r * v));
+		r_dst[1] = _unit_float_to_half(_clamp_unit(y - p_coefficients.cb_g * u - p_coefficients.cr_g * v));
+		r_dst[2] = _unit_float_to_half(_clamp_unit(y + p_coefficients.cb_b * u));
+		r_dst[3] = HALF_ONE;
+		r_dst += 4;
+	}
+}
+
+// The SIMD paths compute exactly what _yuv_to_rgba_row_c does: the products are summed in 32 bits with madd
+// on interleaved (value, value) pairs, then rounded, shifted and saturated back down to bytes.
+
+#ifdef YUV_CPU_CONVERTER_X86
+
+struct YUVCoefficientsSSE2 {
+	__m128i y_offset;
+	__m128i chroma_offset;
+	__m128i rounding;
+	__m128i y_cr_r;
+	__m128i y_cb_g;
+	__m128i cr_g;
+	__m128i y_cb_b;
+};
+
+// Returns the 8 16-bit rounded results of p_a * c0 + p_b * c1, with c0 and c1 packed in p_ab_coefficients.
+YUV_TARGET_SSE2 static inline __m128i _channel_sse2(__m128i p_a, __m128i p_b, __m128i p_ab_coefficients, __m128i p_rounding) {
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(p_a, p_b), p_ab_coefficients);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(p_a, p_b), p_ab_coefficients);
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, p_rounding), COEFFICIENT_BITS);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, p_rounding), COEFFICIENT_BITS);
+	return _mm_packs_epi32(lo, hi);
+}
+
+YUV_TARGET_SSE2 static inline __m128i _channel3_sse2(__m128i p_a, __m128i p_b, __m128i p_c, __m128i p_ab_coefficients, __m128i p_c_coefficients, __m128i p_rounding) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(p_a, p_b), p_ab_coefficients);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(p_a, p_b), p_ab_coefficients);
+	lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(p_c, zero), p_c_coefficients));
+	hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(p_c, zero), p_c_coefficients));
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, p_rounding), COEFFICIENT_BITS);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, p_rounding), COEFFICIENT_BITS);
+	return _mm_packs_epi32(lo, hi);
+}
+
+// Converts 8 pixels worth of 16-bit Y, U and V into 16-bit R, G and B.
+YUV_TARGET_SSE2 static inline void _yuv_to_rgb8_sse2(__m128i p_y, __m128i p_u, __m128i p_v, const YUVCoefficientsSSE2 &p_c, __m128i &r_r, __m128i &r_g, __m128i &r_b) {
+	p_y = _mm_sub_epi16(p_y, p_c.y_offset);
+	p_u = _mm_sub_epi16(p_u, p_c.chroma_offset);
+	p_v = _mm_sub_epi16(p_v, p_c.chroma_offset);
+	r_r = _channel_sse2(p_y, p_v, p_c.y_cr_r, p_c.rounding);
+	r_g = _channel3_sse2(p_y, p_u, p_v, p_c.y_cb_g, p_c.cr_g, p_c.rounding);
+	r_b = _channel_sse2(p_y, p_u, p_c.y_cb_b, p_c.rounding);
+}
+
+// Interleaves 16 bytes of each channel into 64 bytes of RGBA.
+YUV_TARGET_SSE2 static inline void _store_rgba_sse2(uint8_t *r_dst, __m128i p_r, __m128i p_g, __m128i p_b, __m128i p_a) {
+	const __m128i rg_lo = _mm_unpacklo_epi8(p_r, p_g);
+	const __m128i rg_hi = _mm_unpackhi_epi8(p_r, p_g);
+	const __m128i ba_lo = _mm_unpacklo_epi8(p_b, p_a);
+	const __m128i ba_hi = _mm_unpackhi_epi8(p_b, p_a);
+	_mm_storeu_si128((__m128i *)(r_dst + 0), _mm_unpacklo_epi16(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i *)(r_dst + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i *)(r_dst + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+	_mm_storeu_si128((__m128i *)(r_dst + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+YUV_TARGET_SSE2 static YUVCoefficientsSSE2 _make_coefficients_sse2(const YUVCoefficients &p_coefficients) {
+	YUVCoefficientsSSE2 c;
+	c.y_offset = _mm_set1_epi16(p_coefficients.y_offset);
+	c.chroma_offset = _mm_set1_epi16(128);
+	c.rounding = _mm_set1_epi32(COEFFICIENT_ROUNDING);
+	c.y_cr_r = _mm_set1_epi32(_pack_coefficient_pair(p_coefficients.y_scale, p_coefficients.cr_r));
+	c.y_cb_g = _mm_set1_epi32(_pack_coefficient_pair(p_coefficients.y_scale, -p_coefficients.cb_g));
+	c.cr_g = _mm_set1_epi32(_pack_coefficient_pair(-p_coefficients.cr_g, 0));
+	c.y_cb_b = _mm_set1_epi32(_pack_coefficient_pair(p_coefficients.y_scale, p_coefficients.cb_b));
+	return c;
+}
+
+YUV_TARGET_SSE2 static void _yuv_to_rgba_row_sse2(const uint8_t *p_y, const uint8_t *p_u, const uint8_t *p_v, const uint8_t *p_a, uint8_t *r_dst, int p_width, const YUVCoefficients &p_coefficients) {
+	const YUVCoefficientsSSE2 c = _make_coefficients_sse2(p_coefficients);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi8((char)0xFF);
+
+	int x = 0;
+	for (; x + 16 <= p_width; x += 16) {
+		const __m128i y = _mm_loadu_si128((const __m128i *)(p_y + x));
+		const __m128i u = _mm_loadl_epi64((const __m128i *)(p_u + x / 2));
+		const __m128i v = _mm_loadl_epi64((const __m128i *)(p_v + x / 2));
+		// Each chroma sample covers two horizontal pixels.
+		const __m128i u_pixels = _mm_unpacklo_epi8(u, u);
+		const __m128i v_pixels = _mm_unpacklo_epi8(v, v);
+
+		__m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+		_yuv_to_rgb8_sse2(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi8(u_pixels, zero), _mm_unpacklo_epi8(v_pixels, zero), c, r_lo, g_lo, b_lo);
+		_yuv_to_rgb8_sse2(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(u_pixels, zero), _mm_unpackhi_epi8(v_pixels, zero), c, r_hi, g_hi, b_hi);
+
+		const __m128i a = p_a ? _mm_loadu_si128((const __m128i *)(p_a + x)) : opaque;
+		_store_rgba_sse2(r_dst + x * 4, _mm_packus_epi16(r_lo, r_hi), _mm_packus_epi16(g_lo, g_hi), _mm_packus_epi16(b_lo, b_hi), a);
+	}
+
+	if (x < p_width) {
+		_yuv_to_rgba_row_c(p_y + x, p_u + x / 2, p_v + x / 2, p_a ? p_a + x : nullptr, r_dst + x * 4, p_width - x, p_coefficients);
+	}
+}
+
+// 16-bit input, 8 pixels at a time.
+struct YUVFloatCoefficientsSSE2 {
+	__m128 y_offset;
+	__m128 chroma_offset;
+	__m128 y_scale;
+	__m128 cr_r;
+	__m128 cb_g;
+	__m128 cr_g;
+	__m128 cb_b;
+	__m128i shift;
+};
+
+YUV_TARGET_SSE2 static inline __m128i _unit_float_to_half_sse2(__m128 p_value) {
+	const __m128i bits = _mm_castps_si128(p_value);
+	const __m128i rounding = _mm_add_epi32(_mm_set1_epi32(0x0FFF), _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1)));
+	const __m128i half = _mm_sub_epi32(_mm_srli_epi32(_mm_add_epi32(bits, rounding), 13), _mm_set1_epi32(112 << 10));
+	const __m128i normal = _mm_castps_si128(_mm_cmpge_ps(p_value, _mm_set1_ps(HALF_MIN_NORMAL)));
+	return _mm_and_si128(half, normal);
+}
+
+YUV_TARGET_SSE2 static inline __m128 _clamp_unit_sse2(__m128 p_value) {
+	return _mm_min_ps(_mm_max_ps(p_value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+// Interleaves 8 halves of each channel into 64 bytes of half float RGBA.
+YUV_TARGET_SSE2 static inline void _store_rgbah_sse2(uint16_t *r_dst, __m128i p_r, __m128i p_g, __m128i p_b, __m128i p_a) {
+	const __m128i rg_lo = _mm_unpacklo_epi16(p_r, p_g);
+	const __m128i rg_hi = _mm_unpackhi_epi16(p_r, p_g);
+	const __m128i ba_lo = _mm_unpacklo_epi16(p_b, p_a);
+	const __m128i ba_hi = _mm_unpackhi_epi16(p_b, p_a);
+	_mm_storeu_si128((__m128i *)(r_dst + 0), _mm_unpacklo_epi32(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i *)(r_dst + 8), _mm_unpackhi_epi32(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i *)(r_dst + 16), _mm_unpacklo_epi32(rg_hi, ba_hi));
+	_mm_storeu_si128((__m128i *)(r_dst + 24), _mm_unpackhi_epi32(rg_hi, ba_hi));
+}
+
+YUV_TARGET_SSE2 static void _yuv16_to_rgbah_row_sse2(const uint16_t *p_y, const uint16_t *p_u, const uint16_t *p_v, uint16_t *r_dst, int p_width, const YUVFloatCoefficients &p_coefficients) {
+	YUVFloatCoefficientsSSE2 c;
+	c.y_offset = _mm_set1_ps(p_coefficients.y_offset);
+	c.chroma_offset = _mm_set1_ps(p_coefficients.chroma_offset);
+	c.y_scale = _mm_set1_ps(p_coefficients.y_scale);
+	c.cr_r = _mm_set1_ps(p_coefficients.cr_r);
+	c.cb_g = _mm_set1_ps(p_coefficients.cb_g);
+	c.cr_g = _mm_set1_ps(p_coefficients.cr_g);
+	c.cb_b = _mm_set1_ps(p_coefficients.cb_b);
+	c.shift = _mm_cvtsi32_si128(p_coefficients.sample_shift);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i opaque = _mm_set1_epi16((short)HALF_ONE);
+
+	int x = 0;
+	for (; x + 8 <= p_width; x += 8) {
+		const __m128i y = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(p_y + x)), c.shift);
+		__m128i u = _mm_srl_epi16(_mm_loadl_epi64((const __m128i *)(p_u + x / 2)), c.shift);
+		__m128i v = _mm_srl_epi16(_mm_loadl_epi64((const __m128i *)(p_v + x / 2)), c.shift);
+		u = _mm_unpacklo_epi16(u, u);
+		v = _mm_unpacklo_epi16(v, v);
+
+		__m128i r[2], g[2], b[2];
+		for (int half = 0; half < 2; half++) {
+			const __m128i y32 = half == 0 ? _mm_unpacklo_epi16(y, zero) : _mm_unpackhi_epi16(y, zero);
+			const __m128i u32 = half == 0 ? _mm_unpacklo_epi16(u, zero) : _mm_unpackhi_epi16(u, zero);
+			const __m128i v32 = half == 0 ? _mm_unpacklo_epi16(v, zero) : _mm_unpackhi_epi16(v, zero);
+			const __m128 yf = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(y32), c.y_offset), c.y_scale);
+			const __m128 uf = _mm_sub_ps(_mm_cvtepi32_ps(u32), c.chroma_offset);
+			const __m128 vf = _mm_sub_ps(_mm_cvtepi32_ps(v32), c.chroma_offset);
+			r[half] = _unit_float_to_half_sse2(_clamp_unit_sse2(_mm_add_ps(yf, _mm_mul_ps(c.cr_r, vf))));
+			g[half] = _unit_float_to_half_sse2(_clamp_unit_sse2(_mm_sub_ps(_mm_sub_ps(yf, _mm_mul_ps(c.cb_g, uf)), _mm_mul_ps(c.cr_g, vf))));
+			b[half] = _unit_float_to_half_sse2(_clamp_unit_sse2(_mm_add_ps(yf, _mm_mul_ps(c.cb_b, uf))));
+		}
+		// Halves of values in [0, 1] fit in a signed 16-bit integer, so the signed pack doesn't saturate them.
+		_store_rgbah_sse2(r_dst + x * 4, _mm_packs_epi32(r[0], r[1]), _mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(b[0], b[1]), opaque);
+	}
+
+	if (x < p_width) {
+		_yuv16_to_rgbah_row_c(p_y + x, p_u + x / 2, p_v + x / 2, r_dst + x * 4, p_width - x, p_coefficients);
+	}
+}
+
+YUV_TARGET_AVX2 static inline __m256i _channel_avx2(__m256i p_a, __m256i p_b, __m256i p_ab_coefficients, __m256i p_rounding) {
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(p_a, p_b), p_ab_coefficients);
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(p_a, p_b), p_ab_coefficients);
+	lo = _mm256_srai_epi32(_mm256_add_epi32(lo, p_rounding), COEFFICIENT_BITS);
+	hi = _mm256_srai_epi32(_mm256_add_epi32(hi, p_rounding), COEFFICIENT_BITS);
+	// unpack and pack both work within 128-bit lanes, so the pixel order comes back out unchanged.
+	return _mm256_packs_epi32(lo, hi);
+}
+
+YUV_TARGET_AVX2 static inline __m256i _channel3_avx2(__m256i p_a, __m256i p_b, __m256i p_c, __m256i p_ab_coefficients, __m256i p_c_coefficients, __m256i p_rounding) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(p_a, p_b), p_ab_coefficients);
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(p_a, p_b), p_ab_coefficients);
+	lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(p_c, zero), p_c_coefficients));
+	hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(p_c, zero), p_c_coefficients));
+	lo = _mm256_srai_epi32(_mm256_add_epi32(lo, p_rounding), COEFFICIENT_BITS);
+	hi = _mm256_srai_epi32(_mm256_add_epi32(hi, p_rounding), COEFFICIENT_BITS);
+	return _mm256_packs_epi32(lo, hi);
+}
+
+// Packs two sets of 16 16-bit values into 32 bytes, in order.
+YUV_TARGET_AVX2 static inline __m256i _pack_channel_avx2(__m256i p_lo, __m256i p_hi) {
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(p_lo, p_hi), 0xD8);
+}
+
+YUV_TARGET_AVX2 static void _yuv_to_rgba_row_avx2(const uint8_t *p_y, const uint8_t *p_u, const uint8_t *p_v, const uint8_t *p_a, uint8_t *r_dst, int p_width, const YUVCoefficients &p_coefficients) {
+	const __m256i y_offset = _mm256_set1_epi16(p_coefficients.y_offset);
+	const __m256i chroma_offset = _mm256_set1_epi16(128);
+	const __m256i rounding = _mm256_set1_epi32(COEFFICIENT_ROUNDING);
+	const __m256i y_cr_r = _mm256_set1_epi32(_pack_coefficient_pair(p_coefficients.y_scale, p_coefficients.cr_r));
+	const __m256i y_cb_g = _mm256_set1_epi32(_pack_coefficient_pair(p_coefficients.y_scale, -p_coefficients.cb_g));
+	const __m256i cr_g = _mm256_set1_epi32(_pack_coefficient_pair(-p_coefficients.cr_g, 0));
+	const __m256i y_cb_b = _mm256_set1_epi32(_pack_coefficient_pair(p_coefficients.y_scale, p_coefficients.cb_b));
+	const __m256i opaque = _mm256_set1_epi8((char)0xFF);
+
+	int x = 0;
+	for (; x + 32 <= p_width; x += 32) {
+		const __m128i y_lo = _mm_loadu_si128((const __m128i *)(p_y + x));
+		const __m128i y_hi = _mm_loadu_si128((const __m128i *)(p_y + x + 16));
+		const __m128i u = _mm_loadu_si128((const __m128i *)(p_u + x / 2));
+		const __m128i v = _mm_loadu_si128((const __m128i *)(p_v + x / 2));
+
+		__m256i r[2], g[2], b[2];
+		for (int half = 0; half < 2; half++) {
+			const __m128i u_pixels = half == 0 ? _mm_unpacklo_epi8(u, u) : _mm_unpackhi_epi8(u, u);
+			const __m128i v_pixels = half == 0 ? _mm_unpacklo_epi8(v, v) : _mm_unpackhi_epi8(v, v);
+			const __m256i y16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(half == 0 ? y_lo : y_hi), y_offset);
+			const __m256i u16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(u_pixels), chroma_offset);
+			const __m256i v16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(v_pixels), chroma_offset);
+			r[half] = _channel_avx2(y16, v16, y_cr_r, rounding);
+			g[half] = _channel3_avx2(y16, u16, v16, y_cb_g, cr_g, rounding);
+			b[half] = _channel_avx2(y16, u16, y_cb_b, rounding);
+		}
+
+		const __m256i r8 = _pack_channel_avx2(r[0], r[1]);
+		const __m256i g8 = _pack_channel_avx2(g[0], g[1]);
+		const __m256i b8 = _pack_channel_avx2(b[0], b[1]);
+		const __m256i a8 = p_a ? _mm256_loadu_si256((const __m256i *)(p_a + x)) : opaque;
+
+		// The unpacks interleave within each lane, so lane 0 ends up with pixels 0-15 and lane 1 with 16-31.
+		const __m256i rg_lo = _mm256_unpacklo_epi8(r8, g8);
+		const __m256i rg_hi = _mm256_unpackhi_epi8(r8, g8);
+		const __m256i ba_lo = _mm256_unpacklo_epi8(b8, a8);
+		const __m256i ba_hi = _mm256_unpackhi_epi8(b8, a8);
+		const __m256i rgba0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+		const __m256i rgba1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+		const __m256i rgba2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+		const __m256i rgba3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+		uint8_t *dst = r_dst + x * 4;
+		_mm256_storeu_si256((__m256i *)(dst + 0), _mm256_permute2x128_si256(rgba0, rgba1, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + 32), _mm256_permute2x128_si256(rgba2, rgba3, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + 64), _mm256_permute2x128_si256(rgba0, rgba1, 0x31));
+		_mm256_storeu_si256((__m256i *)(dst + 96), _mm256_permute2x128_si256(rgba2, rgba3, 0x31));
+	}
+
+	if (x < p_width) {
+		_yuv_to_rgba_row_sse2(p_y + x, p_u + x / 2, p_v + x / 2, p_a ? p_a + x : nullptr, r_dst + x * 4, p_width - x, p_coefficients);
+	}
+}
+
+YUV_TARGET_AVX2 static inline __m128i _unit_float_to_half_avx2(__m256 p_value) {
+	const __m256 clamped = _mm256_min_ps(_mm256_max_ps(p_value, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	const __m256i bits = _mm256_castps_si256(clamped);
+	const __m256i rounding = _mm256_add_epi32(_mm256_set1_epi32(0x0FFF), _mm256_and_si256(_mm256_srli_epi32(bits, 13), _mm256_set1_epi32(1)));
+	__m256i half = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_add_epi32(bits, rounding), 13), _mm256_set1_epi32(112 << 10));
+	half = _mm256_and_si256(half, _mm256_castps_si256(_mm256_cmp_ps(clamped, _mm256_set1_ps(HALF_MIN_NORMAL), _CMP_GE_OQ)));
+	return _mm_packs_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+}
+
+YUV_TARGET_AVX2 static void _yuv16_to_rgbah_row_avx2(const uint16_t *p_y, const uint16_t *p_u, const uint16_t *p_v, uint16_t *r_dst, int p_width, const YUVFloatCoefficients &p_coefficients) {
+	const __m256 y_offset = _mm256_set1_ps(p_coefficients.y_offset);
+	const __m256 chroma_offset = _mm256_set1_ps(p_coefficients.chroma_offset);
+	const __m256 y_scale = _mm256_set1_ps(p_coefficients.y_scale);
+	const __m256 cr_r = _mm256_set1_ps(p_coefficients.cr_r);
+	const __m256 cb_g = _mm256_set1_ps(p_coefficients.cb_g);
+	const __m256 cr_g = _mm256_set1_ps(p_coefficients.cr_g);
+	const __m256 cb_b = _mm256_set1_ps(p_coefficients.cb_b);
+	const __m128i shift = _mm_cvtsi32_si128(p_coefficients.sample_shift);
+	const __m128i opaque = _mm_set1_epi16((short)HALF_ONE);
+
+	int x = 0;
+	for (; x + 8 <= p_width; x += 8) {
+		const __m128i y = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(p_y + x)), shift);
+		__m128i u = _mm_srl_epi16(_mm_loadl_epi64((const __m128i *)(p_u + x / 2)), shift);
+		__m128i v = _mm_srl_epi16(_mm_loadl_epi64((const __m128i *)(p_v + x / 2)), shift);
+		u = _mm_unpacklo_epi16(u, u);
+		v = _mm_unpacklo_epi16(v, v);
+
+		const __m256 yf = _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(y)), y_offset), y_scale);
+		const __m256 uf = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(u)), chroma_offset);
+		const __m256 vf = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)), chroma_offset);
+		const __m128i r = _unit_float_to_half_avx2(_mm256_add_ps(yf, _mm256_mul_ps(cr_r, vf)));
+		const __m128i g = _unit_float_to_half_avx2(_mm256_sub_ps(_mm256_sub_ps(yf, _mm256_mul_ps(cb_g, uf)), _mm256_mul_ps(cr_g, vf)));
+		const __m128i b = _unit_float_to_half_avx2(_mm256_add_ps(yf, _mm256_mul_ps(cb_b, uf)));
+		_store_rgbah_sse2(r_dst + x * 4, r, g, b, opaque);
+	}
+
+	if (x < p_width) {
+		_yuv16_to_rgbah_row_c(p_y + x, p_u + x / 2, p_v + x / 2, r_dst + x * 4, p_width - x, p_coefficients);
+	}
+}
+
+#endif // YUV_CPU_CONVERTER_X86
+
+#ifdef YUV_CPU_CONVERTER_NEON
+
+static inline int16x8_t _channel_neon(int16x8_t p_a, int16x8_t p_b, int16_t p_a_coefficient, int16_t p_b_coefficient) {
+	int32x4_t lo = vmull_n_s16(vget_low_s16(p_a), p_a_coefficient);
+	int32x4_t hi = vmull_n_s16(vget_high_s16(p_a), p_a_coefficient);
+	lo = vmlal_n_s16(lo, vget_low_s16(p_b), p_b_coefficient);
+	hi = vmlal_n_s16(hi, vget_high_s16(p_b), p_b_coefficient);
+	return vcombine_s16(vqrshrn_n_s32(lo, COEFFICIENT_BITS), vqrshrn_n_s32(hi, COEFFICIENT_BITS));
+}
+
+static inline int16x8_t _channel3_neon(int16x8_t p_a, int16x8_t p_b, int16x8_t p_c, int16_t p_a_coefficient, int16_t p_b_coefficient, int16_t p_c_coefficient) {
+	int32x4_t lo = vmull_n_s16(vget_low_s16(p_a), p_a_coefficient);
+	int32x4_t hi = vmull_n_s16(vget_high_s16(p_a), p_a_coefficient);
+	lo = vmlal_n_s16(lo, vget_low_s16(p_b), p_b_coefficient);
+	hi = vmlal_n_s16(hi, vget_high_s16(p_b), p_b_coefficient);
+	lo = vmlal_n_s16(lo, vget_low_s16(p_c), p_c_coefficient);
+	hi = vmlal_n_s16(hi, vget_high_s16(p_c), p_c_coefficient);
+	return vcombine_s16(vqrshrn_n_s32(lo, COEFFICIENT_BITS), vqrshrn_n_s32(hi, COEFFICIENT_BITS));
+}
+
+static void _yuv_to_rgba_row_neon(const uint8_t *p_y, const uint8_t *p_u, const uint8_t *p_v, const uint8_t *p_a, uint8_t *r_dst, int p_width, const YUVCoefficients &p_coefficients) {
+	const int16x8_t y_offset = vdupq_n_s16(p_coefficients.y_offset);
+	const int16x8_t chroma_offset = vdupq_n_s16(128);
+	const int16_t y_scale = p_coefficients.y_scale;
+
+	int x = 0;
+	for (; x + 16 <= p_width; x += 16) {
+		const uint8x16_t y = vld1q_u8(p_y + x);
+		const uint8x8x2_t u_pixels = vzip_u8(vld1_u8(p_u + x / 2), vld1_u8(p_u + x / 2));
+		const uint8x8x2_t v_pixels = vzip_u8(vld1_u8(p_v + x / 2), vld1_u8(p_v + x / 2));
+
+		uint8x16x4_t rgba;
+		int16x8_t r[2], g[2], b[2];
+		for (int half = 0; half < 2; half++) {
+			const int16x8_t y16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(half == 0 ? vget_low_u8(y) : vget_high_u8(y))), y_offset);
+			const int16x8_t u16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u_pixels.val[half])), chroma_offset);
+			const int16x8_t v16 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v_pixels.val[half])), chroma_offset);
+			r[half] = _channel_neon(y16, v16, y_scale, p_coefficients.cr_r);
+			g[half] = _channel3_neon(y16, u16, v16, y_scale, -p_coefficients.cb_g, -p_coefficients.cr_g);
+			b[half] = _channel_neon(y16, u16, y_scale, p_coefficients.cb_b);
+		}
+		rgba.val[0] = vcombine_u8(vqmovun_s16(r[0]), vqmovun_s16(r[1]));
+		rgba.val[1] = vcombine_u8(vqmovun_s16(g[0]), vqmovun_s16(g[1]));
+		rgba.val[2] = vcombine_u8(vqmovun_s16(b[0]), vqmovun_s16(b[1]));
+		rgba.val[3] = p_a ? vld1q_u8(p_a + x) : vdupq_n_u8(255);
+		vst4q_u8(r_dst + x * 4, rgba);
+	}
+
+	if (x < p_width) {
+		_yuv_to_rgba_row_c(p_y + x, p_u + x / 2, p_v + x / 2, p_a ? p_a + x : nullptr, r_dst + x * 4, p_width - x, p_coefficients);
+	}
+}
+
+static inline uint16x4_t _unit_float_to_half_neon(float32x4_t p_value) {
+	const float32x4_t clamped = vminq_f32(vmaxq_f32(p_value, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+	const uint32x4_t bits = vreinterpretq_u32_f32(clamped);
+	const uint32x4_t rounding = vaddq_u32(vdupq_n_u32(0x0FFF), vandq_u32(vshrq_n_u32(bits, 13), vdupq_n_u32(1)));
+	const uint32x4_t half = vsubq_u32(vshrq_n_u32(vaddq_u32(bits, rounding), 13), vdupq_n_u32(112 << 10));
+	return vmovn_u32(vandq_u32(half, vcgeq_f32(clamped, vdupq_n_f32(HALF_MIN_NORMAL))));
+}
+
+static void _yuv16_to_rgbah_row_neon(const uint16_t *p_y, const uint16_t *p_u, const uint16_t *p_v, uint16_t *r_dst, int p_width, const YUVFloatCoefficients &p_coefficients) {
+	const float32x4_t y_offset = vdupq_n_f32(p_coefficients.y_offset);
+	const float32x4_t chroma_offset = vdupq_n_f32(p_coefficients.chroma_offset);
+	const float32x4_t y_scale = vdupq_n_f32(p_coefficients.y_scale);
+	const int16x8_t shift = vdupq_n_s16(-p_coefficients.sample_shift);
+	const int16x4_t chroma_shift = vdup_n_s16(-p_coefficients.sample_shift);
+
+	int x = 0;
+	for (; x + 8 <= p_width; x += 8) {
+		const uint16x8_t y = vshlq_u16(vld1q_u16(p_y + x), shift);
+		const uint16x4_t u = vshl_u16(vld1_u16(p_u + x / 2), chroma_shift);
+		const uint16x4_t v = vshl_u16(vld1_u16(p_v + x / 2), chroma_shift);
+		const uint16x4x2_t u_pixels = vzip_u16(u, u);
+		const uint16x4x2_t v_pixels = vzip_u16(v, v);
+
+		uint16x4_t r[2], g[2], b[2];
+		for (int half = 0; half < 2; half++) {
+			const float32x4_t yf = vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(half == 0 ? vget_low_u16(y) : vget_high_u16(y))), y_offset), y_scale);
+			const float32x4_t uf = vsubq_f32(vcvtq_f32_u32(vmovl_u16(u_pixels.val[half])), chroma_offset);
+			const float32x4_t vf = vsubq_f32(vcvtq_f32_u32(vmovl_u16(v_pixels.val[half])), chroma_offset);
+			r[half] = _unit_float_to_half_neon(vaddq_f32(yf, vmulq_n_f32(vf, p_coefficients.cr_r)));
+			g[half] = _unit_float_to_half_neon(vsubq_f32(vsubq_f32(yf, vmulq_n_f32(uf, p_coefficients.cb_g)), vmulq_n_f32(vf, p_coefficients.cr_g)));
+			b[half] = _unit_float_to_half_neon(vaddq_f32(yf, vmulq_n_f32(uf, p_coefficients.cb_b)));
+		}
+		uint16x8x4_t rgba;
+		rgba.val[0] = vcombine_u16(r[0], r[1]);
+		rgba.val[1] = vcombine_u16(g[0], g[1]);
+		rgba.val[2] = vcombine_u16(b[0], b[1]);
+		rgba.val[3] = vdupq_n_u16(HALF_ONE);
+		vst4q_u16(r_dst + x * 4, rgba);
+	}
+
+	if (x < p_width) {
+		_yuv16_to_rgbah_row_c(p_y + x, p_u + x / 2, p_v + x / 2, r_dst + x * 4, p_width - x, p_coefficients);
+	}
+}
+
+#endif // YUV_CPU_CONVERTER_NEON
+
+YUVCPUConverter::Matrix YUVCPUConverter::_get_frame_matrix(const AVFrame *p_frame, bool &r_full_range) {
+	r_full_range = p_frame->color_range == AVCOL_RANGE_JPEG || p_frame->format == AV_PIX_FMT_YUVJ420P;
+	if (p_frame->colorspace == AVCOL_SPC_BT709) {
+		return MATRIX_BT709;
+	}
+	if (p_frame->colorspace == AVCOL_SPC_BT2020_NCL || p_frame->colorspace == AVCOL_SPC_BT2020_CL) {
+		// The constant luminance variant isn't a plain matrix, the non-constant one is the closest we can do.
+		return MATRIX_BT2020;
+	}
+	if (p_frame->colorspace == AVCOL_SPC_UNSPECIFIED && p_frame->height >= 720) {
+		// Untagged HD content is almost always BT.709.
+		return MATRIX_BT709;
+	}
+	return MATRIX_BT601;
+}
+
+void YUVCPUConverter::_get_matrix_weights(Matrix p_matrix, double &r_kr, double &r_kb) {
+	switch (p_matrix) {
+		case MATRIX_BT709: {
+			r_kr = 0.2126;
+			r_kb = 0.0722;
+		} break;
+		case MATRIX_BT2020: {
+			r_kr = 0.2627;
+			r_kb = 0.0593;
+		} break;
+		default: {
+			r_kr = 0.299;
+			r_kb = 0.114;
+		} break;
+	}
+}
+
+YUVCoefficients YUVCPUConverter::get_coefficients(Matrix p_matrix, bool p_full_range) {
+	double kr;
+	double kb;
+	_get_matrix_weights(p_matrix, kr, kb);
+	const double kg = 1.0 - kr - kb;
+	// Limited range stretches luma from [16, 235] and chroma from [16, 240].
+	const double y_scale = p_full_range ? 1.0 : 255.0 / 219.0;
+	const double c_scale = p_full_range ? 1.0 : 255.0 / 224.0;
+	const double one = 1 << COEFFICIENT_BITS;
+
+	YUVCoefficients coefficients;
+	coefficients.y_offset = p_full_range ? 0 : 16;
+	coefficients.y_scale = (int32_t)std::lround(y_scale * one);
+	coefficients.cr_r = (int32_t)std::lround(2.0 * (1.0 - kr) * c_scale * one);
+	coefficients.cb_g = (int32_t)std::lround(2.0 * kb * (1.0 - kb) / kg * c_scale * one);
+	coefficients.cr_g = (int32_t)std::lround(2.0 * kr * (1.0 - kr) / kg * c_scale * one);
+	coefficients.cb_b = (int32_t)std::lround(2.0 * (1.0 - kb) * c_scale * one);
+	return coefficients;
+}
+
+YUVFloatCoefficients YUVCPUConverter::get_float_coefficients(Matrix p_matrix, bool p_full_range, int p_bit_depth, int p_sample_shift) {
+	double kr;
+	double kb;
+	_get_matrix_weights(p_matrix, kr, kb);
+	const double kg = 1.0 - kr - kb;
+	// Same ranges as the 8-bit case, scaled up to the bit depth.
+	const int depth_shift = p_bit_depth - 8;
+	const double max_value = (1 << p_bit_depth) - 1;
+	const double y_scale = p_full_range ? 1.0 / max_value : 1.0 / (219 << depth_shift);
+	const double c_scale = p_full_range ? 1.0 / max_value : 1.0 / (224 << depth_shift);
+
+	YUVFloatCoefficients coefficients;
+	coefficients.y_offset = p_full_range ? 0.0f : (float)(16 << depth_shift);
+	coefficients.chroma_offset = (float)(1 << (p_bit_depth - 1));
+	coefficients.y_scale = (float)y_scale;
+	coefficients.cr_r = (float)(2.0 * (1.0 - kr) * c_scale);
+	coefficients.cb_g = (float)(2.0 * kb * (1.0 - kb) / kg * c_scale);
+	coefficients.cr_g = (float)(2.0 * kr * (1.0 - kr) / kg * c_scale);
+	coefficients.cb_b = (float)(2.0 * (1.0 - kb) * c_scale);
+	coefficients.sample_shift = p_sample_shift;
+	return coefficients;
+}
+
+bool YUVCPUConverter::is_supported_format(int p_pixel_format) {
+	switch (p_pixel_format) {
+		case AV_PIX_FMT_YUV420P:
+		case AV_PIX_FMT_YUVJ420P:
+		case AV_PIX_FMT_YUVA420P:
+		case AV_PIX_FMT_NV12:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool YUVCPUConverter::is_supported_high_bit_depth_format(int p_pixel_format) {
+	switch (p_pixel_format) {
+		case AV_PIX_FMT_YUV420P10LE:
+		case AV_PIX_FMT_YUV420P12LE:
+		case AV_PIX_FMT_P010LE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+YUVToRGBARowFunc YUVCPUConverter::get_row_func(int p_cpu_flags) {
+#ifdef YUV_CPU_CONVERTER_X86
+	if (p_cpu_flags & AV_CPU_FLAG_AVX2) {
+		return _yuv_to_rgba_row_avx2;
+	}
+	if (p_cpu_flags & AV_CPU_FLAG_SSE2) {
+		return _yuv_to_rgba_row_sse2;
+	}
+#endif
+#ifdef YUV_CPU_CONVERTER_NEON
+	if (p_cpu_flags & AV_CPU_FLAG_NEON) {
+		return _yuv_to_rgba_row_neon;
+	}
+#endif
+	return _yuv_to_rgba_row_c;
+}
+
+YUV16ToRGBAHRowFunc YUVCPUConverter::get_high_bit_depth_row_func(int p_cpu_flags) {
+#ifdef YUV_CPU_CONVERTER_X86
+	if (p_cpu_flags & AV_CPU_FLAG_AVX2) {
+		return _yuv16_to_rgbah_row_avx2;
+	}
+	if (p_cpu_flags & AV_CPU_FLAG_SSE2) {
+		return _yuv16_to_rgbah_row_sse2;
+	}
+#endif
+#ifdef YUV_CPU_CONVERTER_NEON
+	if (p_cpu_flags & AV_CPU_FLAG_NEON) {
+		return _yuv16_to_rgbah_row_neon;
+	}
+#endif
+	return _yuv16_to_rgbah_row_c;
+}
+
+const char *YUVCPUConverter::get_row_func_name(int p_cpu_flags) {
+	YUVToRGBARowFunc func = get_row_func(p_cpu_flags);
+#ifdef YUV_CPU_CONVERTER_X86
+	if (func == _yuv_to_rgba_row_avx2) {
+		return "AVX2";
+	}
+	if (func == _yuv_to_rgba_row_sse2) {
+		return "SSE2";
+	}
+#endif
+#ifdef YUV_CPU_CONVERTER_NEON
+	if (func == _yuv_to_rgba_row_neon) {
+		return "NEON";
+	}
+#endif
+	return "C";
+}
+
+void YUVCPUConverter::convert(const AVFrame *p_frame, uint8_t *r_dst, int p_dst_stride, int p_row_start, int p_row_end) const {
+	bool full_range;
+	const Matrix matrix = _get_frame_matrix(p_frame, full_range);
+	const YUVCoefficients coefficients = get_coefficients(matrix, full_range);
+
+	const int width = p_frame->width;
+	const bool is_nv12 = p_frame->format == AV_PIX_FMT_NV12;
+	const bool has_alpha = p_frame->format == AV_PIX_FMT_YUVA420P;
+	if (p_row_end < 0 || p_row_end > p_frame->height) {
+		p_row_end = p_frame->height;
+	}
+
+	for (int y = p_row_start; y < p_row_end; y++) {
+		const uint8_t *luma = p_frame->data[0] + y * p_frame->linesize[0];
+		const uint8_t *alpha = has_alpha ? p_frame->data[3] + y * p_frame->linesize[3] : nullptr;
+		uint8_t *dst = r_dst + y * p_dst_stride;
+		if (!is_nv12) {
+			const uint8_t *u = p_frame->data[1] + (y / 2) * p_frame->linesize[1];
+			const uint8_t *v = p_frame->data[2] + (y / 2) * p_frame->linesize[2];
+			row_func(luma, u, v, alpha, dst, width, coefficients);
+			continue;
+		}
+
+		// Split the interleaved chroma into planar blocks on the stack, which keeps this function reentrant.
+		const uint8_t *uv = p_frame->data[1] + (y / 2) * p_frame->linesize[1];
+		uint8_t u[NV12_BLOCK_WIDTH / 2];
+		uint8_t v[NV12_BLOCK_WIDTH / 2];
+		for (int x = 0; x < width; x += NV12_BLOCK_WIDTH) {
+			const int block_width = std::min(NV12_BLOCK_WIDTH, width - x);
+			const int block_chroma_width = (block_width + 1) / 2;
+			const uint8_t *block_uv = uv + x;
+			for (int i = 0; i < block_chroma_width; i++) {
+				u[i] = block_uv[i * 2];
+				v[i] = block_uv[i * 2 + 1];
+			}
+			row_func(luma + x, u, v, nullptr, dst + x * 4, block_width, coefficients);
+		}
+	}
+}
+
+void YUVCPUConverter::convert_high_bit_depth(const AVFrame *p_frame, uint8_t *r_dst, int p_dst_stride, int p_row_start, int p_row_end) const {
+	bool full_range;
+	const Matrix matrix = _get_frame_matrix(p_frame, full_range);
+	const bool is_p010 = p_frame->format == AV_PIX_FMT_P010LE;
+	const int bit_depth = p_frame->format == AV_PIX_FMT_YUV420P12LE ? 12 : 10;
+	// P010 keeps its 10 bits in the top of each 16-bit sample.
+	const YUVFloatCoefficients coefficients = get_float_coefficients(matrix, full_range, bit_depth, is_p010 ? 6 : 0);
+
+	const int width = p_frame->width;
+	if (p_row_end < 0 || p_row_end > p_frame->height) {
+		p_row_end = p_frame->height;
+	}
+
+	for (int y = p_row_start; y < p_row_end; y++) {
+		const uint16_t *luma = (const uint16_t *)(p_frame->data[0] + y * p_frame->linesize[0]);
+		uint16_t *dst = (uint16_t *)(r_dst + y * p_dst_stride);
+		if (!is_p010) {
+			const uint16_t *u = (const uint16_t *)(p_frame->data[1] + (y / 2) * p_frame->linesize[1]);
+			const uint16_t *v = (const uint16_t *)(p_frame->data[2] + (y / 2) * p_frame->linesize[2]);
+			row16_func(luma, u, v, dst, width, coefficients);
+			continue;
+		}
+
+		const uint16_t *uv = (const uint16_t *)(p_frame->data[1] + (y / 2) * p_frame->linesize[1]);
+		uint16_t u[NV12_BLOCK_WIDTH / 2];
+		uint16_t v[NV12_BLOCK_WIDTH / 2];
+		for (int x = 0; x < width; x += NV12_BLOCK_WIDTH) {
+			const int block_width = std::min(NV12_BLOCK_WIDTH, width - x);
+			const int block_chroma_width = (block_width + 1) / 2;
+			const uint16_t *block_uv = uv + x;
+			for (int i = 0; i < block_chroma_width; i++) {
+				u[i] = block_uv[i * 2];
+				v[i] = block_uv[i * 2 + 1];
+			}
+			row16_func(luma + x, u, v, dst + x * 4, block_width, coefficients);
+		}
+	}
+}
+
+// Only handles zero and normal numbers, which is all _unit_float_to_half produces.
+static inline float _half_to_float(uint16_t p_half) {
+	if ((p_half & 0x7FFF) == 0) {
+		return 0.0f;
+	}
+	const uint32_t bits = ((uint32_t)(p_half & 0x8000) << 16) | ((((p_half >> 10) & 0x1F) + 112) << 23) | ((uint32_t)(p_half & 0x3FF) << 13);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Triangle wave over the legal chroma range [16, 240], one code per step.
+static inline int _check_frame_chroma(int p_position) {
+	const int period = 2 * 224;
+	const int phase = p_position % period;
+	return 16 + (phase < 224 ? phase : period - phase);
+}
+
+// Luma sweeps its range every few pixels. Chroma changes by one 8-bit code per sample, so swscale's chroma
+// interpolation barely matters and the comparison comes down to the matrix, the rounding and the clamping.
+// Both stay within the legal range, swscale overflows on colors that are far out of gamut.
+static AVFrame *_make_check_frame(int p_width, int p_height, AVPixelFormat p_format, int p_bit_depth) {
+	AVFrame *frame = av_frame_alloc();
+	if (frame == nullptr) {
+		return nullptr;
+	}
+	frame->width = p_width;
+	frame->height = p_height;
+	frame->format = p_format;
+	frame->colorspace = AVCOL_SPC_BT709;
+	frame->color_range = AVCOL_RANGE_MPEG;
+	if (av_frame_get_buffer(frame, 0) < 0) {
+		av_frame_free(&frame);
+		return nullptr;
+	}
+
+	const int depth_shift = p_bit_depth - 8;
+	for (int y = 0; y < p_height; y++) {
+		for (int x = 0; x < p_width; x++) {
+			const int luma = (16 + (x * 5 + y * 3) % 220) << depth_shift;
+			if (p_bit_depth > 8) {
+				((uint16_t *)(frame->data[0] + y * frame->linesize[0]))[x] = luma;
+			} else {
+				frame->data[0][y * frame->linesize[0] + x] = luma;
+			}
+		}
+	}
+	for (int y = 0; y < (p_height + 1) / 2; y++) {
+		for (int x = 0; x < (p_width + 1) / 2; x++) {
+			const int u = _check_frame_chroma(x) << depth_shift;
+			const int v = _check_frame_chroma(y + x / 8) << depth_shift;
+			if (p_bit_depth > 8) {
+				((uint16_t *)(frame->data[1] + y * frame->linesize[1]))[x] = u;
+				((uint16_t *)(frame->data[2] + y * frame->linesize[2]))[x] = v;
+			} else {
+				frame->data[1][y * frame->linesize[1] + x] = u;
+				frame->data[2][y * frame->linesize[2] + x] = v;
+			}
+		}
+	}
+	return frame;
+}
+
+static bool _convert_with_swscale(const AVFrame *p_frame, AVPixelFormat p_dst_format, uint8_t *r_dst, int p_dst_stride) {
+	// Point sampling and full chroma interpolation keep swscale from filtering the chroma, which the kernels don't do either.
+	SwsContext *context = sws_getContext(p_frame->width, p_frame->height, (AVPixelFormat)p_frame->format, p_frame->width, p_frame->height, p_dst_format, SWS_POINT | SWS_ACCURATE_RND | SWS_FULL_CHR_H_INT | SWS_BITEXACT, nullptr, nullptr, nullptr);
+	if (context == nullptr) {
+		return false;
+	}
+	const int *coefficients = sws_getCoefficients(SWS_CS_ITU709);
+	sws_setColorspaceDetails(context, coefficients, 0, coefficients, 1, 0, 1 << 16, 1 << 16);
+	uint8_t *dst_data[4] = { r_dst, nullptr, nullptr, nullptr };
+	int dst_linesize[4] = { p_dst_stride, 0, 0, 0 };
+	sws_scale(context, p_frame->data, p_frame->linesize, 0, p_frame->height, dst_data, dst_linesize);
+	sws_freeContext(context);
+	return true;
+}
+
+int YUVCPUConverter::check_kernels(int p_width, int p_height, YUVKernelCheck *r_checks) {
+	// swscale places chroma slightly differently for odd sizes.
+	p_width &= ~1;
+	p_height &= ~1;
+	if (p_width < 2 || p_height < 2) {
+		return 0;
+	}
+	const int cpu_flags = av_get_cpu_flags();
+	// Every instruction set the kernels are written for, flags the CPU doesn't have are skipped.
+	static const int kernel_cpu_flags[] = { 0, AV_CPU_FLAG_SSE2, AV_CPU_FLAG_AVX2, AV_CPU_FLAG_NEON };
+	int check_count = 0;
+
+	for (int high_bit_depth = 0; high_bit_depth < 2; high_bit_depth++) {
+		const int bytes_per_pixel = high_bit_depth ? 8 : 4;
+		const int stride = p_width * bytes_per_pixel;
+		AVFrame *frame = _make_check_frame(p_width, p_height, high_bit_depth ? AV_PIX_FMT_YUV420P10LE : AV_PIX_FMT_YUV420P, high_bit_depth ? 10 : 8);
+		uint8_t *reference = (uint8_t *)av_malloc((size_t)stride * p_height);
+		uint8_t *output = (uint8_t *)av_malloc((size_t)stride * p_height);
+		const bool has_reference = frame != nullptr && reference != nullptr && output != nullptr &&
+				_convert_with_swscale(frame, high_bit_depth ? AV_PIX_FMT_RGBA64LE : AV_PIX_FMT_RGBA, reference, stride);
+
+		const void *checked_kernels[MAX_KERNEL_CHECKS / 2] = {};
+		int checked_kernel_count = 0;
+		for (int i = 0; has_reference && i < (int)(sizeof(kernel_cpu_flags) / sizeof(kernel_cpu_flags[0])); i++) {
+			const int flags = kernel_cpu_flags[i];
+			if ((cpu_flags & flags) != flags) {
+				continue;
+			}
+			YUVCPUConverter converter;
+			converter.row_func = get_row_func(flags);
+			converter.row16_func = get_high_bit_depth_row_func(flags);
+			const void *kernel = high_bit_depth ? (const void *)converter.row16_func : (const void *)converter.row_func;
+			if (std::find(checked_kernels, checked_kernels + checked_kernel_count, kernel) != checked_kernels + checked_kernel_count) {
+				continue;
+			}
+			checked_kernels[checked_kernel_count++] = kernel;
+
+			YUVKernelCheck &check = r_checks[check_count++];
+			check.name = get_row_func_name(flags);
+			check.high_bit_depth = high_bit_depth;
+
+			int64_t runs = 0;
+			int64_t elapsed_usec = 0;
+			const int64_t start_usec = av_gettime_relative();
+			do {
+				if (high_bit_depth) {
+					converter.convert_high_bit_depth(frame, output, stride);
+				} else {
+					converter.convert(frame, output, stride);
+				}
+				runs++;
+				elapsed_usec = av_gettime_relative() - start_usec;
+			} while (elapsed_usec < KERNEL_CHECK_DURATION_USEC);
+			// Pixels per microsecond are megapixels per second.
+			check.megapixels_per_second = (double)p_width * p_height * runs / std::max(elapsed_usec, (int64_t)1);
+
+			double max_error = 0.0;
+			for (int y = 0; y < p_height; y++) {
+				if (high_bit_depth) {
+					const uint16_t *output_row = (const uint16_t *)(output + y * stride);
+					const uint16_t *reference_row = (const uint16_t *)(reference + y * stride);
+					for (int c = 0; c < p_width * 4; c++) {
+						max_error = std::max(max_error, std::abs(_half_to_float(output_row[c]) - reference_row[c] / 65535.0) * 255.0);
+					}
+				} else {
+					const uint8_t *output_row = output + y * stride;
+					const uint8_t *reference_row = reference + y * stride;
+					for (int c = 0; c < p_width * 4; c++) {
+						max_error = std::max(max_error, (double)std::abs(output_row[c] - reference_row[c]));
+					}
+				}
+			}
+			check.max_error = max_error;
+			check.passed = max_error <= KERNEL_CHECK_TOLERANCE;
+		}
+
+		av_frame_free(&frame);
+		av_free(reference);
+		av_free(output);
+	}
+	return check_count;
+}
+
+YUVCPUConverter::YUVCPUConverter() {
+	const int cpu_flags = av_get_cpu_flags();
+	row_func = get_row_func(cpu_flags);
+	row16_func = get_high_bit_depth_row_func(cpu_flags);
+}
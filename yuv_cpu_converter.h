@@ -0,0 +1,123 @@
+/**************************************************************************/
+/*  yuv_cpu_converter.h                                                   */
+/**************************************************************************/
+/*                         This file is part of:                          */
+/*                             EIRTeam.FFmpeg                             */
+/*                         https://ph.eirteam.moe                         */
+/**************************************************************************/
+/* Copyright (c) 2023-present Álex Román (EIRTeam) & contributors.        */
+/*                                                                        */
+/*                                                                        */
+/* Permission is hereby granted, free of charge, to any person obtaining  */
+/* a copy of this software and associated documentation files (the        */
+/* "Software"), to deal in the Software without restriction, including    */
+/* without limitation the rights to use, copy, modify, merge, publish,    */
+/* distribute, sublicense, and/or sell copies of the Software, and to     */
+/* permit persons to whom the Software is furnished to do so, subject to  */
+/* the following conditions:                                              */
+/*                                                                        */
+/* The above copyright notice and this permission notice shall be         */
+/* included in all copies or substantial portions of the Software.        */
+/*                                                                        */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,        */
+/* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF     */
+/* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. */
+/* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY   */
+/* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,   */
+/* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE      */
+/* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                 */
+/**************************************************************************/
+
+#ifndef YUV_CPU_CONVERTER_H
+#define YUV_CPU_CONVERTER_H
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/pixfmt.h"
+}
+
+#include <cstdint>
+
+// Fixed point (Q13) YUV to RGB coefficients for a given matrix and range.
+struct YUVCoefficients {
+	int32_t y_offset;
+	int32_t y_scale;
+	int32_t cr_r;
+	int32_t cb_g;
+	int32_t cr_g;
+	int32_t cb_b;
+};
+
+// Normalized coefficients for high bit depth YUV, the results land in [0, 1].
+struct YUVFloatCoefficients {
+	float y_offset;
+	float chroma_offset;
+	float y_scale;
+	float cr_r;
+	float cb_g;
+	float cr_g;
+	float cb_b;
+	// Right shift bringing the samples down to their bit depth, for formats that store them MSB aligned (P010).
+	int sample_shift;
+};
+
+// Converts one row of 4:2:0 YUV(A) into tightly packed RGBA, the chroma rows hold (p_width + 1) / 2 samples.
+// p_a may be null, in which case the output is opaque.
+typedef void (*YUVToRGBARowFunc)(const uint8_t *p_y, const uint8_t *p_u, const uint8_t *p_v, const uint8_t *p_a, uint8_t *r_dst, int p_width, const YUVCoefficients &p_coefficients);
+// Same as YUVToRGBARowFunc for 16-bit samples, the output is opaque half float RGBA.
+typedef void (*YUV16ToRGBAHRowFunc)(const uint16_t *p_y, const uint16_t *p_u, const uint16_t *p_v, uint16_t *r_dst, int p_width, const YUVFloatCoefficients &p_coefficients);
+
+// Result of checking one row conversion kernel against sws_scale.
+struct YUVKernelCheck {
+	const char *name = nullptr;
+	bool high_bit_depth = false;
+	// Largest difference from sws_scale over every channel of every pixel, in steps of 1/255 for both kinds of kernel.
+	double max_error = 0.0;
+	double megapixels_per_second = 0.0;
+	bool passed = false;
+};
+
+// CPU YUV to RGBA conversion for when there is no RenderingDevice to run YUVGPUConverter on.
+// The row conversion is picked at runtime from the best SIMD instruction set the CPU supports.
+class YUVCPUConverter {
+public:
+	enum Matrix {
+		MATRIX_BT601,
+		MATRIX_BT709,
+		MATRIX_BT2020,
+	};
+
+private:
+	YUVToRGBARowFunc row_func = nullptr;
+	YUV16ToRGBAHRowFunc row16_func = nullptr;
+
+	static Matrix _get_frame_matrix(const AVFrame *p_frame, bool &r_full_range);
+	static void _get_matrix_weights(Matrix p_matrix, double &r_kr, double &r_kb);
+
+public:
+	static YUVCoefficients get_coefficients(Matrix p_matrix, bool p_full_range);
+	static YUVFloatCoefficients get_float_coefficients(Matrix p_matrix, bool p_full_range, int p_bit_depth, int p_sample_shift);
+	static bool is_supported_format(int p_pixel_format);
+	// 10 and 12-bit formats, which convert_high_bit_depth turns into half float RGBA.
+	static bool is_supported_high_bit_depth_format(int p_pixel_format);
+	static YUVToRGBARowFunc get_row_func(int p_cpu_flags);
+	static YUV16ToRGBAHRowFunc get_high_bit_depth_row_func(int p_cpu_flags);
+	static const char *get_row_func_name(int p_cpu_flags);
+
+	// Largest max_error check_kernels accepts. The kernels sample chroma without interpolating and round differently from swscale.
+	static constexpr double KERNEL_CHECK_TOLERANCE = 2.0;
+	static constexpr int MAX_KERNEL_CHECKS = 8;
+	// Converts a synthetic BT.709 limited range frame with every kernel this CPU can run, 8-bit and high bit depth,
+	// compares the output against sws_scale and measures the throughput. Returns the number of entries written to r_checks.
+	static int check_kernels(int p_width, int p_height, YUVKernelCheck *r_checks);
+
+	// Converts rows [p_row_start, p_row_end) of the frame, matrix and range are taken from the frame's colorspace fields.
+	// A negative p_row_end means up to the last row. Rows are independent so disjoint ranges can be converted concurrently.
+	void convert(const AVFrame *p_frame, uint8_t *r_dst, int p_dst_stride, int p_row_start = 0, int p_row_end = -1) const;
+	// Same as convert(), for the high bit depth formats. The output has 8 bytes per pixel, half float RGBA.
+	void convert_high_bit_depth(const AVFrame *p_frame, uint8_t *r_dst, int p_dst_stride, int p_row_start = 0, int p_row_end = -1) const;
+
+	YUVCPUConverter();
+};
+
+#endif // YUV_CPU_CONVERTER_H
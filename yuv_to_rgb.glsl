@@ -4,27 +4,62 @@
 // Invocations in the (x, y, z) dimension
 layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
 
-// Our textures
-layout(r8, set = 0, binding = 0) uniform restrict readonly image2D tex_y;
-layout(r8, set = 1, binding = 0) uniform restrict readonly image2D tex_u;
-layout(r8, set = 2, binding = 0) uniform restrict readonly image2D tex_v;
-layout(r8, set = 3, binding = 0) uniform restrict readonly image2D tex_a;
-layout(rgba8, set = 4, binding = 0) uniform restrict writeonly image2D output_image;
+// All planes of the frame, tightly packed one after another, 4 bytes per uint.
+layout(set = 0, binding = 0, std430) restrict readonly buffer YUVData {
+	uint data[];
+}
+yuv_data;
+// The format qualifier is replaced at runtime to match the output texture (rgba16, rgb10_a2).
+layout(rgba8, set = 1, binding = 0) uniform restrict writeonly image2D output_image;
 
 layout(push_constant, std430) uniform Params {
+	// Byte offsets of the Y, U, V and A planes.
+	uvec4 plane_offsets;
+	uint luma_stride;
+	// In bytes, for interleaved chroma this covers both U and V.
+	uint chroma_stride;
+	// log2 of the chroma subsampling.
+	uint chroma_shift_x;
+	uint chroma_shift_y;
+	// U and V share the plane at plane_offsets.y, as in NV12.
+	bool interleaved_chroma;
 	bool use_alpha;
+	// 2 for high bit depth formats, which store each sample as a little endian 16-bit value.
+	uint bytes_per_sample;
+	// Right shift for samples stored MSB aligned, as in P010.
+	uint sample_shift;
+	uint bit_depth;
+	uint padding_0;
+	uint padding_1;
+	uint padding_2;
 }
 params;
 
+float read_plane(uint p_plane_offset, uint p_stride, ivec2 p_pos) {
+	uint byte_index = p_plane_offset + uint(p_pos.y) * p_stride + uint(p_pos.x) * params.bytes_per_sample;
+	uint word = yuv_data.data[byte_index >> 2];
+	uint sample_mask = (1u << (params.bytes_per_sample * 8u)) - 1u;
+	uint value = ((word >> ((byte_index & 3u) * 8u)) & sample_mask) >> params.sample_shift;
+	return float(value) / float((1u << params.bit_depth) - 1u);
+}
+
 // The code we want to execute in each invocation
 void main() {
 	ivec2 uv = ivec2(gl_GlobalInvocationID.xy);
-	ivec2 uv_chroma = ivec2(gl_GlobalInvocationID.xy) / 2;
+	if (any(greaterThanEqual(uv, imageSize(output_image)))) {
+		return;
+	}
+	ivec2 uv_chroma = ivec2(uv.x >> params.chroma_shift_x, uv.y >> params.chroma_shift_y);
 
-	float y = imageLoad(tex_y, uv).r;
+	float y = read_plane(params.plane_offsets.x, params.luma_stride, uv);
 	vec2 chroma;
-	chroma.r = imageLoad(tex_u, uv_chroma).r;
-	chroma.g = imageLoad(tex_v, uv_chroma).r;
+	if (params.interleaved_chroma) {
+		chroma.r = read_plane(params.plane_offsets.y, params.chroma_stride, ivec2(uv_chroma.x * 2, uv_chroma.y));
+		chroma.g = read_plane(params.plane_offsets.y, params.chroma_stride, ivec2(uv_chroma.x * 2 + 1, uv_chroma.y));
+	} else {
+		chroma.r = read_plane(params.plane_offsets.y, params.chroma_stride, uv_chroma);
+		chroma.g = read_plane(params.plane_offsets.z, params.chroma_stride, uv_chroma);
+	}
 	float u = chroma.r - 0.5;
 	float v = chroma.g - 0.5;
 	vec4 rgba;
@@ -32,9 +67,9 @@ void main() {
 	rgba.g = y - (0.344 * u) - (0.714 * v);
 	rgba.b = y + (1.770 * u);
 	if (params.use_alpha) {
-		rgba.a = imageLoad(tex_a, uv).r;
+		rgba.a = read_plane(params.plane_offsets.w, params.luma_stride, uv);
 	} else {
 		rgba.a = 1.0;
 	}
 	imageStore(output_image, uv, rgba);
-}
\ No newline at end of file
+}